@@ -20,6 +20,8 @@ struct ast_channel *sccp_channel_tech_requester(struct sccp_line *line, const ch
 /*!
  * \brief Partial implementation of ast_channel_tech::devicestate.
  *
+ * Return the last device state published for the line, without locking the device.
+ *
  * \note This function CAN'T be used directly in an ast_channel_tech. You must first obtain a sccp_line,
  *       and then call this function with it.
  */
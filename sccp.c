@@ -10,11 +10,16 @@
 
 #include "device/sccp_channel_tech.h"
 #include "device/sccp_rtp_glue.h"
+#include "sccp_admission.h"
+#include "sccp_blf_hub.h"
+#include "sccp_db_cache.h"
 #include "sccp_debug.h"
+#include "sccp_mwi_router.h"
 #include "sccp_config.h"
 #include "sccp_device.h"
 #include "sccp_device_registry.h"
 #include "sccp_msg.h"
+#include "sccp_queue.h"
 #include "sccp_server.h"
 #include "sccp_utils.h"
 
@@ -26,6 +31,7 @@ struct ast_sched_context *sccp_sched;
 const struct ast_module_info *sccp_module_info;
 
 static struct sccp_device_registry *global_registry;
+static struct sccp_admission *global_admission;
 static struct sccp_server *global_server;
 
 enum find_line_result {
@@ -172,19 +178,27 @@ static int reset_all_devices(enum sccp_reset_type type)
 	return 0;
 }
 
+static int reset_prefix_devices(const char *prefix, enum sccp_reset_type type)
+{
+	return sccp_device_registry_do_prefix(global_registry, prefix, reset_registry_callback, &type) > 0 ? 0 : -1;
+}
+
 static char *cli_reset_device(struct ast_cli_entry *e, int cmd, struct ast_cli_args *a)
 {
 	static const char * const choices[] = { "restart", NULL };
 	const char *name;
 	enum sccp_reset_type type;
+	char *prefix;
+	size_t len;
 	int ret;
 
 	switch (cmd) {
 	case CLI_INIT:
 		e->command = "sccp reset";
 		e->usage =
-			"Usage: sccp reset <device|all> [restart]\n"
-			"       Reset one or all SCCP device, optionally with a full restart.\n";
+			"Usage: sccp reset <device|prefix*|all> [restart]\n"
+			"       Reset one SCCP device, the devices whose name starts with prefix,\n"
+			"       or all SCCP devices, optionally with a full restart.\n";
 		return NULL;
 	case CLI_GENERATE:
 		if (a->pos == 2) {
@@ -208,8 +222,13 @@ static char *cli_reset_device(struct ast_cli_entry *e, int cmd, struct ast_cli_a
 		type = SCCP_RESET_SOFT;
 	}
 
+	len = strlen(name);
 	if (!strcasecmp(name, "all")) {
 		ret = reset_all_devices(type);
+	} else if (len && name[len - 1] == '*') {
+		prefix = ast_strdupa(name);
+		prefix[len - 1] = '\0';
+		ret = reset_prefix_devices(prefix, type);
 	} else {
 		ret = reset_one_device(name, type);
 	}
@@ -266,6 +285,7 @@ static char *cli_show_config(struct ast_cli_entry *e, int cmd, struct ast_cli_ar
 #define FORMAT_STRING  "%-18.18s %-12.12s %-24.24s %-4d\n"
 #define FORMAT_STRING2 "%-18.18s %-12.12s %-24.24s %-4s\n"
 	struct sccp_cfg *cfg;
+	struct sccp_config_timing timing;
 	struct sccp_device_cfg *device_cfg;
 	struct ao2_iterator iter;
 	int count = 0;
@@ -283,7 +303,17 @@ static char *cli_show_config(struct ast_cli_entry *e, int cmd, struct ast_cli_ar
 
 	ast_cli(a->fd, "authtimeout = %d\n", cfg->general_cfg->authtimeout);
 	ast_cli(a->fd, "guest = %s\n", AST_CLI_YESNO(cfg->general_cfg->guest_device_cfg));
-	ast_cli(a->fd, "max_guests = %u\n\n", cfg->general_cfg->max_guests);
+	ast_cli(a->fd, "max_guests = %u\n", cfg->general_cfg->max_guests);
+	ast_cli(a->fd, "reactor_threads = %d\n", cfg->general_cfg->reactor_threads);
+	ast_cli(a->fd, "listeners = %d\n", cfg->general_cfg->listeners);
+	ast_cli(a->fd, "listen_backlog = %d\n", cfg->general_cfg->listen_backlog);
+	ast_cli(a->fd, "register_rate = %u\n", cfg->general_cfg->register_rate);
+	ast_cli(a->fd, "register_burst = %u\n", cfg->general_cfg->register_burst);
+	ast_cli(a->fd, "send_buffer_max = %u\n\n", cfg->general_cfg->send_buffer_max);
+
+	sccp_config_get_timing(&timing);
+	ast_cli(a->fd, "Last load: parse %d ms, link %d ms, apply %d ms\n\n",
+			timing.parse_ms, timing.link_ms, timing.apply_ms);
 
 	ast_cli(a->fd, FORMAT_STRING2, "Device", "Line", "Voicemail", "Speeddials");
 	iter = ao2_iterator_init(cfg->devices_cfg, 0);
@@ -312,23 +342,58 @@ static char *cli_show_devices(struct ast_cli_entry *e, int cmd, struct ast_cli_a
 {
 #define FORMAT_STRING  "%-16.16s %-16.16s %-6.6s %-6.6s %-6.6s %-25.25s\n"
 #define FORMAT_STRING2 "%-16.16s %-16.16s %-6.6s %-6.6s %-6u %-25.25s\n"
+	struct sccp_device_registry_filter filter = {
+		.prefix = NULL,
+		.guest = SCCP_DEVICE_REGISTRY_FILTER_ANY,
+		.offset = 0,
+		.limit = 0,
+	};
 	struct sccp_device_snapshot *snapshots;
 	size_t n;
 	size_t n_guests = 0;
 	size_t i;
+	int pos;
 
 	switch (cmd) {
 	case CLI_INIT:
 		e->command = "sccp show devices";
 		e->usage =
-			"Usage: sccp show devices\n"
-			"       Show the connected devices.\n";
+			"Usage: sccp show devices [prefix] [guest|nonguest] [offset <n>] [limit <n>]\n"
+			"       Show the connected devices, sorted by name.\n"
+			"       prefix: only show the devices whose name starts with prefix\n"
+			"       guest, nonguest: only show the guest or the non-guest devices\n"
+			"       offset <n>: skip the first n devices\n"
+			"       limit <n>: show at most n devices\n";
 		return NULL;
 	case CLI_GENERATE:
+		if (a->pos == e->args) {
+			return sccp_device_registry_complete(global_registry, a->word, a->n);
+		}
+
 		return NULL;
 	}
 
-	if (sccp_device_registry_take_snapshots(global_registry, &snapshots, &n)) {
+	for (pos = e->args; pos < a->argc; pos++) {
+		if (!strcasecmp(a->argv[pos], "guest")) {
+			filter.guest = 1;
+		} else if (!strcasecmp(a->argv[pos], "nonguest")) {
+			filter.guest = 0;
+		} else if (!strcasecmp(a->argv[pos], "offset") && pos + 1 < a->argc) {
+			if (sscanf(a->argv[++pos], "%zu", &filter.offset) != 1) {
+				return CLI_SHOWUSAGE;
+			}
+		} else if (!strcasecmp(a->argv[pos], "limit") && pos + 1 < a->argc) {
+			if (sscanf(a->argv[++pos], "%zu", &filter.limit) != 1) {
+				return CLI_SHOWUSAGE;
+			}
+		} else if (pos == e->args) {
+			filter.prefix = a->argv[pos];
+		} else {
+			return CLI_SHOWUSAGE;
+		}
+	}
+
+	if (sccp_device_registry_take_snapshots(global_registry, &filter, &snapshots, &n)) {
 		return CLI_FAILURE;
 	}
 
@@ -351,6 +416,52 @@ static char *cli_show_devices(struct ast_cli_entry *e, int cmd, struct ast_cli_a
 #undef FORMAT_STRING2
 }
 
+static char *cli_show_queues(struct ast_cli_entry *e, int cmd, struct ast_cli_args *a)
+{
+#define FORMAT_STRING  "%-32.32s %-8.8s %-10.10s %-8.8s %-8.8s\n"
+#define FORMAT_STRING2 "%-32.32s %-8d %-10d %-8s %-8d\n"
+	struct sccp_sync_queue_snapshot *snapshots;
+	char capacity[16];
+	size_t n;
+	size_t i;
+
+	switch (cmd) {
+	case CLI_INIT:
+		e->command = "sccp show queues";
+		e->usage =
+			"Usage: sccp show queues\n"
+			"       Show the depth and high-water mark of the internal message queues.\n";
+		return NULL;
+	case CLI_GENERATE:
+		return NULL;
+	}
+
+	if (sccp_sync_queue_take_snapshots(&snapshots, &n)) {
+		return CLI_FAILURE;
+	}
+
+	ast_cli(a->fd, FORMAT_STRING, "Queue", "Depth", "High-water", "Capacity", "Full");
+	for (i = 0; i < n; i++) {
+		if (snapshots[i].capacity) {
+			snprintf(capacity, sizeof(capacity), "%d", snapshots[i].capacity);
+		} else {
+			ast_copy_string(capacity, "-", sizeof(capacity));
+		}
+
+		ast_cli(a->fd, FORMAT_STRING2, snapshots[i].name, snapshots[i].depth, snapshots[i].high_water,
+				capacity, snapshots[i].full_count);
+	}
+
+	ast_cli(a->fd, "Total: %zu queue(s)\n", n);
+
+	ast_free(snapshots);
+
+	return CLI_SUCCESS;
+
+#undef FORMAT_STRING
+#undef FORMAT_STRING2
+}
+
 static char *cli_show_version(struct ast_cli_entry *e, int cmd, struct ast_cli_args *a)
 {
 	switch (cmd) {
@@ -370,10 +481,14 @@ static char *cli_show_version(struct ast_cli_entry *e, int cmd, struct ast_cli_a
 static char *cli_show_stats(struct ast_cli_entry *e, int cmd, struct ast_cli_args *a)
 {
 	struct sccp_stat stat;
+	struct sccp_admission_stat admission_stat;
+	struct sccp_db_cache_stats db_cache_stats;
 	struct timeval tmp_tv = {.tv_usec = 0};
 	struct ast_tm tm;
 	char device_fault_last[64] = "-";
 	char device_panic_last[64] = "-";
+	char accept_queue_full_last[64] = "-";
+	char reload_last[64] = "-";
 
 	switch (cmd) {
 	case CLI_INIT:
@@ -385,6 +500,8 @@ static char *cli_show_stats(struct ast_cli_entry *e, int cmd, struct ast_cli_arg
 	}
 
 	sccp_stat_take_snapshot(&stat);
+	sccp_admission_take_snapshot(global_admission, &admission_stat);
+	sccp_db_cache_get_stats(&db_cache_stats);
 
 	if (stat.device_fault_count) {
 		tmp_tv.tv_sec = stat.device_fault_last;
@@ -398,12 +515,57 @@ static char *cli_show_stats(struct ast_cli_entry *e, int cmd, struct ast_cli_arg
 		ast_strftime(device_panic_last, sizeof(device_panic_last), "%Y-%m-%d %H:%M:%S", &tm);
 	}
 
+	if (stat.accept_queue_full_count) {
+		tmp_tv.tv_sec = stat.accept_queue_full_last;
+		ast_localtime(&tmp_tv, &tm, NULL);
+		ast_strftime(accept_queue_full_last, sizeof(accept_queue_full_last), "%Y-%m-%d %H:%M:%S", &tm);
+	}
+
+	if (stat.reload_count) {
+		tmp_tv.tv_sec = stat.reload_last;
+		ast_localtime(&tmp_tv, &tm, NULL);
+		ast_strftime(reload_last, sizeof(reload_last), "%Y-%m-%d %H:%M:%S", &tm);
+	}
+
 	ast_cli(a->fd,
 			"Device fault:          %d\n"
 			"Last device fault:     %s\n"
 			"Device panic:          %d\n"
-			"Last device panic:     %s\n",
-			stat.device_fault_count, device_fault_last, stat.device_panic_count, device_panic_last);
+			"Last device panic:     %s\n"
+			"Accept queue full:     %d samples\n"
+			"Last queue full:       %s\n"
+			"Keepalive fast path:   %d\n",
+			stat.device_fault_count, device_fault_last, stat.device_panic_count, device_panic_last,
+			stat.accept_queue_full_count, accept_queue_full_last, stat.keepalive_fastpath_count);
+
+	ast_cli(a->fd,
+			"Register admitted:     %d\n"
+			"Register deferred:     %d\n"
+			"Register rejected:     %d\n"
+			"Register queue depth:  %d\n",
+			admission_stat.admitted_count, admission_stat.deferred_count, admission_stat.rejected_count,
+			admission_stat.queue_depth);
+
+	ast_cli(a->fd,
+			"Reload:                %d\n"
+			"Last reload:           %s\n"
+			"Last reload devices:   %d\n"
+			"Last reload time:      %d ms\n",
+			stat.reload_count, reload_last, stat.reload_last_devices, stat.reload_last_ms);
+
+	ast_cli(a->fd,
+			"BLF received:          %d\n"
+			"BLF transmitted:       %d\n",
+			stat.blf_received_count, stat.blf_transmitted_count);
+
+	ast_cli(a->fd,
+			"DB cache entries:      %d\n"
+			"DB cache lookups:      %d\n"
+			"DB cache values found: %d\n"
+			"DB pending writes:     %d\n"
+			"DB writes:             %d\n",
+			db_cache_stats.entries, db_cache_stats.lookups, db_cache_stats.found,
+			db_cache_stats.pending_writes, db_cache_stats.writes);
 
 	return CLI_SUCCESS;
 }
@@ -413,6 +575,7 @@ static struct ast_cli_entry cli_entries[] = {
 	AST_CLI_DEFINE(cli_set_debug, "Enable/Disable SCCP debugging"),
 	AST_CLI_DEFINE(cli_show_config, "Show the module configuration"),
 	AST_CLI_DEFINE(cli_show_devices, "Show the connected devices"),
+	AST_CLI_DEFINE(cli_show_queues, "Show the internal message queues"),
 	AST_CLI_DEFINE(cli_show_stats, "Show the module stats"),
 	AST_CLI_DEFINE(cli_show_version, "Show the module version"),
 };
@@ -445,40 +608,57 @@ static int load_module(void)
 
 	sccp_module_info = ast_module_info;
 
-	if (sccp_config_init()) {
+	if (sccp_blf_hub_init()) {
+		goto fail0;
+	}
+
+	if (sccp_mwi_router_init()) {
 		goto fail1;
 	}
 
-	if (sccp_config_load()) {
+	if (sccp_db_cache_init()) {
 		goto fail2;
 	}
 
+	if (sccp_config_init()) {
+		goto fail3;
+	}
+
+	if (sccp_config_load()) {
+		goto fail4;
+	}
+
 	cfg = sccp_config_get();
 	global_registry = sccp_device_registry_create(cfg);
 	if (!global_registry) {
-		goto fail2;
+		goto fail4;
+	}
+
+	global_admission = sccp_admission_create(cfg);
+	if (!global_admission) {
+		goto fail5;
 	}
 
 	sccp_sched = ast_sched_context_create();
 	if (!sccp_sched) {
-		goto fail3;
+		goto fail6;
 	}
 
-	global_server = sccp_server_create(cfg, global_registry);
+	global_server = sccp_server_create(cfg, global_registry, global_admission);
 	if (!global_server) {
-		goto fail4;
+		goto fail7;
 	}
 
 	if (register_sccp_tech()) {
-		goto fail5;
+		goto fail8;
 	}
 
 	if (ast_rtp_glue_register(&sccp_rtp_glue)) {
-		goto fail6;
+		goto fail9;
 	}
 
 	if (sccp_server_start(global_server)) {
-		goto fail7;
+		goto fail10;
 	}
 
 	ast_cli_register_multiple(cli_entries, ARRAY_LEN(cli_entries));
@@ -486,20 +666,28 @@ static int load_module(void)
 
 	return AST_MODULE_LOAD_SUCCESS;
 
-fail7:
+fail10:
 	ast_rtp_glue_unregister(&sccp_rtp_glue);
-fail6:
+fail9:
 	unregister_sccp_tech();
-fail5:
+fail8:
 	sccp_server_destroy(global_server);
-fail4:
+fail7:
 	ast_sched_context_destroy(sccp_sched);
-fail3:
+fail6:
+	sccp_admission_destroy(global_admission);
+fail5:
 	sccp_device_registry_destroy(global_registry);
-fail2:
+fail4:
 	ao2_cleanup(cfg);
 	sccp_config_destroy();
+fail3:
+	sccp_db_cache_destroy();
+fail2:
+	sccp_mwi_router_destroy();
 fail1:
+	sccp_blf_hub_destroy();
+fail0:
 
 	return AST_MODULE_LOAD_DECLINE;
 }
@@ -512,8 +700,12 @@ static int unload_module(void)
 	unregister_sccp_tech();
 	sccp_server_destroy(global_server);
 	ast_sched_context_destroy(sccp_sched);
+	sccp_admission_destroy(global_admission);
 	sccp_device_registry_destroy(global_registry);
 	sccp_config_destroy();
+	sccp_db_cache_destroy();
+	sccp_mwi_router_destroy();
+	sccp_blf_hub_destroy();
 
 	return 0;
 }
@@ -530,6 +722,7 @@ static int reload(void)
 	cfg = sccp_config_get();
 	ret |= sccp_server_reload_config(global_server, cfg);
 	ret |= sccp_device_registry_reload_config(global_registry, cfg);
+	ret |= sccp_admission_reload_config(global_admission, cfg);
 	ao2_ref(cfg, -1);
 
 	return ret ? -1 : 0;
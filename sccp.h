@@ -7,6 +7,7 @@
 #define SCCP_LINE_NAME_MAX 40
 #define SCCP_SPEEDDIAL_NAME_MAX 40
 
+/* minimum number of buckets of the hash containers, see sccp_buckets */
 #define SCCP_BUCKETS 563
 
 extern struct ast_channel_tech sccp_tech;
@@ -0,0 +1,172 @@
+#include <asterisk.h>
+#include <asterisk/lock.h>
+#include <asterisk/time.h>
+#include <asterisk/utils.h>
+
+#include "sccp_admission.h"
+#include "sccp_config.h"
+
+/*
+ * The token bucket is implemented as a virtual scheduling algorithm: instead of
+ * counting the tokens, we keep the theoretical arrival time (tat) of the next
+ * registration. A registration is admitted right away if it arrives no earlier
+ * than (burst - 1) intervals before the tat, else it is deferred until then.
+ *
+ * This way, deferred registrations are served in order without polling.
+ *
+ * A registration that would be deferred longer than the caller accepts is rejected
+ * without moving the tat, and an abandoned registration moves the tat back by one
+ * interval, so that the schedule only grows with the registrations still waiting.
+ *
+ * The rejections are logged once per episode, i.e. when the first registration is
+ * rejected and when a registration is admitted again, since they come in storms.
+ */
+struct sccp_admission {
+	ast_mutex_t lock;
+	unsigned int rate;
+	unsigned int burst;
+	struct timeval tat;
+	/* non-zero while the registrations are being rejected */
+	int rejecting;
+	/* value of stat.rejected_count when the current rejection episode started */
+	int episode_rejected_count;
+	struct sccp_admission_stat stat;
+};
+
+static void admission_set_config(struct sccp_admission *admission, struct sccp_cfg *cfg)
+{
+	admission->rate = cfg->general_cfg->register_rate;
+	admission->burst = cfg->general_cfg->register_burst;
+}
+
+struct sccp_admission *sccp_admission_create(struct sccp_cfg *cfg)
+{
+	struct sccp_admission *admission;
+
+	if (!cfg) {
+		ast_log(LOG_ERROR, "sccp admission create failed: cfg is null\n");
+		return NULL;
+	}
+
+	admission = ast_calloc(1, sizeof(*admission));
+	if (!admission) {
+		return NULL;
+	}
+
+	ast_mutex_init(&admission->lock);
+	admission_set_config(admission, cfg);
+
+	return admission;
+}
+
+void sccp_admission_destroy(struct sccp_admission *admission)
+{
+	ast_mutex_destroy(&admission->lock);
+	ast_free(admission);
+}
+
+static int64_t admission_interval_us(const struct sccp_admission *admission)
+{
+	return 1000000 / admission->rate;
+}
+
+int sccp_admission_request(struct sccp_admission *admission, int max_delay_ms)
+{
+	struct timeval now;
+	int64_t interval_us;
+	int64_t delay_us;
+	int delay_ms = 0;
+
+	ast_mutex_lock(&admission->lock);
+
+	if (!admission->rate) {
+		admission->stat.admitted_count++;
+		goto end;
+	}
+
+	now = ast_tvnow();
+	if (ast_tvcmp(admission->tat, now) < 0) {
+		admission->tat = now;
+	}
+
+	interval_us = admission_interval_us(admission);
+	delay_us = ast_tvdiff_us(admission->tat, now) - (admission->burst - 1) * interval_us;
+	if (delay_us > (int64_t) max_delay_ms * 1000) {
+		if (!admission->rejecting) {
+			ast_log(LOG_NOTICE, "Rejecting registrations: admission queue is full\n");
+			admission->rejecting = 1;
+			admission->episode_rejected_count = admission->stat.rejected_count;
+		}
+
+		delay_ms = SCCP_ADMISSION_REJECTED;
+		admission->stat.rejected_count++;
+		goto end;
+	}
+
+	if (admission->rejecting) {
+		ast_log(LOG_NOTICE, "Admitting registrations again, %d rejected\n", admission->stat.rejected_count - admission->episode_rejected_count);
+		admission->rejecting = 0;
+	}
+
+	admission->tat = ast_tvadd(admission->tat, ast_tv(0, interval_us));
+
+	if (delay_us > 0) {
+		/* round up, so that the registration is never processed too early */
+		delay_ms = (delay_us + 999) / 1000;
+		admission->stat.queue_depth++;
+		admission->stat.deferred_count++;
+	} else {
+		admission->stat.admitted_count++;
+	}
+
+end:
+	ast_mutex_unlock(&admission->lock);
+
+	return delay_ms;
+}
+
+void sccp_admission_release(struct sccp_admission *admission)
+{
+	ast_mutex_lock(&admission->lock);
+	admission->stat.queue_depth--;
+	ast_mutex_unlock(&admission->lock);
+}
+
+void sccp_admission_cancel(struct sccp_admission *admission)
+{
+	struct timeval now;
+
+	ast_mutex_lock(&admission->lock);
+	admission->stat.queue_depth--;
+
+	if (admission->rate) {
+		now = ast_tvnow();
+		admission->tat = ast_tvsub(admission->tat, ast_tv(0, admission_interval_us(admission)));
+		if (ast_tvcmp(admission->tat, now) < 0) {
+			admission->tat = now;
+		}
+	}
+
+	ast_mutex_unlock(&admission->lock);
+}
+
+void sccp_admission_take_snapshot(struct sccp_admission *admission, struct sccp_admission_stat *dst)
+{
+	ast_mutex_lock(&admission->lock);
+	memcpy(dst, &admission->stat, sizeof(*dst));
+	ast_mutex_unlock(&admission->lock);
+}
+
+int sccp_admission_reload_config(struct sccp_admission *admission, struct sccp_cfg *cfg)
+{
+	if (!cfg) {
+		ast_log(LOG_ERROR, "sccp admission reload config failed: cfg is null\n");
+		return -1;
+	}
+
+	ast_mutex_lock(&admission->lock);
+	admission_set_config(admission, cfg);
+	ast_mutex_unlock(&admission->lock);
+
+	return 0;
+}
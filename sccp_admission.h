@@ -0,0 +1,79 @@
+#ifndef SCCP_ADMISSION_H_
+#define SCCP_ADMISSION_H_
+
+struct sccp_admission;
+struct sccp_cfg;
+
+#define SCCP_ADMISSION_REJECTED -1
+
+struct sccp_admission_stat {
+	/* number of registrations currently deferred */
+	int queue_depth;
+	/* number of registrations admitted without delay */
+	int admitted_count;
+	/* number of registrations deferred */
+	int deferred_count;
+	/* number of registrations rejected because they would have been deferred too long */
+	int rejected_count;
+};
+
+/*!
+ * \brief Create a new registration admission controller.
+ *
+ * The admission controller is a thread safe token bucket that paces the
+ * registrations, so that a mass re-registration doesn't saturate Asterisk.
+ *
+ * \retval non-NULL on success
+ * \retval NULL on failure
+ */
+struct sccp_admission *sccp_admission_create(struct sccp_cfg *cfg);
+
+/*!
+ * \brief Destroy the admission controller.
+ */
+void sccp_admission_destroy(struct sccp_admission *admission);
+
+/*!
+ * \brief Reserve a registration slot.
+ *
+ * If the returned delay is positive, the registration has been deferred and
+ * must be processed only after the delay, and either sccp_admission_release or
+ * sccp_admission_cancel must be called once it has been processed or abandoned.
+ *
+ * The rejections are logged once per episode; the stats count each of them.
+ *
+ * \param max_delay_ms the longest the registration can be deferred
+ *
+ * \return the number of milliseconds the registration must be deferred
+ * \retval SCCP_ADMISSION_REJECTED if the registration would be deferred longer than
+ *         max_delay_ms, in which case no slot has been reserved
+ */
+int sccp_admission_request(struct sccp_admission *admission, int max_delay_ms);
+
+/*!
+ * \brief Release a deferred registration that has been processed.
+ */
+void sccp_admission_release(struct sccp_admission *admission);
+
+/*!
+ * \brief Cancel a deferred registration that has been abandoned before being processed.
+ *
+ * The slot of the registration is given back, so that the registrations requested
+ * afterward are deferred for less time.
+ */
+void sccp_admission_cancel(struct sccp_admission *admission);
+
+/*!
+ * \brief Take a snapshot of the admission controller stat and copy it into dst.
+ */
+void sccp_admission_take_snapshot(struct sccp_admission *admission, struct sccp_admission_stat *dst);
+
+/*!
+ * \brief Reload the admission controller configuration.
+ *
+ * \retval 0 on success
+ * \retval non-zero on failure
+ */
+int sccp_admission_reload_config(struct sccp_admission *admission, struct sccp_cfg *cfg);
+
+#endif /* SCCP_ADMISSION_H_ */
@@ -0,0 +1,261 @@
+#include <asterisk.h>
+#include <asterisk/astobj2.h>
+#include <asterisk/dlinkedlists.h>
+#include <asterisk/pbx.h>
+#include <asterisk/strings.h>
+
+#include "sccp.h"
+#include "sccp_blf_hub.h"
+
+/*
+ * Lock order: watchers container, then watcher.
+ *
+ * The subscription callbacks must not take any lock: the speeddial callback only stores
+ * the state and queues a message to the session, which transmits it from its own thread.
+ *
+ * The subscription callbacks are called with the watcher locked, which is what guarantees
+ * that a callback is not running anymore once sccp_blf_hub_unsubscribe has returned.
+ * ast_extension_state_del is never called with a watcher locked, since the Asterisk thread
+ * calling on_extension_state_change might hold locks of its own.
+ *
+ * ast_extension_state_del doesn't wait for a callback that is already running, and the
+ * destroy callback can also be run by Asterisk itself, e.g. when the hint is removed. The
+ * extension state callbacks whose destroy callback has not run yet are counted, so that
+ * sccp_blf_hub_destroy can wait for them; once it has returned, none of the callbacks is
+ * called anymore.
+ */
+struct blf_watcher {
+	AST_DLLIST_HEAD_NOLOCK(, sccp_blf_subscription) subs;
+	/* const */
+	int cb_id;
+	/* protected by the watcher lock */
+	int state;
+	/* const, "exten@context" */
+	char key[AST_MAX_EXTENSION + AST_MAX_CONTEXT + 1];
+};
+
+struct sccp_blf_subscription {
+	AST_DLLIST_ENTRY(sccp_blf_subscription) list;
+	struct blf_watcher *watcher;
+	sccp_blf_cb *callback;
+	void *data;
+};
+
+static struct ao2_container *watchers;
+
+static ast_mutex_t state_cbs_lock;
+static ast_cond_t state_cbs_cond;
+/* protected by state_cbs_lock */
+static int state_cbs;
+
+static int blf_watcher_hash(const void *obj, int flags)
+{
+	const char *key;
+
+	if (flags & OBJ_SEARCH_KEY) {
+		key = obj;
+	} else {
+		key = ((const struct blf_watcher *) obj)->key;
+	}
+
+	return ast_str_hash(key);
+}
+
+static int blf_watcher_cmp(void *obj, void *arg, int flags)
+{
+	struct blf_watcher *watcher = obj;
+	const char *key;
+
+	if (flags & OBJ_SEARCH_KEY) {
+		key = arg;
+	} else {
+		key = ((const struct blf_watcher *) arg)->key;
+	}
+
+	return strcmp(watcher->key, key) ? 0 : (CMP_MATCH | CMP_STOP);
+}
+
+static int on_extension_state_change(const char *context, const char *exten, struct ast_state_cb_info *info, void *data)
+{
+	struct blf_watcher *watcher = data;
+	struct sccp_blf_subscription *sub;
+
+	ao2_lock(watcher);
+	watcher->state = info->exten_state;
+	AST_DLLIST_TRAVERSE(&watcher->subs, sub, list) {
+		sub->callback(watcher->state, sub->data);
+	}
+	ao2_unlock(watcher);
+
+	return 0;
+}
+
+static void on_extension_state_destroy(int id, void *data)
+{
+	struct blf_watcher *watcher = data;
+
+	ao2_ref(watcher, -1);
+
+	ast_mutex_lock(&state_cbs_lock);
+	state_cbs--;
+	ast_cond_signal(&state_cbs_cond);
+	ast_mutex_unlock(&state_cbs_lock);
+}
+
+/*
+ * Must be called with the watchers container locked.
+ */
+static struct blf_watcher *blf_watcher_create(const char *context, const char *exten, const char *key)
+{
+	struct blf_watcher *watcher;
+
+	watcher = ao2_alloc(sizeof(*watcher), NULL);
+	if (!watcher) {
+		return NULL;
+	}
+
+	AST_DLLIST_HEAD_INIT_NOLOCK(&watcher->subs);
+	ast_copy_string(watcher->key, key, sizeof(watcher->key));
+
+	/* the reference and the count are released in on_extension_state_destroy */
+	ao2_ref(watcher, +1);
+	ast_mutex_lock(&state_cbs_lock);
+	state_cbs++;
+	ast_mutex_unlock(&state_cbs_lock);
+
+	watcher->state = ast_extension_state(NULL, context, exten);
+	watcher->cb_id = ast_extension_state_add_destroy(context, exten, on_extension_state_change, on_extension_state_destroy, watcher);
+	if (watcher->cb_id == -1) {
+		/* not linked, so that the next subscriber tries again */
+		ast_log(LOG_WARNING, "Could not subscribe to %s@%s\n", exten, context);
+		ast_mutex_lock(&state_cbs_lock);
+		state_cbs--;
+		ast_mutex_unlock(&state_cbs_lock);
+		ao2_ref(watcher, -2);
+		return NULL;
+	}
+
+	if (!ao2_link_flags(watchers, watcher, OBJ_NOLOCK)) {
+		ast_extension_state_del(watcher->cb_id, NULL);
+		ao2_ref(watcher, -1);
+		return NULL;
+	}
+
+	return watcher;
+}
+
+int sccp_blf_hub_init(void)
+{
+	watchers = ao2_container_alloc_hash(AO2_ALLOC_OPT_LOCK_MUTEX, 0, SCCP_BUCKETS, blf_watcher_hash, NULL, blf_watcher_cmp);
+	if (!watchers) {
+		return -1;
+	}
+
+	ast_mutex_init(&state_cbs_lock);
+	ast_cond_init(&state_cbs_cond, NULL);
+	state_cbs = 0;
+
+	return 0;
+}
+
+void sccp_blf_hub_destroy(void)
+{
+	struct ao2_iterator iter;
+	struct blf_watcher *watcher;
+
+	if (ao2_container_count(watchers)) {
+		ast_log(LOG_WARNING, "BLF hub destroyed with %d extension(s) still watched\n", ao2_container_count(watchers));
+
+		/* their subscribers won't be notified anymore */
+		iter = ao2_iterator_init(watchers, 0);
+		while ((watcher = ao2_iterator_next(&iter))) {
+			ast_extension_state_del(watcher->cb_id, NULL);
+			ao2_ref(watcher, -1);
+		}
+		ao2_iterator_destroy(&iter);
+	}
+
+	/* wait for the destroy callbacks, so that the module can be unloaded */
+	ast_mutex_lock(&state_cbs_lock);
+	while (state_cbs) {
+		ast_cond_wait(&state_cbs_cond, &state_cbs_lock);
+	}
+	ast_mutex_unlock(&state_cbs_lock);
+
+	ast_cond_destroy(&state_cbs_cond);
+	ast_mutex_destroy(&state_cbs_lock);
+
+	ao2_ref(watchers, -1);
+	watchers = NULL;
+}
+
+struct sccp_blf_subscription *sccp_blf_hub_subscribe(const char *context, const char *exten, sccp_blf_cb *callback, void *data, int *state)
+{
+	struct sccp_blf_subscription *sub;
+	struct blf_watcher *watcher;
+	char key[AST_MAX_EXTENSION + AST_MAX_CONTEXT + 1];
+
+	if (!context || !exten || !callback || !state) {
+		ast_log(LOG_ERROR, "blf hub subscribe failed: invalid argument\n");
+		return NULL;
+	}
+
+	snprintf(key, sizeof(key), "%s@%s", exten, context);
+
+	sub = ast_calloc(1, sizeof(*sub));
+	if (!sub) {
+		return NULL;
+	}
+
+	ao2_lock(watchers);
+
+	watcher = ao2_find(watchers, key, OBJ_SEARCH_KEY | OBJ_NOLOCK);
+	if (!watcher) {
+		watcher = blf_watcher_create(context, exten, key);
+		if (!watcher) {
+			ao2_unlock(watchers);
+			ast_free(sub);
+			return NULL;
+		}
+	}
+
+	/* steal the reference ownership */
+	sub->watcher = watcher;
+	sub->callback = callback;
+	sub->data = data;
+
+	ao2_lock(watcher);
+	AST_DLLIST_INSERT_TAIL(&watcher->subs, sub, list);
+	*state = watcher->state;
+	ao2_unlock(watcher);
+
+	ao2_unlock(watchers);
+
+	return sub;
+}
+
+void sccp_blf_hub_unsubscribe(struct sccp_blf_subscription *sub)
+{
+	struct blf_watcher *watcher = sub->watcher;
+	int empty;
+
+	ao2_lock(watchers);
+
+	ao2_lock(watcher);
+	AST_DLLIST_REMOVE(&watcher->subs, sub, list);
+	empty = AST_DLLIST_EMPTY(&watcher->subs);
+	ao2_unlock(watcher);
+
+	if (empty) {
+		ao2_unlink_flags(watchers, watcher, OBJ_NOLOCK);
+	}
+
+	ao2_unlock(watchers);
+
+	if (empty) {
+		ast_extension_state_del(watcher->cb_id, NULL);
+	}
+
+	ao2_ref(watcher, -1);
+	ast_free(sub);
+}
@@ -0,0 +1,59 @@
+#ifndef SCCP_BLF_HUB_H_
+#define SCCP_BLF_HUB_H_
+
+struct sccp_blf_subscription;
+
+/*!
+ * \brief Function type for the BLF state change callback.
+ *
+ * \param state the new extension state, one of the ast_extension_states values
+ */
+typedef void (sccp_blf_cb)(int state, void *data);
+
+/*!
+ * \brief Initialize the BLF hub.
+ *
+ * The BLF hub holds a single Asterisk extension state callback per watched extension,
+ * and fans the state changes out to its subscribers, so that many BLF speeddials
+ * watching the same extension don't each add their own callback.
+ *
+ * \retval 0 on success
+ * \retval non-zero on failure
+ */
+int sccp_blf_hub_init(void);
+
+/*!
+ * \brief Free the resources associated to the BLF hub.
+ *
+ * This function waits for the extension state callbacks that have been deleted to be
+ * destroyed by Asterisk.
+ *
+ * \note All the subscriptions must have been removed.
+ */
+void sccp_blf_hub_destroy(void);
+
+/*!
+ * \brief Subscribe to the state changes of an extension.
+ *
+ * The callback is called, from an Asterisk thread, every time the state of the extension
+ * changes, until the subscription is removed.
+ *
+ * \param[out] state the current state of the extension
+ *
+ * \retval non-NULL on success
+ * \retval NULL on failure, e.g. if the extension has no hint yet; subscribing again
+ *         later tries again
+ */
+struct sccp_blf_subscription *sccp_blf_hub_subscribe(const char *context, const char *exten, sccp_blf_cb *callback, void *data, int *state);
+
+/*!
+ * \brief Remove a subscription.
+ *
+ * Once this function returns, the callback of the subscription is not running and
+ * won't be called anymore.
+ *
+ * \note You must not call this function from the subscription callback.
+ */
+void sccp_blf_hub_unsubscribe(struct sccp_blf_subscription *sub);
+
+#endif /* SCCP_BLF_HUB_H_ */
@@ -1,12 +1,18 @@
+#include <sys/param.h>
+
 #include <asterisk.h>
 #include <asterisk/acl.h>
 #include <asterisk/astobj2.h>
 #include <asterisk/config_options.h>
 #include <asterisk/linkedlists.h>
+#include <asterisk/lock.h>
 #include <asterisk/strings.h>
+#include <asterisk/time.h>
+#include <asterisk/utils.h>
 
 #include "sccp.h"
 #include "sccp_config.h"
+#include "sccp_utils.h"
 
 #define DEVICE_CFG_NAME_GUEST "guest"
 
@@ -17,12 +23,42 @@ static void sccp_general_cfg_free_internal(struct sccp_general_cfg *general_cfg)
 static struct sccp_speeddial_cfg *sccp_cfg_find_speeddial(struct sccp_cfg *cfg, const char *name);
 static int pre_apply_config(void);
 
+/*
+ * Number of buckets of the config containers. The containers of a new config are sized
+ * from the number of objects in the previous config, and are grown in pre_apply_config
+ * if the new config is bigger. Only accessed from the thread loading the config.
+ */
+struct cfg_buckets {
+	unsigned int devices;
+	unsigned int lines;
+	unsigned int speeddials;
+};
+
+static struct cfg_buckets next_buckets = {
+	.devices = SCCP_BUCKETS,
+	.lines = SCCP_BUCKETS,
+	.speeddials = SCCP_BUCKETS,
+};
+static struct cfg_buckets pending_buckets;
+
+/*
+ * Timing of the last config load. The pending_* members are only accessed from the
+ * thread loading the config; timing_lock protects last_timing.
+ */
+static struct timeval pending_pre_apply_start;
+static struct timeval pending_pre_apply_end;
+static int pending_pre_applied;
+static struct sccp_config_timing last_timing;
+AST_MUTEX_DEFINE_STATIC(timing_lock);
+
 struct sccp_general_cfg_internal {
 	int guest;
 };
 
 struct sccp_device_cfg_internal {
 	char line_name[SCCP_LINE_NAME_MAX];
+	/* temporary storage to hold the line_cfg reference */
+	struct sccp_line_cfg *line_cfg;
 	AST_LIST_HEAD_NOLOCK(, device_cfg_speeddial) speeddials;
 };
 
@@ -47,21 +83,18 @@ static void *sccp_speeddial_cfg_alloc(const char *category)
 	}
 
 	ast_copy_string(speeddial_cfg->name, category, sizeof(speeddial_cfg->name));
+	speeddial_cfg->hash = ast_str_hash(speeddial_cfg->name);
 
 	return speeddial_cfg;
 }
 
 static int sccp_speeddial_cfg_hash(const void *obj, int flags)
 {
-	const char *name;
-
 	if (flags & OBJ_SEARCH_KEY) {
-		name = obj;
-	} else {
-		name = ((const struct sccp_speeddial_cfg *) obj)->name;
+		return ast_str_hash(obj);
 	}
 
-	return ast_str_hash(name);
+	return ((const struct sccp_speeddial_cfg *) obj)->hash;
 }
 
 static int sccp_speeddial_cfg_cmp(void *obj, void *arg, int flags)
@@ -72,6 +105,10 @@ static int sccp_speeddial_cfg_cmp(void *obj, void *arg, int flags)
 	if (flags & OBJ_SEARCH_KEY) {
 		name = arg;
 	} else {
+		if (speeddial_cfg->hash != ((const struct sccp_speeddial_cfg *) arg)->hash) {
+			return 0;
+		}
+
 		name = ((const struct sccp_speeddial_cfg *) arg)->name;
 	}
 
@@ -119,6 +156,7 @@ static void *sccp_line_cfg_alloc(const char *category)
 	}
 
 	ast_copy_string(line_cfg->name, category, sizeof(line_cfg->name));
+	line_cfg->hash = ast_str_hash(line_cfg->name);
 	line_cfg->caps = caps;
 	line_cfg->chanvars = NULL;
 	line_cfg->callgroups = 0;
@@ -143,15 +181,11 @@ static void sccp_line_cfg_free_internal(struct sccp_line_cfg *line_cfg)
 
 static int sccp_line_cfg_hash(const void *obj, int flags)
 {
-	const char *name;
-
 	if (flags & OBJ_SEARCH_KEY) {
-		name = obj;
-	} else {
-		name = ((const struct sccp_line_cfg *) obj)->name;
+		return ast_str_hash(obj);
 	}
 
-	return ast_str_hash(name);
+	return ((const struct sccp_line_cfg *) obj)->hash;
 }
 
 static int sccp_line_cfg_cmp(void *obj, void *arg, int flags)
@@ -162,6 +196,10 @@ static int sccp_line_cfg_cmp(void *obj, void *arg, int flags)
 	if (flags & OBJ_SEARCH_KEY) {
 		name = arg;
 	} else {
+		if (line_cfg->hash != ((const struct sccp_line_cfg *) arg)->hash) {
+			return 0;
+		}
+
 		name = ((const struct sccp_line_cfg *) arg)->name;
 	}
 
@@ -199,12 +237,14 @@ static void *sccp_device_cfg_alloc(const char *category)
 	}
 
 	ast_copy_string(device_cfg->name, category, sizeof(device_cfg->name));
+	device_cfg->hash = ast_str_hash(device_cfg->name);
 	device_cfg->line_cfg = NULL;
 	device_cfg->guest = 0;
 	device_cfg->speeddial_count = 0;
 	device_cfg->speeddials_cfg = NULL;
 	device_cfg->internal = internal;
 	device_cfg->internal->line_name[0] = '\0';
+	device_cfg->internal->line_cfg = NULL;
 	AST_LIST_HEAD_INIT_NOLOCK(&device_cfg->internal->speeddials);
 
 	return device_cfg;
@@ -236,10 +276,12 @@ static void sccp_device_cfg_free_internal(struct sccp_device_cfg *device_cfg)
 
 	AST_LIST_TRAVERSE_SAFE_BEGIN(&device_cfg->internal->speeddials, device_sd, list) {
 		AST_LIST_REMOVE_CURRENT(list);
+		ao2_cleanup(device_sd->speeddial_cfg);
 		ast_free(device_sd);
 	}
 	AST_LIST_TRAVERSE_SAFE_END;
 
+	ao2_cleanup(device_cfg->internal->line_cfg);
 	ast_free(device_cfg->internal);
 	device_cfg->internal = NULL;
 }
@@ -265,19 +307,38 @@ static int sccp_device_cfg_add_speeddial_name(struct sccp_device_cfg *device_cfg
 }
 
 /*
+ * Look up the line and the speeddials of the device config.
+ *
  * The "internal" member must not have been freed.
+ * The function must not have been called for this device config
+ */
+static void sccp_device_cfg_resolve(struct sccp_device_cfg *device_cfg, struct sccp_cfg *cfg)
+{
+	struct device_cfg_speeddial *device_sd;
+
+	if (!ast_strlen_zero(device_cfg->internal->line_name)) {
+		device_cfg->internal->line_cfg = sccp_cfg_find_line(cfg, device_cfg->internal->line_name);
+	}
+
+	AST_LIST_TRAVERSE(&device_cfg->internal->speeddials, device_sd, list) {
+		device_sd->speeddial_cfg = sccp_cfg_find_speeddial(cfg, device_sd->name);
+	}
+}
+
+/*
+ * The "internal" member must not have been freed.
+ * The device config must have been resolved.
  * The function must not have been called successfully for this device config
  */
-static int sccp_device_cfg_build_line(struct sccp_device_cfg *device_cfg, struct sccp_cfg *cfg)
+static int sccp_device_cfg_build_line(struct sccp_device_cfg *device_cfg)
 {
-	struct sccp_line_cfg *line_cfg;
+	struct sccp_line_cfg *line_cfg = device_cfg->internal->line_cfg;
 
 	if (ast_strlen_zero(device_cfg->internal->line_name)) {
 		ast_log(LOG_ERROR, "invalid device %s: no line associated\n", device_cfg->name);
 		return -1;
 	}
 
-	line_cfg = sccp_cfg_find_line(cfg, device_cfg->internal->line_name);
 	if (!line_cfg) {
 		ast_log(LOG_ERROR, "invalid device %s: unknown line %s\n", device_cfg->name, device_cfg->internal->line_name);
 		return -1;
@@ -285,11 +346,12 @@ static int sccp_device_cfg_build_line(struct sccp_device_cfg *device_cfg, struct
 
 	if (line_cfg->internal->associated) {
 		ast_log(LOG_ERROR, "invalid device %s: line %s is already associated\n", device_cfg->name, line_cfg->name);
-		ao2_ref(line_cfg, -1);
 		return -1;
 	}
 
+	/* steal the reference ownership */
 	device_cfg->line_cfg = line_cfg;
+	device_cfg->internal->line_cfg = NULL;
 	line_cfg->internal->associated = 1;
 
 	return 0;
@@ -297,16 +359,16 @@ static int sccp_device_cfg_build_line(struct sccp_device_cfg *device_cfg, struct
 
 /*
  * The "internal" member must not have been freed.
+ * The device config must have been resolved.
  * The function must not have been called successfully for this device config
  */
-static int sccp_device_cfg_build_speeddials(struct sccp_device_cfg *device_cfg, struct sccp_cfg *cfg)
+static int sccp_device_cfg_build_speeddials(struct sccp_device_cfg *device_cfg)
 {
 	struct device_cfg_speeddial *device_sd;
 	size_t i;
 	size_t count = 0;
 
 	AST_LIST_TRAVERSE(&device_cfg->internal->speeddials, device_sd, list) {
-		device_sd->speeddial_cfg = sccp_cfg_find_speeddial(cfg, device_sd->name);
 		if (!device_sd->speeddial_cfg) {
 			ast_log(LOG_WARNING, "invalid device %s: unknown speeddial %s\n", device_cfg->name, device_sd->name);
 			continue;
@@ -321,10 +383,6 @@ static int sccp_device_cfg_build_speeddials(struct sccp_device_cfg *device_cfg,
 
 	device_cfg->speeddials_cfg = ast_calloc(count, sizeof(*device_cfg->speeddials_cfg));
 	if (!device_cfg->speeddials_cfg) {
-		AST_LIST_TRAVERSE(&device_cfg->internal->speeddials, device_sd, list) {
-			ao2_cleanup(device_sd->speeddial_cfg);
-		}
-
 		return -1;
 	}
 
@@ -334,7 +392,9 @@ static int sccp_device_cfg_build_speeddials(struct sccp_device_cfg *device_cfg,
 			continue;
 		}
 
+		/* steal the reference ownership */
 		device_cfg->speeddials_cfg[i] = device_sd->speeddial_cfg;
+		device_sd->speeddial_cfg = NULL;
 		i++;
 	}
 
@@ -361,15 +421,11 @@ static void sccp_device_cfg_norm_voicemail(struct sccp_device_cfg *device_cfg)
 
 static int sccp_device_cfg_hash(const void *obj, int flags)
 {
-	const char *name;
-
 	if (flags & OBJ_SEARCH_KEY) {
-		name = obj;
-	} else {
-		name = ((const struct sccp_device_cfg *) obj)->name;
+		return ast_str_hash(obj);
 	}
 
-	return ast_str_hash(name);
+	return ((const struct sccp_device_cfg *) obj)->hash;
 }
 
 static int sccp_device_cfg_cmp(void *obj, void *arg, int flags)
@@ -380,6 +436,10 @@ static int sccp_device_cfg_cmp(void *obj, void *arg, int flags)
 	if (flags & OBJ_SEARCH_KEY) {
 		name = arg;
 	} else {
+		if (device_cfg->hash != ((const struct sccp_device_cfg *) arg)->hash) {
+			return 0;
+		}
+
 		name = ((const struct sccp_device_cfg *) arg)->name;
 	}
 
@@ -455,17 +515,17 @@ static void *sccp_cfg_alloc(void)
 		goto error;
 	}
 
-	devices_cfg = ao2_container_alloc_hash(AO2_ALLOC_OPT_LOCK_NOLOCK, 0, SCCP_BUCKETS, sccp_device_cfg_hash, NULL, sccp_device_cfg_cmp);
+	devices_cfg = ao2_container_alloc_hash(AO2_ALLOC_OPT_LOCK_NOLOCK, 0, next_buckets.devices, sccp_device_cfg_hash, NULL, sccp_device_cfg_cmp);
 	if (!devices_cfg) {
 		goto error;
 	}
 
-	lines_cfg = ao2_container_alloc_hash(AO2_ALLOC_OPT_LOCK_NOLOCK, 0, SCCP_BUCKETS, sccp_line_cfg_hash, NULL, sccp_line_cfg_cmp);
+	lines_cfg = ao2_container_alloc_hash(AO2_ALLOC_OPT_LOCK_NOLOCK, 0, next_buckets.lines, sccp_line_cfg_hash, NULL, sccp_line_cfg_cmp);
 	if (!lines_cfg) {
 		goto error;
 	}
 
-	speeddials_cfg = ao2_container_alloc_hash(AO2_ALLOC_OPT_LOCK_NOLOCK, 0, SCCP_BUCKETS, sccp_speeddial_cfg_hash, NULL, sccp_speeddial_cfg_cmp);
+	speeddials_cfg = ao2_container_alloc_hash(AO2_ALLOC_OPT_LOCK_NOLOCK, 0, next_buckets.speeddials, sccp_speeddial_cfg_hash, NULL, sccp_speeddial_cfg_cmp);
 	if (!speeddials_cfg) {
 		goto error;
 	}
@@ -479,6 +539,7 @@ static void *sccp_cfg_alloc(void)
 	cfg->devices_cfg = devices_cfg;
 	cfg->lines_cfg = lines_cfg;
 	cfg->speeddials_cfg = speeddials_cfg;
+	pending_buckets = next_buckets;
 
 	return cfg;
 
@@ -561,17 +622,17 @@ CONFIG_INFO_STANDARD(cfg_info, global_cfg, sccp_cfg_alloc,
 	.hidden = 1,
 );
 
-static int cb_pre_apply_device_cfg(void *obj, void *arg, int flags)
+/*
+ * The device config must have been resolved.
+ */
+static int build_device_cfg(struct sccp_device_cfg *device_cfg)
 {
-	struct sccp_device_cfg *device_cfg = obj;
-	struct sccp_cfg *cfg = arg;
-
-	if (sccp_device_cfg_build_line(device_cfg, cfg)) {
-		return CMP_MATCH;
+	if (sccp_device_cfg_build_line(device_cfg)) {
+		return -1;
 	}
 
-	if (sccp_device_cfg_build_speeddials(device_cfg, cfg)) {
-		return CMP_MATCH;
+	if (sccp_device_cfg_build_speeddials(device_cfg)) {
+		return -1;
 	}
 
 	sccp_device_cfg_norm_voicemail(device_cfg);
@@ -580,9 +641,65 @@ static int cb_pre_apply_device_cfg(void *obj, void *arg, int flags)
 	return 0;
 }
 
+static int cb_pre_apply_device_cfg(void *obj, void *arg, int flags)
+{
+	struct sccp_device_cfg *device_cfg = obj;
+	struct sccp_cfg *cfg = arg;
+
+	sccp_device_cfg_resolve(device_cfg, cfg);
+
+	return build_device_cfg(device_cfg) ? CMP_MATCH : 0;
+}
+
+static int device_cfg_cmp(const void *a, const void *b)
+{
+	const struct sccp_device_cfg *device_cfg_a = *(const struct sccp_device_cfg **) a;
+	const struct sccp_device_cfg *device_cfg_b = *(const struct sccp_device_cfg **) b;
+
+	return strcmp(device_cfg_a->name, device_cfg_b->name);
+}
+
+/*
+ * The devices are linked and validated in name order, so that the errors are reported
+ * in a deterministic order, and that when many devices reference the same line, the
+ * first one by name always gets it.
+ */
 static void pre_apply_devices_cfg(struct sccp_cfg *cfg)
 {
-	ao2_callback(cfg->devices_cfg, OBJ_NODATA | OBJ_MULTIPLE | OBJ_UNLINK, cb_pre_apply_device_cfg, cfg);
+	struct ao2_iterator iter;
+	struct sccp_device_cfg **devices_cfg;
+	struct sccp_device_cfg *device_cfg;
+	size_t count;
+	size_t max;
+	size_t i;
+
+	max = ao2_container_count(cfg->devices_cfg);
+	devices_cfg = ast_malloc(MAX(max, 1) * sizeof(*devices_cfg));
+	if (!devices_cfg) {
+		ao2_callback(cfg->devices_cfg, OBJ_NODATA | OBJ_MULTIPLE | OBJ_UNLINK, cb_pre_apply_device_cfg, cfg);
+		return;
+	}
+
+	count = 0;
+	iter = ao2_iterator_init(cfg->devices_cfg, 0);
+	while (count < max && (device_cfg = ao2_iterator_next(&iter))) {
+		devices_cfg[count++] = device_cfg;
+	}
+	ao2_iterator_destroy(&iter);
+
+	qsort(devices_cfg, count, sizeof(*devices_cfg), device_cfg_cmp);
+
+	for (i = 0; i < count; i++) {
+		device_cfg = devices_cfg[i];
+		sccp_device_cfg_resolve(device_cfg, cfg);
+		if (build_device_cfg(device_cfg)) {
+			ao2_unlink(cfg->devices_cfg, device_cfg);
+		}
+
+		ao2_ref(device_cfg, -1);
+	}
+
+	ast_free(devices_cfg);
 }
 
 static int cb_pre_apply_line_cfg(void *obj, void *arg, int flags)
@@ -630,13 +747,172 @@ static void pre_apply_general_cfg(struct sccp_cfg *cfg)
 	sccp_general_cfg_free_internal(general_cfg);
 }
 
+#define FINGERPRINT_INIT 0xcbf29ce484222325ULL
+#define FINGERPRINT_PRIME 0x100000001b3ULL
+
+static uint64_t fingerprint_mem(uint64_t fp, const void *data, size_t len)
+{
+	const unsigned char *p = data;
+	size_t i;
+
+	for (i = 0; i < len; i++) {
+		fp ^= p[i];
+		fp *= FINGERPRINT_PRIME;
+	}
+
+	return fp;
+}
+
+static uint64_t fingerprint_str(uint64_t fp, const char *str)
+{
+	/* include the null terminator, so that "a" "bc" differs from "ab" "c" */
+	return fingerprint_mem(fp, str, strlen(str) + 1);
+}
+
+#define fingerprint_val(fp, val) fingerprint_mem(fp, &(val), sizeof(val))
+
+static uint64_t fingerprint_line_cfg(uint64_t fp, struct sccp_line_cfg *line_cfg)
+{
+	struct ast_str *buf = ast_str_alloca(256);
+	struct ast_variable *var;
+
+	fp = fingerprint_str(fp, line_cfg->name);
+	fp = fingerprint_str(fp, line_cfg->cid_num);
+	fp = fingerprint_str(fp, line_cfg->cid_name);
+	fp = fingerprint_str(fp, line_cfg->language);
+	fp = fingerprint_str(fp, line_cfg->context);
+	fp = fingerprint_str(fp, line_cfg->accountcode);
+	fp = fingerprint_val(fp, line_cfg->directmedia);
+	fp = fingerprint_val(fp, line_cfg->tos_audio);
+	fp = fingerprint_val(fp, line_cfg->callgroups);
+	fp = fingerprint_val(fp, line_cfg->pickupgroups);
+	fp = fingerprint_str(fp, ast_print_namedgroups(&buf, line_cfg->named_callgroups));
+	fp = fingerprint_str(fp, ast_print_namedgroups(&buf, line_cfg->named_pickupgroups));
+	fp = fingerprint_str(fp, ast_format_cap_get_names(line_cfg->caps, &buf));
+
+	for (var = line_cfg->chanvars; var; var = var->next) {
+		fp = fingerprint_str(fp, var->name);
+		fp = fingerprint_str(fp, var->value);
+	}
+
+	return fp;
+}
+
+static uint64_t fingerprint_speeddial_cfg(uint64_t fp, struct sccp_speeddial_cfg *speeddial_cfg)
+{
+	fp = fingerprint_str(fp, speeddial_cfg->name);
+	fp = fingerprint_str(fp, speeddial_cfg->label);
+	fp = fingerprint_str(fp, speeddial_cfg->extension);
+	fp = fingerprint_val(fp, speeddial_cfg->blf);
+
+	return fp;
+}
+
+static void fingerprint_device_cfg(struct sccp_device_cfg *device_cfg)
+{
+	uint64_t fp = FINGERPRINT_INIT;
+	size_t i;
+
+	fp = fingerprint_str(fp, device_cfg->name);
+	fp = fingerprint_str(fp, device_cfg->dateformat);
+	fp = fingerprint_str(fp, device_cfg->voicemail);
+	fp = fingerprint_str(fp, device_cfg->vmexten);
+	fp = fingerprint_str(fp, device_cfg->timezone);
+	fp = fingerprint_val(fp, device_cfg->keepalive);
+	fp = fingerprint_val(fp, device_cfg->dialtimeout);
+	fp = fingerprint_val(fp, device_cfg->blf_window);
+	fp = fingerprint_val(fp, device_cfg->guest);
+	fp = fingerprint_line_cfg(fp, device_cfg->line_cfg);
+	fp = fingerprint_val(fp, device_cfg->speeddial_count);
+	for (i = 0; i < device_cfg->speeddial_count; i++) {
+		fp = fingerprint_speeddial_cfg(fp, device_cfg->speeddials_cfg[i]);
+	}
+
+	device_cfg->fingerprint = fp;
+}
+
+static int cb_fingerprint_device_cfg(void *obj, void *arg, int flags)
+{
+	fingerprint_device_cfg(obj);
+
+	return 0;
+}
+
+static void pre_apply_fingerprints(struct sccp_cfg *cfg)
+{
+	struct sccp_general_cfg *general_cfg = cfg->general_cfg;
+	uint64_t fp = FINGERPRINT_INIT;
+
+	ao2_callback(cfg->devices_cfg, OBJ_NODATA | OBJ_MULTIPLE, cb_fingerprint_device_cfg, NULL);
+
+	/*
+	 * Only the settings used by the sessions with a device are included. The other
+	 * ones are used at load time, or by the registry and the admission control, which
+	 * are reloaded on their own, and authtimeout only applies to the sessions without
+	 * a device, which are always reloaded.
+	 */
+	fp = fingerprint_val(fp, general_cfg->tos);
+	fp = fingerprint_val(fp, general_cfg->send_buffer_max);
+	if (general_cfg->guest_device_cfg) {
+		fingerprint_device_cfg(general_cfg->guest_device_cfg);
+		fp = fingerprint_val(fp, general_cfg->guest_device_cfg->fingerprint);
+	}
+
+	general_cfg->fingerprint = fp;
+}
+
+/*
+ * Replace *container by a container with n_buckets buckets, if it has less than that.
+ *
+ * On failure, the original container is kept, which is not an error.
+ */
+static void resize_container(struct ao2_container **container, unsigned int cur_buckets, unsigned int n_buckets, ao2_hash_fn *hash_fn, ao2_callback_fn *cmp_fn)
+{
+	struct ao2_container *new_container;
+
+	if (n_buckets <= cur_buckets) {
+		return;
+	}
+
+	new_container = ao2_container_alloc_hash(AO2_ALLOC_OPT_LOCK_NOLOCK, 0, n_buckets, hash_fn, NULL, cmp_fn);
+	if (!new_container) {
+		return;
+	}
+
+	if (ao2_container_dup(new_container, *container, 0)) {
+		ao2_ref(new_container, -1);
+		return;
+	}
+
+	ao2_ref(*container, -1);
+	*container = new_container;
+}
+
+static void pre_apply_buckets(struct sccp_cfg *cfg)
+{
+	next_buckets.devices = sccp_buckets(ao2_container_count(cfg->devices_cfg));
+	next_buckets.lines = sccp_buckets(ao2_container_count(cfg->lines_cfg));
+	next_buckets.speeddials = sccp_buckets(ao2_container_count(cfg->speeddials_cfg));
+
+	resize_container(&cfg->devices_cfg, pending_buckets.devices, next_buckets.devices, sccp_device_cfg_hash, sccp_device_cfg_cmp);
+	resize_container(&cfg->lines_cfg, pending_buckets.lines, next_buckets.lines, sccp_line_cfg_hash, sccp_line_cfg_cmp);
+	resize_container(&cfg->speeddials_cfg, pending_buckets.speeddials, next_buckets.speeddials, sccp_speeddial_cfg_hash, sccp_speeddial_cfg_cmp);
+}
+
 static int pre_apply_config(void)
 {
 	struct sccp_cfg *cfg = aco_pending_config(&cfg_info);
 
+	pending_pre_apply_start = ast_tvnow();
+
 	pre_apply_devices_cfg(cfg);
 	pre_apply_lines_cfg(cfg);
 	pre_apply_general_cfg(cfg);
+	pre_apply_fingerprints(cfg);
+	pre_apply_buckets(cfg);
+
+	pending_pre_apply_end = ast_tvnow();
+	pending_pre_applied = 1;
 
 	return 0;
 }
@@ -749,6 +1025,12 @@ int sccp_config_init(void)
 	aco_option_register_custom(&cfg_info, "guest", ACO_EXACT, general_types, "no", general_cfg_guest_handler, 0);
 	aco_option_register(&cfg_info, "max_guests", ACO_EXACT, general_types, "100", OPT_UINT_T, 0, FLDSET(struct sccp_general_cfg, max_guests));
 	aco_option_register_custom(&cfg_info, "tos", ACO_EXACT, general_types, "AF31", general_cfg_tos_handler, 0);
+	aco_option_register(&cfg_info, "reactor_threads", ACO_EXACT, general_types, "0", OPT_INT_T, PARSE_IN_RANGE, FLDSET(struct sccp_general_cfg, reactor_threads), 0, 256);
+	aco_option_register(&cfg_info, "listeners", ACO_EXACT, general_types, "1", OPT_INT_T, PARSE_IN_RANGE, FLDSET(struct sccp_general_cfg, listeners), 1, 64);
+	aco_option_register(&cfg_info, "listen_backlog", ACO_EXACT, general_types, "50", OPT_INT_T, PARSE_IN_RANGE, FLDSET(struct sccp_general_cfg, listen_backlog), 1, 65535);
+	aco_option_register(&cfg_info, "register_rate", ACO_EXACT, general_types, "0", OPT_UINT_T, PARSE_IN_RANGE, FLDSET(struct sccp_general_cfg, register_rate), 0, 100000);
+	aco_option_register(&cfg_info, "register_burst", ACO_EXACT, general_types, "20", OPT_UINT_T, PARSE_IN_RANGE, FLDSET(struct sccp_general_cfg, register_burst), 1, 100000);
+	aco_option_register(&cfg_info, "send_buffer_max", ACO_EXACT, general_types, "65536", OPT_UINT_T, PARSE_IN_RANGE, FLDSET(struct sccp_general_cfg, send_buffer_max), 4096, 16777216);
 
 	/* device options */
 	aco_option_register(&cfg_info, "type", ACO_EXACT, device_types, NULL, OPT_NOOP_T, 0, 0);
@@ -757,6 +1039,7 @@ int sccp_config_init(void)
 	aco_option_register(&cfg_info, "vmexten", ACO_EXACT, device_types, "*98", OPT_CHAR_ARRAY_T, 0, CHARFLDSET(struct sccp_device_cfg, vmexten));
 	aco_option_register(&cfg_info, "keepalive", ACO_EXACT, device_types, "10", OPT_INT_T, PARSE_IN_RANGE, FLDSET(struct sccp_device_cfg, keepalive), 1, 600);
 	aco_option_register(&cfg_info, "dialtimeout", ACO_EXACT, device_types, "2", OPT_INT_T, PARSE_IN_RANGE, FLDSET(struct sccp_device_cfg, dialtimeout), 1, 60);
+	aco_option_register(&cfg_info, "blf_window", ACO_EXACT, device_types, "100", OPT_INT_T, PARSE_IN_RANGE, FLDSET(struct sccp_device_cfg, blf_window), 0, 5000);
 	aco_option_register(&cfg_info, "timezone", ACO_EXACT, device_types, NULL, OPT_CHAR_ARRAY_T, 0, CHARFLDSET(struct sccp_device_cfg, timezone));
 	aco_option_register_custom(&cfg_info, "line", ACO_EXACT, device_types, NULL, device_cfg_line_handler, 0);
 	aco_option_register_custom(&cfg_info, "speeddial", ACO_EXACT, device_types, NULL, device_cfg_speeddial_handler, 0);
@@ -789,13 +1072,33 @@ int sccp_config_init(void)
 
 static int sccp_config_load_internal(int reload)
 {
-	if (aco_process_config(&cfg_info, reload) == ACO_PROCESS_ERROR) {
+	struct timeval start = ast_tvnow();
+	enum aco_process_status status;
+
+	pending_pre_applied = 0;
+	status = aco_process_config(&cfg_info, reload);
+	if (status == ACO_PROCESS_ERROR) {
 		return -1;
 	}
 
+	if (status == ACO_PROCESS_OK && pending_pre_applied) {
+		ast_mutex_lock(&timing_lock);
+		last_timing.parse_ms = ast_tvdiff_ms(pending_pre_apply_start, start);
+		last_timing.link_ms = ast_tvdiff_ms(pending_pre_apply_end, pending_pre_apply_start);
+		last_timing.apply_ms = ast_tvdiff_ms(ast_tvnow(), pending_pre_apply_end);
+		ast_mutex_unlock(&timing_lock);
+	}
+
 	return 0;
 }
 
+void sccp_config_get_timing(struct sccp_config_timing *timing)
+{
+	ast_mutex_lock(&timing_lock);
+	*timing = last_timing;
+	ast_mutex_unlock(&timing_lock);
+}
+
 int sccp_config_load(void)
 {
 	return sccp_config_load_internal(0);
@@ -840,6 +1143,64 @@ struct sccp_device_cfg *sccp_cfg_find_device_or_guest(struct sccp_cfg *cfg, cons
 	return NULL;
 }
 
+int sccp_cfg_general_changed(struct sccp_cfg *old_cfg, struct sccp_cfg *new_cfg)
+{
+	return old_cfg->general_cfg->fingerprint != new_cfg->general_cfg->fingerprint;
+}
+
+struct diff_devices_data {
+	struct ao2_container *other_devices_cfg;
+	sccp_cfg_diff_cb *callback;
+	void *data;
+	size_t count;
+	/* if true, only report the devices that are not in other_devices_cfg */
+	int missing_only;
+};
+
+static int cb_diff_devices(void *obj, void *arg, int flags)
+{
+	struct sccp_device_cfg *device_cfg = obj;
+	struct sccp_device_cfg *other_device_cfg;
+	struct diff_devices_data *diff_data = arg;
+	int changed;
+
+	other_device_cfg = ao2_find(diff_data->other_devices_cfg, device_cfg->name, OBJ_SEARCH_KEY);
+	if (!other_device_cfg) {
+		changed = 1;
+	} else {
+		changed = !diff_data->missing_only && other_device_cfg->fingerprint != device_cfg->fingerprint;
+		ao2_ref(other_device_cfg, -1);
+	}
+
+	if (changed) {
+		diff_data->callback(device_cfg->name, diff_data->data);
+		diff_data->count++;
+	}
+
+	return 0;
+}
+
+size_t sccp_cfg_diff_devices(struct sccp_cfg *old_cfg, struct sccp_cfg *new_cfg, sccp_cfg_diff_cb callback, void *data)
+{
+	struct diff_devices_data diff_data = {
+		.callback = callback,
+		.data = data,
+		.count = 0,
+	};
+
+	/* added or modified devices */
+	diff_data.other_devices_cfg = old_cfg->devices_cfg;
+	diff_data.missing_only = 0;
+	ao2_callback(new_cfg->devices_cfg, OBJ_NODATA | OBJ_MULTIPLE, cb_diff_devices, &diff_data);
+
+	/* removed devices */
+	diff_data.other_devices_cfg = new_cfg->devices_cfg;
+	diff_data.missing_only = 1;
+	ao2_callback(old_cfg->devices_cfg, OBJ_NODATA | OBJ_MULTIPLE, cb_diff_devices, &diff_data);
+
+	return diff_data.count;
+}
+
 struct sccp_line_cfg *sccp_cfg_find_line(struct sccp_cfg *cfg, const char *name)
 {
 	return ao2_find(cfg->lines_cfg, name, OBJ_SEARCH_KEY);
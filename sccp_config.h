@@ -5,6 +5,7 @@
 #include <asterisk/mwi.h>
 #include <asterisk/channel.h>
 #include <stddef.h>
+#include <stdint.h>
 
 #include "sccp.h"
 
@@ -21,6 +22,15 @@ struct sccp_general_cfg {
 	int authtimeout;
 	unsigned int max_guests;
 	unsigned int tos;
+	int reactor_threads;
+	int listeners;
+	int listen_backlog;
+	unsigned int register_rate;
+	unsigned int register_burst;
+	unsigned int send_buffer_max;
+
+	/* hash of the general settings used by the sessions and of the guest device config, to detect changes on reload */
+	uint64_t fingerprint;
 
 	struct sccp_device_cfg *guest_device_cfg;
 
@@ -29,14 +39,20 @@ struct sccp_general_cfg {
 
 struct sccp_device_cfg {
 	char name[SCCP_DEVICE_NAME_MAX];
+	/* cached hash of name */
+	int hash;
 	char dateformat[8];
 	char voicemail[AST_MAX_MAILBOX_UNIQUEID];
 	char vmexten[AST_MAX_EXTENSION];
 	char timezone[40];
 	int keepalive;
 	int dialtimeout;
+	/* milliseconds during which the BLF state changes are coalesced */
+	int blf_window;
 
 	int guest;
+	/* hash of the device, line and speeddials settings, to detect changes on reload */
+	uint64_t fingerprint;
 	size_t speeddial_count;
 	struct sccp_line_cfg *line_cfg;
 	struct sccp_speeddial_cfg **speeddials_cfg;
@@ -46,6 +62,8 @@ struct sccp_device_cfg {
 
 struct sccp_line_cfg {
 	char name[SCCP_LINE_NAME_MAX];
+	/* cached hash of name */
+	int hash;
 	char cid_num[40];
 	char cid_name[40];
 	char language[MAX_LANGUAGE];
@@ -69,6 +87,8 @@ struct sccp_line_cfg {
 
 struct sccp_speeddial_cfg {
 	char name[SCCP_SPEEDDIAL_NAME_MAX];
+	/* cached hash of name */
+	int hash;
 	char label[40];
 	char extension[AST_MAX_EXTENSION];
 	int blf;
@@ -108,6 +128,22 @@ int sccp_config_load(void);
  */
 int sccp_config_reload(void);
 
+struct sccp_config_timing {
+	/* time spent parsing the config file */
+	int parse_ms;
+	/* time spent linking and validating the devices, lines and speeddials */
+	int link_ms;
+	/* time spent publishing the new config */
+	int apply_ms;
+};
+
+/*!
+ * \brief Get the timing of the last successful config load.
+ *
+ * \param timing memory where the timing will be saved
+ */
+void sccp_config_get_timing(struct sccp_config_timing *timing);
+
 /*!
  * \brief Get the current config.
  *
@@ -135,6 +171,31 @@ struct sccp_device_cfg *sccp_cfg_find_device(struct sccp_cfg *cfg, const char *n
  */
 struct sccp_device_cfg *sccp_cfg_find_device_or_guest(struct sccp_cfg *cfg, const char *name);
 
+/*!
+ * \brief Return true if the general config differs between old_cfg and new_cfg.
+ *
+ * Only the general settings used by the sessions with a device are compared. The
+ * guest device config is considered part of the general config, since it applies
+ * to any number of devices.
+ */
+int sccp_cfg_general_changed(struct sccp_cfg *old_cfg, struct sccp_cfg *new_cfg);
+
+/*!
+ * \brief Function type for the sccp_cfg_diff_devices function.
+ */
+typedef void (sccp_cfg_diff_cb)(const char *name, void *data);
+
+/*!
+ * \brief Call a function for each device whose config differs between old_cfg and new_cfg.
+ *
+ * The callback is called with the name of every device that has been added, removed,
+ * or whose config (including its line and speeddials) has been modified. The guest
+ * device config is not compared.
+ *
+ * \retval the number of devices that differ
+ */
+size_t sccp_cfg_diff_devices(struct sccp_cfg *old_cfg, struct sccp_cfg *new_cfg, sccp_cfg_diff_cb callback, void *data);
+
 /*!
  * \brief Find the line config with the given name.
  *
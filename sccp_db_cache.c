@@ -0,0 +1,383 @@
+#include <asterisk.h>
+#include <asterisk/astdb.h>
+#include <asterisk/astobj2.h>
+#include <asterisk/linkedlists.h>
+#include <asterisk/lock.h>
+#include <asterisk/strings.h>
+#include <asterisk/utils.h>
+
+#include "sccp.h"
+#include "sccp_db_cache.h"
+#include "sccp_utils.h"
+
+#define DB_FAMILY_MAX 32
+
+/*
+ * All the state of the cache, including the entries, is protected by cache_lock. The
+ * astdb is only accessed from the writer thread (and at init), never with the lock held.
+ *
+ * An entry is in the pending list at most once, i.e. when it is dirty; the writer thread
+ * writes the value the entry has at the time it is taken off the list, so many changes
+ * made to the same key in a row result in a single write.
+ */
+struct db_entry {
+	AST_LIST_ENTRY(db_entry) list;
+	/* non-zero if the entry has a value, zero if it has been deleted */
+	int present;
+	/* non-zero if the entry is in the pending list */
+	int dirty;
+	char family[DB_FAMILY_MAX];
+	char key[AST_MAX_EXTENSION];
+	char value[AST_MAX_EXTENSION];
+};
+
+struct db_key {
+	const char *family;
+	const char *key;
+};
+
+static const char *const cached_families[] = {
+	SCCP_DB_FAMILY_DND,
+	SCCP_DB_FAMILY_CFWDALL,
+};
+
+static ast_mutex_t cache_lock;
+static ast_cond_t cache_cond;
+static struct ao2_container *entries;
+static AST_LIST_HEAD_NOLOCK(, db_entry) pending;
+static pthread_t writer_thread;
+static int writer_stop;
+static struct sccp_db_cache_stats stats;
+
+static int db_key_hash(const char *family, const char *key)
+{
+	/* computed unsigned, since the signed multiplication could overflow */
+	return (int) ((unsigned int) ast_str_hash(family) * 31u + (unsigned int) ast_str_hash(key));
+}
+
+static int db_entry_hash(const void *obj, int flags)
+{
+	const struct db_entry *entry;
+	const struct db_key *db_key;
+
+	if (flags & OBJ_SEARCH_KEY) {
+		db_key = obj;
+		return db_key_hash(db_key->family, db_key->key);
+	}
+
+	entry = obj;
+
+	return db_key_hash(entry->family, entry->key);
+}
+
+static int db_entry_cmp(void *obj, void *arg, int flags)
+{
+	struct db_entry *entry = obj;
+	const char *family;
+	const char *key;
+
+	if (flags & OBJ_SEARCH_KEY) {
+		family = ((const struct db_key *) arg)->family;
+		key = ((const struct db_key *) arg)->key;
+	} else {
+		family = ((const struct db_entry *) arg)->family;
+		key = ((const struct db_entry *) arg)->key;
+	}
+
+	return strcmp(entry->key, key) || strcmp(entry->family, family) ? 0 : (CMP_MATCH | CMP_STOP);
+}
+
+/*
+ * Must be called with cache_lock held.
+ */
+static struct db_entry *db_entry_find(const char *family, const char *key)
+{
+	struct db_key db_key = {
+		.family = family,
+		.key = key,
+	};
+
+	return ao2_find(entries, &db_key, OBJ_SEARCH_KEY | OBJ_NOLOCK);
+}
+
+/*
+ * Must be called with cache_lock held.
+ */
+static struct db_entry *db_entry_get_or_create(const char *family, const char *key)
+{
+	struct db_entry *entry;
+
+	entry = db_entry_find(family, key);
+	if (entry) {
+		return entry;
+	}
+
+	if (strlen(family) >= sizeof(entry->family) || strlen(key) >= sizeof(entry->key)) {
+		ast_log(LOG_ERROR, "db cache: key %s/%s is too long\n", family, key);
+		return NULL;
+	}
+
+	entry = ao2_alloc_options(sizeof(*entry), NULL, AO2_ALLOC_OPT_LOCK_NOLOCK);
+	if (!entry) {
+		return NULL;
+	}
+
+	ast_copy_string(entry->family, family, sizeof(entry->family));
+	ast_copy_string(entry->key, key, sizeof(entry->key));
+
+	if (!ao2_link_flags(entries, entry, OBJ_NOLOCK)) {
+		ao2_ref(entry, -1);
+		return NULL;
+	}
+
+	return entry;
+}
+
+/*
+ * Must be called with cache_lock held.
+ */
+static void db_entry_mark_dirty(struct db_entry *entry)
+{
+	if (entry->dirty) {
+		return;
+	}
+
+	entry->dirty = 1;
+	ao2_ref(entry, +1);
+	AST_LIST_INSERT_TAIL(&pending, entry, list);
+	stats.pending_writes++;
+	ast_cond_signal(&cache_cond);
+}
+
+static void *writer_run(void *data)
+{
+	struct db_entry *entry;
+	char value[AST_MAX_EXTENSION];
+	int present;
+
+	ast_mutex_lock(&cache_lock);
+	for (;;) {
+		while (AST_LIST_EMPTY(&pending) && !writer_stop) {
+			ast_cond_wait(&cache_cond, &cache_lock);
+		}
+
+		/* the pending changes are written even when stopping */
+		entry = AST_LIST_REMOVE_HEAD(&pending, list);
+		if (!entry) {
+			break;
+		}
+
+		entry->dirty = 0;
+		present = entry->present;
+		ast_copy_string(value, entry->value, sizeof(value));
+		stats.pending_writes--;
+		ast_mutex_unlock(&cache_lock);
+
+		if (present) {
+			ast_db_put(entry->family, entry->key, value);
+		} else {
+			ast_db_del(entry->family, entry->key);
+		}
+
+		ao2_ref(entry, -1);
+
+		ast_mutex_lock(&cache_lock);
+		stats.writes++;
+	}
+	ast_mutex_unlock(&cache_lock);
+
+	return NULL;
+}
+
+static size_t tree_count(struct ast_db_entry *tree)
+{
+	size_t count = 0;
+
+	for (; tree; tree = tree->next) {
+		count++;
+	}
+
+	return count;
+}
+
+static void load_family(const char *family, struct ast_db_entry *tree)
+{
+	struct ast_db_entry *db_entry;
+	struct db_entry *entry;
+	size_t prefix_len = strlen(family) + 2;
+
+	for (db_entry = tree; db_entry; db_entry = db_entry->next) {
+		/* the keys are of the form "/family/key" */
+		if (strlen(db_entry->key) <= prefix_len || strncmp(db_entry->key + 1, family, prefix_len - 2)) {
+			continue;
+		}
+
+		entry = db_entry_get_or_create(family, db_entry->key + prefix_len);
+		if (!entry) {
+			continue;
+		}
+
+		entry->present = 1;
+		ast_copy_string(entry->value, db_entry->data, sizeof(entry->value));
+		stats.entries++;
+		ao2_ref(entry, -1);
+	}
+}
+
+int sccp_db_cache_init(void)
+{
+	struct ast_db_entry *trees[ARRAY_LEN(cached_families)];
+	size_t count = 0;
+	size_t i;
+	int ret;
+
+	/* the families are read first, so that the container is sized for them */
+	for (i = 0; i < ARRAY_LEN(cached_families); i++) {
+		trees[i] = ast_db_gettree(cached_families[i], NULL);
+		count += tree_count(trees[i]);
+	}
+
+	entries = ao2_container_alloc_hash(AO2_ALLOC_OPT_LOCK_NOLOCK, 0, sccp_buckets(count), db_entry_hash, NULL, db_entry_cmp);
+	if (!entries) {
+		for (i = 0; i < ARRAY_LEN(cached_families); i++) {
+			ast_db_freetree(trees[i]);
+		}
+
+		return -1;
+	}
+
+	ast_mutex_init(&cache_lock);
+	ast_cond_init(&cache_cond, NULL);
+	AST_LIST_HEAD_INIT_NOLOCK(&pending);
+	memset(&stats, 0, sizeof(stats));
+	writer_stop = 0;
+
+	for (i = 0; i < ARRAY_LEN(cached_families); i++) {
+		load_family(cached_families[i], trees[i]);
+		ast_db_freetree(trees[i]);
+	}
+
+	ret = ast_pthread_create_background(&writer_thread, NULL, writer_run, NULL);
+	if (ret) {
+		ast_log(LOG_ERROR, "db cache init failed: pthread create: %s\n", strerror(ret));
+		ast_cond_destroy(&cache_cond);
+		ast_mutex_destroy(&cache_lock);
+		ao2_ref(entries, -1);
+		entries = NULL;
+		return -1;
+	}
+
+	return 0;
+}
+
+void sccp_db_cache_destroy(void)
+{
+	int ret;
+
+	ast_mutex_lock(&cache_lock);
+	writer_stop = 1;
+	ast_cond_signal(&cache_cond);
+	ast_mutex_unlock(&cache_lock);
+
+	ret = pthread_join(writer_thread, NULL);
+	if (ret) {
+		ast_log(LOG_ERROR, "db cache destroy failed: pthread_join: %s\n", strerror(ret));
+	}
+
+	ast_cond_destroy(&cache_cond);
+	ast_mutex_destroy(&cache_lock);
+	ao2_ref(entries, -1);
+	entries = NULL;
+}
+
+int sccp_db_cache_get(const char *family, const char *key, char *value, size_t valuelen)
+{
+	struct db_entry *entry;
+	int ret = -1;
+
+	if (!family || !key || !value) {
+		ast_log(LOG_ERROR, "db cache get failed: invalid argument\n");
+		return -1;
+	}
+
+	ast_mutex_lock(&cache_lock);
+	stats.lookups++;
+	entry = db_entry_find(family, key);
+	if (entry) {
+		if (entry->present) {
+			ast_copy_string(value, entry->value, valuelen);
+			stats.found++;
+			ret = 0;
+		}
+
+		ao2_ref(entry, -1);
+	}
+	ast_mutex_unlock(&cache_lock);
+
+	return ret;
+}
+
+int sccp_db_cache_put(const char *family, const char *key, const char *value)
+{
+	struct db_entry *entry;
+
+	if (!family || !key || !value) {
+		ast_log(LOG_ERROR, "db cache put failed: invalid argument\n");
+		return -1;
+	}
+
+	ast_mutex_lock(&cache_lock);
+	entry = db_entry_get_or_create(family, key);
+	if (!entry) {
+		ast_mutex_unlock(&cache_lock);
+		return -1;
+	}
+
+	if (!entry->present || strcmp(entry->value, value)) {
+		if (!entry->present) {
+			entry->present = 1;
+			stats.entries++;
+		}
+
+		ast_copy_string(entry->value, value, sizeof(entry->value));
+		db_entry_mark_dirty(entry);
+	}
+
+	ao2_ref(entry, -1);
+	ast_mutex_unlock(&cache_lock);
+
+	return 0;
+}
+
+int sccp_db_cache_del(const char *family, const char *key)
+{
+	struct db_entry *entry;
+
+	if (!family || !key) {
+		ast_log(LOG_ERROR, "db cache del failed: invalid argument\n");
+		return -1;
+	}
+
+	ast_mutex_lock(&cache_lock);
+	entry = db_entry_find(family, key);
+	if (entry) {
+		if (entry->present) {
+			entry->present = 0;
+			entry->value[0] = '\0';
+			stats.entries--;
+			db_entry_mark_dirty(entry);
+		}
+
+		ao2_ref(entry, -1);
+	}
+	ast_mutex_unlock(&cache_lock);
+
+	return 0;
+}
+
+void sccp_db_cache_get_stats(struct sccp_db_cache_stats *out)
+{
+	ast_mutex_lock(&cache_lock);
+	*out = stats;
+	ast_mutex_unlock(&cache_lock);
+}
@@ -0,0 +1,80 @@
+#ifndef SCCP_DB_CACHE_H_
+#define SCCP_DB_CACHE_H_
+
+#define SCCP_DB_FAMILY_DND "sccp/dnd"
+#define SCCP_DB_FAMILY_CFWDALL "sccp/cfwdall"
+
+struct sccp_db_cache_stats {
+	/* number of entries in the cache */
+	int entries;
+	/* number of sccp_db_cache_get calls, all served from memory */
+	int lookups;
+	/* number of sccp_db_cache_get calls that found a value, i.e. DND or forward set */
+	int found;
+	/* number of changes not yet written to the astdb */
+	int pending_writes;
+	/* number of changes written to the astdb */
+	int writes;
+};
+
+/*!
+ * \brief Initialize the astdb cache.
+ *
+ * The astdb cache holds in memory the SCCP_DB_FAMILY_* families, which are loaded from
+ * the astdb once, here. The lookups are then served from memory, and the changes are
+ * written through to the astdb asynchronously, by a writer thread.
+ *
+ * \note The changes made to these families outside of the cache (e.g. with the
+ *       "database put" CLI command or the DB dialplan function) are not seen until
+ *       the module is loaded again; a config reload doesn't read them again.
+ *
+ * \retval 0 on success
+ * \retval non-zero on failure
+ */
+int sccp_db_cache_init(void);
+
+/*!
+ * \brief Free the resources associated to the astdb cache.
+ *
+ * The pending changes are written to the astdb before this function returns.
+ */
+void sccp_db_cache_destroy(void);
+
+/*!
+ * \brief Get a value from the cache.
+ *
+ * Same semantic as ast_db_get, but never touches the astdb.
+ *
+ * \note This function is thread safe.
+ *
+ * \retval 0 if the value was found
+ * \retval non-zero if there is no such value
+ */
+int sccp_db_cache_get(const char *family, const char *key, char *value, size_t valuelen);
+
+/*!
+ * \brief Put a value in the cache, and queue its write to the astdb.
+ *
+ * \note This function is thread safe.
+ *
+ * \retval 0 on success
+ * \retval non-zero on failure
+ */
+int sccp_db_cache_put(const char *family, const char *key, const char *value);
+
+/*!
+ * \brief Delete a value from the cache, and queue its deletion from the astdb.
+ *
+ * \note This function is thread safe.
+ *
+ * \retval 0 on success
+ * \retval non-zero on failure
+ */
+int sccp_db_cache_del(const char *family, const char *key);
+
+/*!
+ * \brief Get the statistics of the cache.
+ */
+void sccp_db_cache_get_stats(struct sccp_db_cache_stats *stats);
+
+#endif /* SCCP_DB_CACHE_H_ */
@@ -1,5 +1,4 @@
 #include <asterisk.h>
-#include <asterisk/astdb.h>
 #include <asterisk/astobj2.h>
 #include <asterisk/bridge.h>
 #include <asterisk/callerid.h>
@@ -25,10 +24,13 @@
 #include "device/sccp_channel_tech.h"
 #include "device/sccp_rtp_glue.h"
 #include "sccp.h"
+#include "sccp_blf_hub.h"
 #include "sccp_config.h"
+#include "sccp_db_cache.h"
 #include "sccp_device.h"
 #include "sccp_session.h"
 #include "sccp_msg.h"
+#include "sccp_mwi_router.h"
 #include "sccp_queue.h"
 #include "sccp_utils.h"
 
@@ -47,9 +49,11 @@ struct sccp_speeddial {
 	uint32_t index;
 
 	/* updated in session thread only */
-	int exten_state_cb_id;
+	struct sccp_blf_subscription *blf_sub;
 	/* updated in >1 threads */
 	int exten_state;
+	/* updated in >1 threads, set when exten_state has not been transmitted yet */
+	int blf_pending;
 };
 
 struct sccp_speeddials {
@@ -110,6 +114,11 @@ struct sccp_line {
 	 * non-session thread without holding the device lock
 	 */
 	char name[SCCP_LINE_NAME_MAX];
+	/* const, cached hash of name */
+	int name_hash;
+
+	/* last published device state, accessed atomically without holding the device lock */
+	int devstate;
 };
 
 /* limited to exactly 1 line for now, but is the way on to the support of multiple lines,
@@ -168,7 +177,7 @@ struct sccp_device {
 	/* (dynamic) */
 	struct ast_format_cap *caps;	/* Supported capabilities */
 	/* (dynamic, modified in thread session only) */
-	struct stasis_subscription *mwi_event_sub;
+	struct sccp_mwi_subscription *mwi_sub;
 	/* (dynamic) */
 	struct sccp_subchannel *active_subchan;
 
@@ -179,6 +188,12 @@ struct sccp_device {
 	enum sccp_device_state state;
 	int dnd;
 	unsigned int flags;
+	/* updated in session thread only */
+	int blf_flush_scheduled;
+	/* updated in >1 threads */
+	int mwi_new_msgs;
+	/* updated in >1 threads, set when mwi_new_msgs has not been transmitted yet */
+	int mwi_pending;
 	enum sccp_device_type type;
 	uint8_t proto_version;
 
@@ -186,9 +201,15 @@ struct sccp_device {
 	 * device config name (static)
 	 */
 	char name[SCCP_DEVICE_NAME_MAX];
+	/* (static) cached hash of name */
+	int name_hash;
 	char exten[AST_MAX_EXTENSION];
 	char last_exten[AST_MAX_EXTENSION];
 	char callfwd_exten[AST_MAX_EXTENSION];
+
+	/* (dynamic) summary_lock protects summary, which is updated with the device lock held */
+	ast_mutex_t summary_lock;
+	struct sccp_device_snapshot summary;
 };
 
 struct nolock_task_ast_bridge_transfer_attended {
@@ -262,6 +283,7 @@ static int add_dialtimeout_task(struct sccp_device *device, struct sccp_subchann
 static void remove_dialtimeout_task(struct sccp_device *device, struct sccp_subchannel *subchan);
 static int add_fwdtimeout_task(struct sccp_device *device);
 static void remove_fwdtimeout_task(struct sccp_device *device);
+static void remove_blf_flush_task(struct sccp_device *device);
 
 static unsigned int chan_idx = 0;
 
@@ -288,22 +310,29 @@ static struct sccp_speeddial *sccp_speeddial_alloc(struct sccp_speeddial_cfg *cf
 	ao2_ref(cfg, +1);
 	sd->instance = instance;
 	sd->index = index;
-	sd->exten_state_cb_id = -1;
+	sd->blf_sub = NULL;
+	sd->blf_pending = 0;
 
 	return sd;
 }
 
-static int on_extension_state_change(const char *context, const char *exten, struct ast_state_cb_info *info, void *data)
+/*
+ * entry point: yes
+ * thread: any (extension state)
+ *
+ * The device is not locked here; the state is transmitted later from the session
+ * thread, so that a burst of changes results in a single message per speeddial.
+ */
+static void on_extension_state_change(int state, void *data)
 {
 	struct sccp_speeddial *sd = data;
-	struct sccp_device *device = sd->device;
 
-	sccp_device_lock(device);
-	sd->exten_state = info->exten_state;
-	transmit_feature_status(device, sd);
-	sccp_device_unlock(device);
+	sccp_stat_on_blf_received();
 
-	return 0;
+	__atomic_store_n(&sd->exten_state, state, __ATOMIC_SEQ_CST);
+	if (!__atomic_exchange_n(&sd->blf_pending, 1, __ATOMIC_SEQ_CST)) {
+		sccp_session_queue_blf_update(sd->device->session);
+	}
 }
 
 /*
@@ -313,13 +342,10 @@ static void sccp_speeddial_add_extension_state_cb(struct sccp_speeddial *sd)
 {
 	const char *context = sccp_lines_get_default(&sd->device->lines)->cfg->context;
 
-	/* XXX fetching the state isn't part of "add extension state callback", still it makes
-	 *     some sense to do it there...
-	 */
-	sd->exten_state = ast_extension_state(NULL, context, sd->cfg->extension);
-	sd->exten_state_cb_id = ast_extension_state_add(context, sd->cfg->extension, on_extension_state_change, sd);
-	if (sd->exten_state_cb_id == -1) {
-		ast_log(LOG_WARNING, "Could not subscribe to %s@%s\n", sd->cfg->extension, context);
+	/* the extension state is shared with the other speeddials watching the same extension */
+	sd->blf_sub = sccp_blf_hub_subscribe(context, sd->cfg->extension, on_extension_state_change, sd, &sd->exten_state);
+	if (!sd->blf_sub) {
+		sd->exten_state = AST_EXTENSION_REMOVED;
 	}
 }
 
@@ -328,8 +354,9 @@ static void sccp_speeddial_add_extension_state_cb(struct sccp_speeddial *sd)
  */
 static void sccp_speeddial_del_extension_state_cb(struct sccp_speeddial *sd)
 {
-	if (sd->exten_state_cb_id != -1) {
-		ast_extension_state_del(sd->exten_state_cb_id, NULL);
+	if (sd->blf_sub) {
+		sccp_blf_hub_unsubscribe(sd->blf_sub);
+		sd->blf_sub = NULL;
 	}
 }
 
@@ -370,7 +397,7 @@ static enum sccp_blf_status extstate_ast2sccp(const struct sccp_device *device,
 
 static enum sccp_blf_status sccp_speeddial_status(const struct sccp_device *device, const struct sccp_speeddial *sd) {
 	if (sd->cfg->blf) {
-		return extstate_ast2sccp(device, sd->exten_state);
+		return extstate_ast2sccp(device, __atomic_load_n(&sd->exten_state, __ATOMIC_SEQ_CST));
 	} else {
 		return SCCP_BLF_STATUS_UNKNOWN;
 	}
@@ -1047,6 +1074,8 @@ static struct sccp_line *sccp_line_alloc(struct sccp_line_cfg *cfg, struct sccp_
 	ao2_ref(cfg, +1);
 	line->instance = instance;
 	ast_copy_string(line->name, cfg->name, sizeof(line->name));
+	line->name_hash = cfg->hash;
+	line->devstate = AST_DEVICE_NOT_INUSE;
 
 	return line;
 }
@@ -1069,6 +1098,7 @@ static void sccp_line_destroy(struct sccp_line *line)
 
 static void sccp_line_update_devstate(struct sccp_line *line, enum ast_device_state state)
 {
+	__atomic_store_n(&line->devstate, state, __ATOMIC_RELEASE);
 	ast_devstate_changed(state, AST_DEVSTATE_CACHABLE, SCCP_LINE_PREFIX "/%s", line->cfg->name);
 }
 
@@ -1246,6 +1276,7 @@ static void sccp_device_destructor(void *data)
 
 	sccp_queue_destroy(&device->nolock_tasks);
 	ast_mutex_destroy(&device->lock);
+	ast_mutex_destroy(&device->summary_lock);
 	ao2_ref(device->caps, -1);
 	ao2_ref(device->session, -1);
 	ao2_ref(device->cfg, -1);
@@ -1290,6 +1321,28 @@ static int device_type_is_supported(enum sccp_device_type device_type)
 	return supported;
 }
 
+/*
+ * Must be called with the device lock held, or before the device is shared.
+ */
+static void update_summary(struct sccp_device *device)
+{
+	struct sccp_device_snapshot summary;
+	struct ast_str *buf = ast_str_alloca(sizeof(summary.capabilities));
+
+	summary.type = device->type;
+	summary.guest = device->cfg->guest;
+	summary.proto_version = device->proto_version;
+	ast_copy_string(summary.name, device->name, sizeof(summary.name));
+	ast_copy_string(summary.ipaddr, sccp_session_remote_addr_ch(device->session), sizeof(summary.ipaddr));
+	ast_format_cap_get_names(device->caps, &buf);
+	ast_copy_string(summary.capabilities, ast_str_buffer(buf), sizeof(summary.capabilities));
+
+	ast_mutex_lock(&device->summary_lock);
+	summary.version = device->summary.version + 1;
+	device->summary = summary;
+	ast_mutex_unlock(&device->summary_lock);
+}
+
 static struct sccp_device *sccp_device_alloc(struct sccp_device_cfg *cfg, struct sccp_session *session, struct sccp_device_info *info)
 {
 	struct ast_format_cap *caps;
@@ -1307,6 +1360,7 @@ static struct sccp_device *sccp_device_alloc(struct sccp_device_cfg *cfg, struct
 	}
 
 	ast_mutex_init(&device->lock);
+	ast_mutex_init(&device->summary_lock);
 	sccp_msg_builder_init(&device->msg_builder, info->proto_version);
 	sccp_queue_init(&device->nolock_tasks, sizeof(struct nolock_task));
 	device->session = session;
@@ -1315,7 +1369,7 @@ static struct sccp_device *sccp_device_alloc(struct sccp_device_cfg *cfg, struct
 	ao2_ref(cfg, +1);
 	device->state = STATE_NEW;
 	device->caps = caps;
-	device->mwi_event_sub = NULL;
+	device->mwi_sub = NULL;
 	device->active_subchan = NULL;
 	/* The callid is not initialized to 1 since the 7940 needs a power cycle
 	   to track calls with a callid lower than the last callid in it's outgoing
@@ -1330,9 +1384,11 @@ static struct sccp_device *sccp_device_alloc(struct sccp_device_cfg *cfg, struct
 	device->type = info->type;
 	device->proto_version = info->proto_version;
 	ast_copy_string(device->name, info->name, sizeof(device->name));
+	device->name_hash = ast_str_hash(device->name);
 	device->exten[0] = '\0';
 	device->last_exten[0] = '\0';
 	device->callfwd_exten[0] = '\0';
+	update_summary(device);
 
 	return device;
 }
@@ -1384,6 +1440,7 @@ void sccp_device_destroy(struct sccp_device *device)
 {
 	sccp_speeddials_destroy(&device->speeddials);
 	unsubscribe_mwi(device);
+	remove_blf_flush_task(device);
 
 	sccp_device_lock(device);
 
@@ -1400,9 +1457,14 @@ void sccp_device_destroy(struct sccp_device *device)
 	sccp_device_unlock(device);
 }
 
+/*
+ * The session is corked while the device is locked, so that all the messages
+ * transmitted in the same critical section are written at once on unlock.
+ */
 static void sccp_device_lock(struct sccp_device *device)
 {
 	ast_mutex_lock(&device->lock);
+	sccp_session_cork(device->session);
 }
 
 static void sccp_device_unlock(struct sccp_device *device)
@@ -1411,11 +1473,13 @@ static void sccp_device_unlock(struct sccp_device *device)
 
 	if (sccp_queue_empty(&device->nolock_tasks)) {
 		ast_mutex_unlock(&device->lock);
+		sccp_session_uncork(device->session);
 		return;
 	}
 
 	sccp_queue_move(&tasks, &device->nolock_tasks);
 	ast_mutex_unlock(&device->lock);
+	sccp_session_uncork(device->session);
 
 	exec_nolock_tasks(&tasks);
 	sccp_queue_destroy(&tasks);
@@ -1857,7 +1921,7 @@ static void set_callforward(struct sccp_device *device, const char *exten)
 	ast_copy_string(device->callfwd_exten, exten, sizeof(device->callfwd_exten));
 
 	remove_fwdtimeout_task(device);
-	ast_db_put("sccp/cfwdall", device->name, device->callfwd_exten);
+	sccp_db_cache_put(SCCP_DB_FAMILY_CFWDALL, device->name, device->callfwd_exten);
 
 	transmit_callstate(device, SCCP_ONHOOK, line->instance, device->callfwd_id);
 	transmit_line_forward_status_res(device, line);
@@ -1878,7 +1942,7 @@ static void clear_callforward(struct sccp_device *device)
 	device->callfwd = SCCP_CFWD_INACTIVE;
 	device->callfwd_exten[0] = '\0';
 
-	ast_db_del("sccp/cfwdall", device->name);
+	sccp_db_cache_del(SCCP_DB_FAMILY_CFWDALL, device->name);
 
 	transmit_line_forward_status_res(device, line);
 	update_displaymessage(device);
@@ -1899,20 +1963,32 @@ static void cancel_callforward_input(struct sccp_device *device)
 
 /*
  * entry point: yes
+ * thread: any (stasis)
+ *
+ * The device is not locked here; the lamp state is transmitted from the session thread.
  */
-static void on_mwi_event(void *data, struct stasis_subscription *sub, struct stasis_message *msg)
+static void on_mwi_event(int new_msgs, void *data)
 {
 	struct sccp_device *device = data;
-	struct ast_mwi_state *mwi_state;
 
-	if (ast_mwi_state_type() != stasis_message_type(msg)) {
+	__atomic_store_n(&device->mwi_new_msgs, new_msgs, __ATOMIC_SEQ_CST);
+	if (!__atomic_exchange_n(&device->mwi_pending, 1, __ATOMIC_SEQ_CST)) {
+		sccp_session_queue_mwi_update(device->session);
+	}
+}
+
+void sccp_device_on_mwi_update(struct sccp_device *device)
+{
+	if (device->state == STATE_DESTROYED) {
 		return;
 	}
 
-	mwi_state = stasis_message_data(msg);
+	if (!__atomic_exchange_n(&device->mwi_pending, 0, __ATOMIC_SEQ_CST)) {
+		return;
+	}
 
 	sccp_device_lock(device);
-	transmit_voicemail_lamp_state(device, mwi_state->new_msgs);
+	transmit_voicemail_lamp_state(device, __atomic_load_n(&device->mwi_new_msgs, __ATOMIC_SEQ_CST));
 	sccp_device_unlock(device);
 }
 
@@ -1921,21 +1997,22 @@ static void on_mwi_event(void *data, struct stasis_subscription *sub, struct sta
  */
 static void subscribe_mwi(struct sccp_device *device)
 {
-	struct stasis_topic *mwi_topic;
+	int new_msgs;
 
 	if (ast_strlen_zero(device->cfg->voicemail)) {
 		return;
 	}
 
-	mwi_topic = ast_mwi_topic(device->cfg->voicemail);
-	if (!mwi_topic) {
-		ast_log(LOG_WARNING, "device %s subscribe mwi failed: no mwi topic\n", device->name);
+	/* the stasis subscription is shared with the other devices using the same mailbox */
+	device->mwi_sub = sccp_mwi_router_subscribe(device->cfg->voicemail, on_mwi_event, device, &new_msgs);
+	if (!device->mwi_sub) {
+		ast_log(LOG_WARNING, "device %s subscribe mwi failed\n", device->name);
 		return;
 	}
 
-	device->mwi_event_sub = stasis_subscribe_pool(mwi_topic, on_mwi_event, device);
-	if (!device->mwi_event_sub) {
-		ast_log(LOG_WARNING, "device %s subscribe mwi failed: could not subscribe to topic\n", device->name);
+	/* else the voicemail lamp is set once the router has fetched the count */
+	if (new_msgs != -1) {
+		on_mwi_event(new_msgs, device);
 	}
 }
 
@@ -1945,8 +2022,9 @@ static void subscribe_mwi(struct sccp_device *device)
  */
 static void unsubscribe_mwi(struct sccp_device *device)
 {
-	if (device->mwi_event_sub) {
-		device->mwi_event_sub = stasis_unsubscribe_and_join(device->mwi_event_sub);
+	if (device->mwi_sub) {
+		sccp_mwi_router_unsubscribe(device->mwi_sub);
+		device->mwi_sub = NULL;
 	}
 }
 
@@ -2306,6 +2384,8 @@ static void handle_msg_capabilities_res(struct sccp_device *device, struct sccp_
 			ast_format_cap_append(device->caps, format, 0);
 		}
 	}
+
+	update_summary(device);
 }
 
 static void handle_msg_config_status_req(struct sccp_device *device)
@@ -2620,10 +2700,10 @@ static void handle_softkey_dnd(struct sccp_device *device)
 {
 	if (device->dnd) {
 		device->dnd = 0;
-		ast_db_del("sccp/dnd", device->name);
+		sccp_db_cache_del(SCCP_DB_FAMILY_DND, device->name);
 	} else {
 		device->dnd = 1;
-		ast_db_put("sccp/dnd", device->name, "on");
+		sccp_db_cache_put(SCCP_DB_FAMILY_DND, device->name, "on");
 	}
 
 	update_displaymessage(device);
@@ -3115,6 +3195,7 @@ int sccp_device_reload_config(struct sccp_device *device, struct sccp_device_cfg
 
 	sccp_lines_apply_config(&device->lines, new_device_cfg);
 	sccp_speeddials_apply_config(&device->speeddials, new_device_cfg);
+	update_summary(device);
 
 	sccp_device_unlock(device);
 
@@ -3134,6 +3215,15 @@ void sccp_device_on_connection_lost(struct sccp_device *device)
  */
 static void on_keepalive_timeout(struct sccp_device *device, void __attribute__((unused)) *data)
 {
+	int timeout = 2 * device->cfg->keepalive;
+	int idle_time = sccp_session_idle_time(device->session);
+
+	/* the deadline is not pushed back on every read, but only when it is reached */
+	if (idle_time < timeout) {
+		sccp_session_add_device_task(device->session, on_keepalive_timeout, NULL, timeout - idle_time);
+		return;
+	}
+
 	ast_log(LOG_NOTICE, "Device %s has timed out\n", device->name);
 
 	sccp_session_stop(device->session);
@@ -3201,36 +3291,62 @@ static void remove_fwdtimeout_task(struct sccp_device *device)
 	sccp_session_remove_device_task(device->session, on_fwd_timeout, NULL);
 }
 
-void sccp_device_on_data_read(struct sccp_device *device)
-{
-	add_keepalive_task(device);
-}
-
 /*
+ * entry point: yes
  * thread: session
  */
-static void init_voicemail_lamp_state(struct sccp_device *device)
+static void on_blf_flush(struct sccp_device *device, void __attribute__((unused)) *data)
 {
-	int new_msgs;
-	int old_msgs;
+	struct sccp_speeddial *sd;
+	size_t i;
 
-	if (ast_strlen_zero(device->cfg->voicemail)) {
+	device->blf_flush_scheduled = 0;
+
+	sccp_device_lock(device);
+	for (i = 0; i < device->speeddials.count; i++) {
+		sd = device->speeddials.arr[i];
+		if (__atomic_exchange_n(&sd->blf_pending, 0, __ATOMIC_SEQ_CST)) {
+			transmit_feature_status(device, sd);
+			sccp_stat_on_blf_transmitted();
+		}
+	}
+	sccp_device_unlock(device);
+}
+
+static void remove_blf_flush_task(struct sccp_device *device)
+{
+	if (device->blf_flush_scheduled) {
+		sccp_session_remove_device_task(device->session, on_blf_flush, NULL);
+		device->blf_flush_scheduled = 0;
+	}
+}
+
+void sccp_device_on_blf_update(struct sccp_device *device)
+{
+	int window = device->cfg->blf_window;
+
+	if (device->state == STATE_DESTROYED || device->blf_flush_scheduled) {
 		return;
 	}
 
-	if (ast_app_inboxcount(device->cfg->voicemail, &new_msgs, &old_msgs) == -1) {
-		ast_log(LOG_NOTICE, "could not get voicemail count for %s\n", device->cfg->voicemail);
+	if (!window) {
+		on_blf_flush(device, NULL);
 		return;
 	}
 
-	transmit_voicemail_lamp_state(device, new_msgs);
+	if (sccp_session_add_device_task_ms(device->session, on_blf_flush, NULL, window)) {
+		on_blf_flush(device, NULL);
+		return;
+	}
+
+	device->blf_flush_scheduled = 1;
 }
 
 static void init_dnd(struct sccp_device *device)
 {
 	char dnd_status[4];
 
-	if (!ast_db_get("sccp/dnd", device->name, dnd_status, sizeof(dnd_status))) {
+	if (!sccp_db_cache_get(SCCP_DB_FAMILY_DND, device->name, dnd_status, sizeof(dnd_status))) {
 		device->dnd = 1;
 	} else {
 		device->dnd = 0;
@@ -3241,7 +3357,7 @@ static void init_callfwd(struct sccp_device *device)
 {
 	char exten[AST_MAX_EXTENSION];
 
-	if (!ast_db_get("sccp/cfwdall", device->name, exten, sizeof(exten))) {
+	if (!sccp_db_cache_get(SCCP_DB_FAMILY_CFWDALL, device->name, exten, sizeof(exten))) {
 		set_callforward(device, exten);
 	} else {
 		struct sccp_line *line = sccp_lines_get_default(&device->lines);
@@ -3249,9 +3365,9 @@ static void init_callfwd(struct sccp_device *device)
 		/* callforward was set on the default line previously, so also check
 		 * if the default line has an entry in the ast_db
 		 */
-		if (!ast_db_get("sccp/cfwdall", line->name, exten, sizeof(exten))) {
+		if (!sccp_db_cache_get(SCCP_DB_FAMILY_CFWDALL, line->name, exten, sizeof(exten))) {
 			set_callforward(device, exten);
-			ast_db_del("sccp/cfwdall", line->name);
+			sccp_db_cache_del(SCCP_DB_FAMILY_CFWDALL, line->name);
 		}
 	}
 }
@@ -3269,7 +3385,6 @@ void sccp_device_on_registration_success(struct sccp_device *device)
 
 	init_dnd(device);
 	init_callfwd(device);
-	init_voicemail_lamp_state(device);
 
 	update_displaymessage(device);
 
@@ -3299,18 +3414,9 @@ int sccp_device_reset(struct sccp_device *device, enum sccp_reset_type type)
 
 void sccp_device_take_snapshot(struct sccp_device *device, struct sccp_device_snapshot *snapshot)
 {
-	struct ast_str *buf = ast_str_alloca(sizeof(snapshot->capabilities));
-
-	sccp_device_lock(device);
-	snapshot->type = device->type;
-	snapshot->guest = device->cfg->guest;
-	snapshot->proto_version = device->proto_version;
-	ast_copy_string(snapshot->name, device->name, sizeof(snapshot->name));
-	ast_copy_string(snapshot->ipaddr, sccp_session_remote_addr_ch(device->session), sizeof(snapshot->ipaddr));
-	ast_format_cap_get_names(device->caps, &buf);
-	sccp_device_unlock(device);
-
-	ast_copy_string(snapshot->capabilities, ast_str_buffer(buf), sizeof(snapshot->capabilities));
+	ast_mutex_lock(&device->summary_lock);
+	*snapshot = device->summary;
+	ast_mutex_unlock(&device->summary_lock);
 }
 
 unsigned int sccp_device_line_count(const struct sccp_device *device)
@@ -3332,6 +3438,16 @@ const char *sccp_device_name(const struct sccp_device *device)
 	return device->name;
 }
 
+int sccp_device_name_hash(const struct sccp_device *device)
+{
+	return device->name_hash;
+}
+
+struct sccp_session *sccp_device_session(struct sccp_device *device)
+{
+	return device->session;
+}
+
 int sccp_device_is_guest(struct sccp_device *device)
 {
 	int guest;
@@ -3348,6 +3464,11 @@ const char *sccp_line_name(const struct sccp_line *line)
 	return line->name;
 }
 
+int sccp_line_name_hash(const struct sccp_line *line)
+{
+	return line->name_hash;
+}
+
 static int channel_tech_requester_locked(struct sccp_device *device, struct sccp_line *line, struct ast_channel *channel, const char *options, struct ast_format_cap *cap, int *cause)
 {
 	struct sccp_subchannel *subchan;
@@ -3418,21 +3539,7 @@ struct ast_channel *sccp_channel_tech_requester(struct sccp_line *line, const ch
 
 int sccp_channel_tech_devicestate(const struct sccp_line *line)
 {
-	struct sccp_device *device = line->device;
-	int res;
-
-	sccp_device_lock(device);
-	if (device->state == STATE_DESTROYED) {
-		res = AST_DEVICE_UNAVAILABLE;
-	} else if (AST_LIST_EMPTY(&line->subchans)) {
-		res = AST_DEVICE_NOT_INUSE;
-	} else {
-		res = AST_DEVICE_INUSE;
-	}
-
-	sccp_device_unlock(device);
-
-	return res;
+	return __atomic_load_n(&line->devstate, __ATOMIC_ACQUIRE);
 }
 
 static void format_party_name(struct ast_channel *channel, char *name, size_t n)
@@ -21,6 +21,8 @@ struct sccp_device_info {
 };
 
 struct sccp_device_snapshot {
+	/* incremented every time the device summary changes */
+	unsigned int version;
 	enum sccp_device_type type;
 	int guest;
 	uint8_t proto_version;
@@ -67,12 +69,21 @@ int sccp_device_reload_config(struct sccp_device *device, struct sccp_device_cfg
 void sccp_device_on_connection_lost(struct sccp_device *device);
 
 /*!
- * \brief Signal that some data has been read from the session socket.
+ * \brief Signal that the extension state of some speeddials has changed.
+ *
+ * The new states are transmitted once the device BLF window has elapsed, so that
+ * the changes received in the meantime are coalesced.
  *
  * \note Must be called only from the session thread.
- * \note It is an undefined behaviour to call this function on a destroyed device.
  */
-void sccp_device_on_data_read(struct sccp_device *device);
+void sccp_device_on_blf_update(struct sccp_device *device);
+
+/*!
+ * \brief Signal that the MWI state of the device mailbox has changed.
+ *
+ * \note Must be called only from the session thread.
+ */
+void sccp_device_on_mwi_update(struct sccp_device *device);
 
 /*!
  * \brief Signal that the registration was successful.
@@ -93,6 +104,9 @@ int sccp_device_reset(struct sccp_device *device, enum sccp_reset_type type);
 /*!
  * \brief Take a snapshot of information from the device.
  *
+ * The snapshot is copied from a summary cached in the device, which is updated when
+ * the device information changes, so the device lock is not taken.
+ *
  * \param snapshot memory where the snapshot will be saved
  */
 void sccp_device_take_snapshot(struct sccp_device *device, struct sccp_device_snapshot *snapshot);
@@ -120,6 +134,18 @@ struct sccp_line* sccp_device_line(struct sccp_device *device, unsigned int i);
  */
 const char *sccp_device_name(const struct sccp_device *device);
 
+/*!
+ * \brief Return the hash of the name of the device, as computed by ast_str_hash.
+ */
+int sccp_device_name_hash(const struct sccp_device *device);
+
+/*!
+ * \brief Return the session of the device.
+ *
+ * \note The session of a device is a constant attribute.
+ */
+struct sccp_session *sccp_device_session(struct sccp_device *device);
+
 /*!
  * \brief Return non-zero if the device is a guest device.
  *
@@ -134,4 +160,9 @@ int sccp_device_is_guest(struct sccp_device *device);
  */
 const char *sccp_line_name(const struct sccp_line *line);
 
+/*!
+ * \brief Return the hash of the name of the line, as computed by ast_str_hash.
+ */
+int sccp_line_name_hash(const struct sccp_line *line);
+
 #endif /* SCCP_DEVICE_H_ */
@@ -7,26 +7,52 @@
 #include "sccp_config.h"
 #include "sccp_device.h"
 #include "sccp_device_registry.h"
+#include "sccp_utils.h"
+
+#define NAME_INDEX_MIN_SIZE 16
+
+/*
+ * A sorted array of ao2 objects, each one holding a reference.
+ */
+struct name_index {
+	void **objs;
+	size_t count;
+	size_t capacity;
+	const char *(*name)(const void *obj);
+};
 
+/*
+ * The containers are read-write locked, and the lookups only take their read lock,
+ * so they run concurrently and never wait on the registry lock. The registry lock
+ * only serializes the writers, so that adding a device (i.e. checking for a
+ * duplicate, the guest limit and linking the device and its lines) is atomic.
+ *
+ * The iterations lock the containers one step at a time, so that a long iteration
+ * doesn't block the lookups.
+ *
+ * The devices are also kept in a name index, i.e. an array sorted by name (case
+ * insensitively), which is used for the prefix queries. The index is protected by
+ * index_lock, which is never held while locking a container or a device.
+ */
 struct sccp_device_registry {
 	ast_mutex_t lock;
+	ast_rwlock_t index_lock;
 	unsigned int max_guests;
 	unsigned int cur_guests;
+	unsigned int device_buckets;
+	unsigned int line_buckets;
 	struct ao2_container *devices;
 	struct ao2_container *lines;
+	struct name_index device_index;
 };
 
 static int sccp_device_hash(const void *obj, int flags)
 {
-	const char *name;
-
 	if (flags & OBJ_SEARCH_KEY) {
-		name = (const char *) obj;
-	} else {
-		name = sccp_device_name((const struct sccp_device *) obj);
+		return ast_str_hash((const char *) obj);
 	}
 
-	return ast_str_hash(name);
+	return sccp_device_name_hash((const struct sccp_device *) obj);
 }
 
 static int sccp_device_cmp(void *obj, void *arg, int flags)
@@ -37,6 +63,10 @@ static int sccp_device_cmp(void *obj, void *arg, int flags)
 	if (flags & OBJ_SEARCH_KEY) {
 		name = (const char *) arg;
 	} else {
+		if (sccp_device_name_hash(device) != sccp_device_name_hash((const struct sccp_device *) arg)) {
+			return 0;
+		}
+
 		name = sccp_device_name((const struct sccp_device *) arg);
 	}
 
@@ -45,15 +75,11 @@ static int sccp_device_cmp(void *obj, void *arg, int flags)
 
 static int sccp_line_hash(const void *obj, int flags)
 {
-	const char *name;
-
 	if (flags & OBJ_SEARCH_KEY) {
-		name = (const char *) obj;
-	} else {
-		name = sccp_line_name((const struct sccp_line *) obj);
+		return ast_str_hash((const char *) obj);
 	}
 
-	return ast_str_hash(name);
+	return sccp_line_name_hash((const struct sccp_line *) obj);
 }
 
 static int sccp_line_cmp(void *obj, void *arg, int flags)
@@ -64,12 +90,169 @@ static int sccp_line_cmp(void *obj, void *arg, int flags)
 	if (flags & OBJ_SEARCH_KEY) {
 		name = (const char *) arg;
 	} else {
+		if (sccp_line_name_hash(line) != sccp_line_name_hash((const struct sccp_line *) arg)) {
+			return 0;
+		}
+
 		name = sccp_line_name((const struct sccp_line *) arg);
 	}
 
 	return strcmp(sccp_line_name(line), name) ? 0 : (CMP_MATCH | CMP_STOP);
 }
 
+static const char *device_index_name(const void *obj)
+{
+	return sccp_device_name(obj);
+}
+
+static int name_cmp(const char *a, const char *b)
+{
+	int ret;
+
+	ret = strcasecmp(a, b);
+	if (!ret) {
+		ret = strcmp(a, b);
+	}
+
+	return ret;
+}
+
+static void name_index_init(struct name_index *index, const char *(*name)(const void *obj))
+{
+	index->objs = NULL;
+	index->count = 0;
+	index->capacity = 0;
+	index->name = name;
+}
+
+static void name_index_destroy(struct name_index *index)
+{
+	size_t i;
+
+	for (i = 0; i < index->count; i++) {
+		ao2_ref(index->objs[i], -1);
+	}
+
+	ast_free(index->objs);
+}
+
+/*
+ * Return the position of the first object whose name is not less than name.
+ */
+static size_t name_index_lower_bound(struct name_index *index, const char *name)
+{
+	size_t lo = 0;
+	size_t hi = index->count;
+	size_t mid;
+
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (name_cmp(index->name(index->objs[mid]), name) < 0) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+
+	return lo;
+}
+
+/*
+ * Find the range [*first, *last) of objects whose name starts with prefix (case insensitive).
+ */
+static void name_index_prefix_range(struct name_index *index, const char *prefix, size_t *first, size_t *last)
+{
+	size_t len = strlen(prefix);
+	size_t lo = 0;
+	size_t hi = index->count;
+	size_t mid;
+
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (strncasecmp(index->name(index->objs[mid]), prefix, len) < 0) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+
+	*first = lo;
+
+	hi = index->count;
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (strncasecmp(index->name(index->objs[mid]), prefix, len) <= 0) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+
+	*last = lo;
+}
+
+static int name_index_insert(struct name_index *index, void *obj)
+{
+	void **objs;
+	size_t capacity;
+	size_t pos;
+
+	if (index->count == index->capacity) {
+		capacity = index->capacity ? index->capacity * 2 : NAME_INDEX_MIN_SIZE;
+		objs = ast_realloc(index->objs, capacity * sizeof(*objs));
+		if (!objs) {
+			return -1;
+		}
+
+		index->objs = objs;
+		index->capacity = capacity;
+	}
+
+	pos = name_index_lower_bound(index, index->name(obj));
+	memmove(&index->objs[pos + 1], &index->objs[pos], (index->count - pos) * sizeof(*index->objs));
+	index->objs[pos] = obj;
+	index->count++;
+	ao2_ref(obj, +1);
+
+	return 0;
+}
+
+static void name_index_remove(struct name_index *index, void *obj)
+{
+	const char *name = index->name(obj);
+	size_t pos;
+
+	/* many objects can have the same name, e.g. the lines of the guest devices */
+	pos = name_index_lower_bound(index, name);
+	while (pos < index->count && index->objs[pos] != obj && !strcmp(index->name(index->objs[pos]), name)) {
+		pos++;
+	}
+
+	if (pos == index->count || index->objs[pos] != obj) {
+		return;
+	}
+
+	index->count--;
+	memmove(&index->objs[pos], &index->objs[pos + 1], (index->count - pos) * sizeof(*index->objs));
+	ao2_ref(obj, -1);
+}
+
+static char *name_index_complete(struct name_index *index, ast_rwlock_t *lock, const char *word, int state)
+{
+	char *result = NULL;
+	size_t first;
+	size_t last;
+
+	ast_rwlock_rdlock(lock);
+	name_index_prefix_range(index, word, &first, &last);
+	if (state >= 0 && (size_t) state < last - first) {
+		result = ast_strdup(index->name(index->objs[first + state]));
+	}
+	ast_rwlock_unlock(lock);
+
+	return result;
+}
+
 struct sccp_device_registry *sccp_device_registry_create(struct sccp_cfg *cfg)
 {
 	struct sccp_device_registry *registry;
@@ -84,13 +267,17 @@ struct sccp_device_registry *sccp_device_registry_create(struct sccp_cfg *cfg)
 		return NULL;
 	}
 
-	registry->devices = ao2_container_alloc_hash(AO2_ALLOC_OPT_LOCK_NOLOCK, 0, SCCP_BUCKETS, sccp_device_hash, NULL, sccp_device_cmp);
+	/* the containers can't be resized while in use, so size them for the loaded config */
+	registry->device_buckets = sccp_buckets(ao2_container_count(cfg->devices_cfg) + cfg->general_cfg->max_guests);
+	registry->line_buckets = sccp_buckets(ao2_container_count(cfg->lines_cfg) + cfg->general_cfg->max_guests);
+
+	registry->devices = ao2_container_alloc_hash(AO2_ALLOC_OPT_LOCK_RWLOCK, 0, registry->device_buckets, sccp_device_hash, NULL, sccp_device_cmp);
 	if (!registry->devices) {
 		ast_free(registry);
 		return NULL;
 	}
 
-	registry->lines = ao2_container_alloc_hash(AO2_ALLOC_OPT_LOCK_NOLOCK, 0, SCCP_BUCKETS, sccp_line_hash, NULL, sccp_line_cmp);
+	registry->lines = ao2_container_alloc_hash(AO2_ALLOC_OPT_LOCK_RWLOCK, 0, registry->line_buckets, sccp_line_hash, NULL, sccp_line_cmp);
 	if (!registry->lines) {
 		ao2_ref(registry->devices, -1);
 		ast_free(registry);
@@ -98,6 +285,8 @@ struct sccp_device_registry *sccp_device_registry_create(struct sccp_cfg *cfg)
 	}
 
 	ast_mutex_init(&registry->lock);
+	ast_rwlock_init(&registry->index_lock);
+	name_index_init(&registry->device_index, device_index_name);
 	registry->max_guests = cfg->general_cfg->max_guests;
 	registry->cur_guests = 0;
 
@@ -108,17 +297,38 @@ void sccp_device_registry_destroy(struct sccp_device_registry *registry)
 {
 	ao2_ref(registry->devices, -1);
 	ao2_ref(registry->lines, -1);
+	name_index_destroy(&registry->device_index);
+	ast_rwlock_destroy(&registry->index_lock);
 	ast_mutex_destroy(&registry->lock);
 	ast_free(registry);
 }
 
 static int add_device(struct sccp_device_registry *registry, struct sccp_device *device)
 {
-	return !ao2_link(registry->devices, device);
+	int ret;
+
+	if (!ao2_link(registry->devices, device)) {
+		return -1;
+	}
+
+	ast_rwlock_wrlock(&registry->index_lock);
+	ret = name_index_insert(&registry->device_index, device);
+	ast_rwlock_unlock(&registry->index_lock);
+
+	if (ret) {
+		ao2_unlink(registry->devices, device);
+		return -1;
+	}
+
+	return 0;
 }
 
 static void remove_device(struct sccp_device_registry *registry, struct sccp_device *device)
 {
+	ast_rwlock_wrlock(&registry->index_lock);
+	name_index_remove(&registry->device_index, device);
+	ast_rwlock_unlock(&registry->index_lock);
+
 	ao2_unlink(registry->devices, device);
 }
 
@@ -232,9 +442,7 @@ struct sccp_device *sccp_device_registry_find(struct sccp_device_registry *regis
 		return NULL;
 	}
 
-	ast_mutex_lock(&registry->lock);
 	device = ao2_find(registry->devices, name, OBJ_SEARCH_KEY);
-	ast_mutex_unlock(&registry->lock);
 
 	return device;
 }
@@ -248,9 +456,7 @@ struct sccp_line *sccp_device_registry_find_line(struct sccp_device_registry *re
 		return NULL;
 	}
 
-	ast_mutex_lock(&registry->lock);
 	line = ao2_find(registry->lines, name, OBJ_SEARCH_KEY);
-	ast_mutex_unlock(&registry->lock);
 
 	return line;
 }
@@ -260,58 +466,114 @@ void sccp_device_registry_do(struct sccp_device_registry *registry, sccp_device_
 	struct ao2_iterator iter;
 	struct sccp_device *device;
 
-	ast_mutex_lock(&registry->lock);
-
 	iter = ao2_iterator_init(registry->devices, 0);
 	while ((device = ao2_iterator_next(&iter))) {
 		callback(device, data);
 		ao2_ref(device, -1);
 	}
 	ao2_iterator_destroy(&iter);
+}
 
-	ast_mutex_unlock(&registry->lock);
+/*
+ * Return the devices whose name starts with prefix, sorted by name, each one with its
+ * reference count incremented by one.
+ */
+static int collect_devices(struct sccp_device_registry *registry, const char *prefix, struct sccp_device ***devices, size_t *n)
+{
+	size_t first;
+	size_t last;
+	size_t i;
+
+	ast_rwlock_rdlock(&registry->index_lock);
+	name_index_prefix_range(&registry->device_index, prefix, &first, &last);
+	*n = last - first;
+	if (!*n) {
+		ast_rwlock_unlock(&registry->index_lock);
+		*devices = NULL;
+		return 0;
+	}
+
+	*devices = ast_malloc(*n * sizeof(**devices));
+	if (!*devices) {
+		ast_rwlock_unlock(&registry->index_lock);
+		return -1;
+	}
+
+	for (i = 0; i < *n; i++) {
+		(*devices)[i] = registry->device_index.objs[first + i];
+		ao2_ref((*devices)[i], +1);
+	}
+	ast_rwlock_unlock(&registry->index_lock);
+
+	return 0;
 }
 
-char *sccp_device_registry_complete(struct sccp_device_registry *registry, const char *word, int state)
+static void release_devices(struct sccp_device **devices, size_t n)
 {
-	struct ao2_iterator iter;
-	struct sccp_device *device;
-	char *result = NULL;
-	int which = 0;
-	int len;
+	size_t i;
 
-	if (!word) {
-		ast_log(LOG_ERROR, "registry complete failed: word is null\n");
-		return NULL;
+	for (i = 0; i < n; i++) {
+		ao2_ref(devices[i], -1);
 	}
 
-	len = strlen(word);
+	ast_free(devices);
+}
 
-	ast_mutex_lock(&registry->lock);
+int sccp_device_registry_do_prefix(struct sccp_device_registry *registry, const char *prefix, sccp_device_registry_cb callback, void *data)
+{
+	struct sccp_device **devices;
+	size_t n;
+	size_t i;
 
-	iter = ao2_iterator_init(registry->devices, 0);
-	while ((device = ao2_iterator_next(&iter))) {
-		if (!strncasecmp(word, sccp_device_name(device), len) && ++which > state) {
-			result = ast_strdup(sccp_device_name(device));
-			ao2_ref(device, -1);
-			break;
-		}
+	if (!prefix) {
+		ast_log(LOG_ERROR, "registry do prefix failed: prefix is null\n");
+		return -1;
+	}
 
-		ao2_ref(device, -1);
+	if (collect_devices(registry, prefix, &devices, &n)) {
+		return -1;
 	}
-	ao2_iterator_destroy(&iter);
 
-	ast_mutex_unlock(&registry->lock);
+	for (i = 0; i < n; i++) {
+		callback(devices[i], data);
+	}
 
-	return result;
+	release_devices(devices, n);
+
+	return n;
 }
 
-int sccp_device_registry_take_snapshots(struct sccp_device_registry *registry, struct sccp_device_snapshot **snapshots, size_t *n)
+char *sccp_device_registry_complete(struct sccp_device_registry *registry, const char *word, int state)
 {
-	struct ao2_iterator iter;
-	struct sccp_device *device;
+	if (!word) {
+		ast_log(LOG_ERROR, "registry complete failed: word is null\n");
+		return NULL;
+	}
+
+	return name_index_complete(&registry->device_index, &registry->index_lock, word, state);
+}
+
+static int snapshot_match(const struct sccp_device_snapshot *snapshot, const struct sccp_device_registry_filter *filter)
+{
+	if (filter->guest != SCCP_DEVICE_REGISTRY_FILTER_ANY && filter->guest != snapshot->guest) {
+		return 0;
+	}
+
+	return 1;
+}
+
+int sccp_device_registry_take_snapshots(struct sccp_device_registry *registry, const struct sccp_device_registry_filter *filter, struct sccp_device_snapshot **snapshots, size_t *n)
+{
+	static const struct sccp_device_registry_filter no_filter = {
+		.prefix = NULL,
+		.guest = SCCP_DEVICE_REGISTRY_FILTER_ANY,
+		.offset = 0,
+		.limit = 0,
+	};
+	struct sccp_device **devices;
+	size_t n_devices;
+	size_t skipped = 0;
 	size_t i;
-	int ret = 0;
 
 	if (!snapshots) {
 		ast_log(LOG_ERROR, "registry take snapshots failed: snapshots is null\n");
@@ -323,32 +585,48 @@ int sccp_device_registry_take_snapshots(struct sccp_device_registry *registry, s
 		return -1;
 	}
 
-	ast_mutex_lock(&registry->lock);
+	if (!filter) {
+		filter = &no_filter;
+	}
 
-	*n = ao2_container_count(registry->devices);
-	if (!*n) {
+	/* devices added while collecting are not part of the snapshot */
+	if (collect_devices(registry, S_OR(filter->prefix, ""), &devices, &n_devices)) {
+		return -1;
+	}
+
+	*n = 0;
+	if (!n_devices) {
 		*snapshots = NULL;
-		goto unlock;
+		return 0;
 	}
 
-	*snapshots = ast_calloc(*n, sizeof(**snapshots));
+	*snapshots = ast_calloc(n_devices, sizeof(**snapshots));
 	if (!*snapshots) {
-		ret = -1;
-		goto unlock;
+		release_devices(devices, n_devices);
+		return -1;
 	}
 
-	i = 0;
-	iter = ao2_iterator_init(registry->devices, 0);
-	while ((device = ao2_iterator_next(&iter))) {
-		sccp_device_take_snapshot(device, &(*snapshots)[i++]);
-		ao2_ref(device, -1);
+	for (i = 0; i < n_devices; i++) {
+		if (filter->limit && *n == filter->limit) {
+			break;
+		}
+
+		sccp_device_take_snapshot(devices[i], &(*snapshots)[*n]);
+		if (!snapshot_match(&(*snapshots)[*n], filter)) {
+			continue;
+		}
+
+		if (skipped < filter->offset) {
+			skipped++;
+			continue;
+		}
+
+		(*n)++;
 	}
-	ao2_iterator_destroy(&iter);
 
-unlock:
-	ast_mutex_unlock(&registry->lock);
+	release_devices(devices, n_devices);
 
-	return ret;
+	return 0;
 }
 
 int sccp_device_registry_reload_config(struct sccp_device_registry *registry, struct sccp_cfg *cfg)
@@ -362,5 +640,9 @@ int sccp_device_registry_reload_config(struct sccp_device_registry *registry, st
 	registry->max_guests = cfg->general_cfg->max_guests;
 	ast_mutex_unlock(&registry->lock);
 
+	if (sccp_buckets(ao2_container_count(cfg->lines_cfg) + cfg->general_cfg->max_guests) > registry->line_buckets) {
+		ast_log(LOG_NOTICE, "sccp device registry is sized for a smaller config; it will be resized on next module load\n");
+	}
+
 	return 0;
 }
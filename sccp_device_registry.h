@@ -9,10 +9,30 @@ struct sccp_device_snapshot;
 #define SCCP_DEVICE_REGISTRY_ALREADY 1
 #define SCCP_DEVICE_REGISTRY_MAXGUESTS 2
 
+#define SCCP_DEVICE_REGISTRY_FILTER_ANY -1
+
+/*!
+ * \brief Selection of the devices returned by sccp_device_registry_take_snapshots.
+ */
+struct sccp_device_registry_filter {
+	/* only the devices whose name starts with prefix (case insensitive), or NULL for any */
+	const char *prefix;
+	/* SCCP_DEVICE_REGISTRY_FILTER_ANY, 0 for non-guest devices only, 1 for guest devices only */
+	int guest;
+	/* number of matching devices to skip */
+	size_t offset;
+	/* maximum number of snapshots to return, or 0 for no limit */
+	size_t limit;
+};
+
 /*!
  * \brief Create a new device registry.
  *
- * The device registry is a thread safe container for devices.
+ * The device registry is a thread safe container for devices. Lookups don't block
+ * on each other, nor on the iterations.
+ *
+ * The devices are also indexed by name, for the prefix queries and the completion. The
+ * lines are only looked up by exact name.
  *
  * \retval non-NULL on success
  * \retval NULL on failure
@@ -72,20 +92,36 @@ typedef void (sccp_device_registry_cb)(struct sccp_device *device, void *data);
  * The reference count on the device is automatically handled, i.e. you must not decrease
  * it inside the callback function.
  *
- * The callback is called with the registry lock held. Be careful with what you do inside the
- * callback function, or a deadlock could arise. That said, inside the callback, it is safe to
- * call a function that acquire the device lock.
+ * The callback is called without any registry lock held, so it is safe to call any function
+ * inside the callback, including the ones that acquire the device lock. Devices added or
+ * removed during the iteration might or might not be visited.
  */
 void sccp_device_registry_do(struct sccp_device_registry *registry, sccp_device_registry_cb callback, void *data);
 
 /*!
- * \brief Completion function for CLI.
+ * \brief Call a function for all devices whose name starts with a prefix.
+ *
+ * The prefix is matched case insensitively, and the devices are visited in name order.
+ * The callback is called under the same conditions than in sccp_device_registry_do.
+ *
+ * \retval the number of devices visited
+ * \retval -1 on failure
+ */
+int sccp_device_registry_do_prefix(struct sccp_device_registry *registry, const char *prefix, sccp_device_registry_cb callback, void *data);
+
+/*!
+ * \brief Completion function for CLI, on device names.
  */
 char *sccp_device_registry_complete(struct sccp_device_registry *registry, const char *word, int state);
 
 /*!
- * \brief Take a snapshot of all the devices in the registry.
+ * \brief Take a snapshot of the devices in the registry.
+ *
+ * The snapshots are copied from the summary cached in each device, without taking the
+ * registry lock nor the device locks. They are sorted by device name (case insensitive),
+ * so that paging with the offset and limit of the filter is stable.
  *
+ * \param filter the devices to select, or NULL for all the devices
  * \param[out] snapshots address where to store the dynamically allocated snapshots array
  * \param[out] n length of the snapshots array
  *
@@ -96,7 +132,7 @@ char *sccp_device_registry_complete(struct sccp_device_registry *registry, const
  * \retval 0 on success
  * \retval non-zero on failure
  */
-int sccp_device_registry_take_snapshots(struct sccp_device_registry *registry, struct sccp_device_snapshot **snapshots, size_t *n);
+int sccp_device_registry_take_snapshots(struct sccp_device_registry *registry, const struct sccp_device_registry_filter *filter, struct sccp_device_snapshot **snapshots, size_t *n);
 
 /*!
  * \brief Reload the device registry configuration.
@@ -1,6 +1,10 @@
 #include <errno.h>
 #include <iconv.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <strings.h>
+#include <sys/param.h>
+#include <sys/uio.h>
 
 #include <asterisk.h>
 #include <asterisk/logger.h>
@@ -616,33 +620,191 @@ void sccp_msg_builder_register_ack(struct sccp_msg_builder *builder, struct sccp
 	sccp_msg_register_ack(msg, datefmt, keepalive, proto_version, unknown1, unknown2, unknown3);
 }
 
+/*
+ * Return the minimum data length of a message received from a device, i.e. the
+ * number of data bytes the message handlers might read.
+ */
+static size_t sccp_msg_min_data_len(uint32_t id)
+{
+	switch (id) {
+	case REGISTER_MESSAGE:
+		return sizeof(struct register_message);
+	case IP_PORT_MESSAGE:
+		return sizeof(struct ip_port_message);
+	case KEYPAD_BUTTON_MESSAGE:
+		return sizeof(struct keypad_button_message);
+	case ENBLOC_CALL_MESSAGE:
+		return sizeof(struct enbloc_call_message);
+	case STIMULUS_MESSAGE:
+		return sizeof(struct stimulus_message);
+	case OFFHOOK_MESSAGE:
+		return sizeof(struct offhook_message);
+	case ONHOOK_MESSAGE:
+		return sizeof(struct onhook_message);
+	case FORWARD_STATUS_REQ_MESSAGE:
+		return sizeof(struct forward_status_req_message);
+	case SPEEDDIAL_STAT_REQ_MESSAGE:
+		return sizeof(struct speeddial_stat_req_message);
+	case LINE_STATUS_REQ_MESSAGE:
+		return sizeof(struct line_status_req_message);
+	case CAPABILITIES_RES_MESSAGE:
+		return sizeof(struct capabilities_res_message);
+	case ALARM_MESSAGE:
+		return sizeof(struct alarm_message);
+	case OPEN_RECEIVE_CHANNEL_ACK_MESSAGE:
+		return sizeof(struct open_receive_channel_ack_message);
+	case SOFTKEY_EVENT_MESSAGE:
+		return sizeof(struct softkey_event_message);
+	case FEATURE_STATUS_REQ_MESSAGE:
+		return sizeof(struct feature_status_req_message);
+	case SUBSCRIPTION_STATUS_REQ_MESSAGE:
+		return sizeof(struct subscription_status_req_message);
+	}
+
+	return 0;
+}
+
 void sccp_deserializer_init(struct sccp_deserializer *deserializer, int fd)
 {
+	deserializer->buf = NULL;
+	deserializer->size = 0;
 	deserializer->start = 0;
 	deserializer->end = 0;
 	deserializer->fd = fd;
 }
 
+void sccp_deserializer_destroy(struct sccp_deserializer *deserializer)
+{
+	ast_free(deserializer->buf);
+}
+
+static int deserializer_resize(struct sccp_deserializer *deserializer, size_t size)
+{
+	char *buf;
+
+	buf = ast_realloc(deserializer->buf, size);
+	if (!buf) {
+		return -1;
+	}
+
+	deserializer->buf = buf;
+	deserializer->size = size;
+
+	return 0;
+}
+
+/*
+ * Make room at the end of the buffer by moving the unconsumed bytes at its
+ * beginning. Since all the complete messages have been consumed before reading,
+ * this usually moves at most a partial message.
+ */
+static int deserializer_compact(struct sccp_deserializer *deserializer)
+{
+	size_t pending = deserializer->end - deserializer->start;
+
+	if (!pending) {
+		deserializer->start = 0;
+		deserializer->end = 0;
+		if (deserializer->size != SCCP_DESERIALIZER_MIN_SIZE) {
+			ast_free(deserializer->buf);
+			deserializer->buf = NULL;
+			deserializer->size = 0;
+			return deserializer_resize(deserializer, SCCP_DESERIALIZER_MIN_SIZE);
+		}
+
+		return 0;
+	}
+
+	if (deserializer->start) {
+		memmove(deserializer->buf, &deserializer->buf[deserializer->start], pending);
+		deserializer->start = 0;
+		deserializer->end = pending;
+	}
+
+	return 0;
+}
+
+/*
+ * Append the bytes that did not fit in the buffer, growing it as needed.
+ */
+static int deserializer_append(struct sccp_deserializer *deserializer, const char *data, size_t len)
+{
+	size_t needed = deserializer->end + len;
+	size_t size = deserializer->size;
+
+	if (needed > size) {
+		while (size < needed) {
+			size *= 2;
+		}
+
+		if (deserializer_resize(deserializer, MIN(size, SCCP_DESERIALIZER_MAX_SIZE))) {
+			return -1;
+		}
+	}
+
+	memcpy(&deserializer->buf[deserializer->end], data, len);
+	deserializer->end += len;
+
+	return 0;
+}
+
 int sccp_deserializer_read(struct sccp_deserializer *deserializer)
 {
-	ssize_t n;
+	char spill[SCCP_DESERIALIZER_MIN_SIZE];
+	struct iovec iov[2];
+	int iovcnt = 1;
 	size_t bytes_left;
+	ssize_t n;
 
-	bytes_left = sizeof(deserializer->buf) - deserializer->end;
-	if (!bytes_left) {
-		ast_log(LOG_WARNING, "sccp deserializer read failed: buffer is full\n");
-		return SCCP_DESERIALIZER_FULL;
+	if (deserializer_compact(deserializer)) {
+		ast_log(LOG_ERROR, "sccp deserializer read failed: could not allocate buffer\n");
+		return -1;
 	}
 
-	n = read(deserializer->fd, &deserializer->buf[deserializer->end], bytes_left);
+	if (deserializer->end == deserializer->size) {
+		if (deserializer->size == SCCP_DESERIALIZER_MAX_SIZE) {
+			ast_log(LOG_WARNING, "sccp deserializer read failed: buffer is full\n");
+			return SCCP_DESERIALIZER_FULL;
+		}
+
+		if (deserializer_resize(deserializer, MIN(deserializer->size * 2, SCCP_DESERIALIZER_MAX_SIZE))) {
+			ast_log(LOG_ERROR, "sccp deserializer read failed: could not grow buffer\n");
+			return -1;
+		}
+	}
+
+	bytes_left = deserializer->size - deserializer->end;
+
+	/* read what's left in the buffer, plus a bit more, so that bursts are drained at once */
+	iov[0].iov_base = &deserializer->buf[deserializer->end];
+	iov[0].iov_len = bytes_left;
+	if (deserializer->size < SCCP_DESERIALIZER_MAX_SIZE) {
+		iov[1].iov_base = spill;
+		iov[1].iov_len = MIN(sizeof(spill), SCCP_DESERIALIZER_MAX_SIZE - deserializer->size);
+		iovcnt = 2;
+	}
+
+	n = readv(deserializer->fd, iov, iovcnt);
 	if (n == -1) {
-		ast_log(LOG_ERROR, "sccp deserializer read failed: read: %s\n", strerror(errno));
+		if (errno == EAGAIN || errno == EINTR) {
+			return SCCP_DESERIALIZER_NOMSG;
+		}
+
+		ast_log(LOG_ERROR, "sccp deserializer read failed: readv: %s\n", strerror(errno));
 		return -1;
 	} else if (n == 0) {
 		return SCCP_DESERIALIZER_EOF;
 	}
 
-	deserializer->end += (size_t) n;
+	if ((size_t) n <= bytes_left) {
+		deserializer->end += (size_t) n;
+	} else {
+		deserializer->end = deserializer->size;
+		if (deserializer_append(deserializer, spill, (size_t) n - bytes_left)) {
+			ast_log(LOG_ERROR, "sccp deserializer read failed: could not grow buffer\n");
+			return -1;
+		}
+	}
 
 	return 0;
 }
@@ -650,45 +812,52 @@ int sccp_deserializer_read(struct sccp_deserializer *deserializer)
 int sccp_deserializer_pop(struct sccp_deserializer *deserializer, struct sccp_msg **msg)
 {
 	size_t avail_bytes;
-	size_t new_start;
 	size_t total_length;
+	size_t min_total_length;
 	size_t copy_length;
 	uint32_t msg_length;
+	uint32_t msg_id;
+	char *raw;
 
 	avail_bytes = deserializer->end - deserializer->start;
 	if (avail_bytes < SCCP_MSG_MIN_TOTAL_LEN) {
 		return SCCP_DESERIALIZER_NOMSG;
 	}
 
-	memcpy(&msg_length, &deserializer->buf[deserializer->start], sizeof(msg_length));
+	raw = &deserializer->buf[deserializer->start];
+	memcpy(&msg_length, raw, sizeof(msg_length));
 	total_length = SCCP_MSG_TOTAL_LEN_FROM_LEN(letohl(msg_length));
-	if (avail_bytes < total_length) {
-		return SCCP_DESERIALIZER_NOMSG;
-	}  else if (total_length < SCCP_MSG_MIN_TOTAL_LEN) {
+	if (total_length < SCCP_MSG_MIN_TOTAL_LEN) {
 		ast_log(LOG_WARNING, "invalid message: total length (%zu) is too small\n", total_length);
 		return SCCP_DESERIALIZER_MALFORMED;
-	} else if (total_length > SCCP_MSG_MAX_TOTAL_LEN) {
-		 if (total_length <= sizeof(deserializer->buf)) {
-			 copy_length = SCCP_MSG_MAX_TOTAL_LEN;
-		 } else {
-			 ast_log(LOG_WARNING, "invalid message: total length (%zu) is too large\n", total_length);
-			 return SCCP_DESERIALIZER_MALFORMED;
-		 }
-	} else {
-		copy_length = total_length;
+	} else if (total_length > SCCP_DESERIALIZER_MAX_SIZE) {
+		ast_log(LOG_WARNING, "invalid message: total length (%zu) is too large\n", total_length);
+		return SCCP_DESERIALIZER_MALFORMED;
+	} else if (avail_bytes < total_length) {
+		return SCCP_DESERIALIZER_NOMSG;
 	}
 
-	memcpy(&deserializer->msg, &deserializer->buf[deserializer->start], copy_length);
-	*msg = &deserializer->msg;
+	memcpy(&msg_id, raw + offsetof(struct sccp_msg, id), sizeof(msg_id));
+	min_total_length = SCCP_MSG_MIN_TOTAL_LEN + sccp_msg_min_data_len(letohl(msg_id));
 
-	new_start = deserializer->start + total_length;
-	if (new_start == deserializer->end) {
-		deserializer->start = 0;
-		deserializer->end = 0;
+	/*
+	 * Messages that are correctly aligned and long enough for their handler are
+	 * returned in place. The other ones are copied and padded with zeros.
+	 */
+	if (total_length >= min_total_length && !((uintptr_t) raw % __alignof__(struct sccp_msg))) {
+		*msg = (struct sccp_msg *) raw;
 	} else {
-		deserializer->start = new_start;
+		copy_length = MIN(total_length, SCCP_MSG_MAX_TOTAL_LEN);
+		memcpy(&deserializer->msg, raw, copy_length);
+		if (copy_length < min_total_length) {
+			memset((char *) &deserializer->msg + copy_length, 0, min_total_length - copy_length);
+		}
+
+		*msg = &deserializer->msg;
 	}
 
+	deserializer->start += total_length;
+
 	return 0;
 }
 
@@ -745,12 +745,20 @@ void sccp_msg_builder_register_ack(struct sccp_msg_builder *builder, struct sccp
 #define SCCP_DESERIALIZER_EOF 3
 #define SCCP_DESERIALIZER_MALFORMED 4
 
+#define SCCP_DESERIALIZER_MIN_SIZE 2048
+#define SCCP_DESERIALIZER_MAX_SIZE 65536
+
+/*
+ * The buffer is allocated on the first read, grows when a read fills it
+ * completely, and shrinks back to its minimum size once it has been drained.
+ */
 struct sccp_deserializer {
 	struct sccp_msg msg;
+	char *buf;
+	size_t size;
 	size_t start;
 	size_t end;
 	int fd;
-	char buf[3072];
 };
 
 /*!
@@ -760,10 +768,20 @@ struct sccp_deserializer {
  */
 void sccp_deserializer_init(struct sccp_deserializer *dzer, int fd);
 
+/*!
+ * \brief Free the resources used by the deserializer.
+ */
+void sccp_deserializer_destroy(struct sccp_deserializer *dzer);
+
 /*!
  * \brief Read data into the deserializer buffer.
  *
+ * The unconsumed bytes are first moved to the beginning of the buffer, so the
+ * buffer is never full unless a single message is larger than
+ * SCCP_DESERIALIZER_MAX_SIZE.
+ *
  * \retval 0 on success
+ * \retval SCCP_DESERIALIZER_NOMSG if no data is available (i.e. the read would block)
  * \retval SCCP_DESERIALIZER_FULL if the buffer is full
  * \retval SCCP_DESERIALIZER_EOF if the end of file is reached
  * \retval -1 on other failure
@@ -775,7 +793,12 @@ int sccp_deserializer_read(struct sccp_deserializer *dzer);
  *
  * \param msg output parameter used to store the address of the parsed message
  *
- * \note The message stored in *msg is only valid between calls to this function.
+ * The message is parsed in place when possible. It is guaranteed to be at least
+ * as long as the structure associated with its ID, short messages being padded
+ * with zeros.
+ *
+ * \note The message stored in *msg is only valid until the next call to this
+ *       function or to sccp_deserializer_read.
  *
  * \retval 0 on success
  * \retval SCCP_DESERIALIZER_NOMSG if no message are available
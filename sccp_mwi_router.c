@@ -0,0 +1,391 @@
+#include <asterisk.h>
+#include <asterisk/app.h>
+#include <asterisk/astobj2.h>
+#include <asterisk/dlinkedlists.h>
+#include <asterisk/linkedlists.h>
+#include <asterisk/lock.h>
+#include <asterisk/stasis.h>
+#include <asterisk/strings.h>
+#include <asterisk/utils.h>
+
+#include "sccp.h"
+#include "sccp_mwi_router.h"
+
+/*
+ * Lock order: mailboxes container, then mailbox, then whatever the subscription callbacks
+ * lock.
+ *
+ * The subscription callbacks are called with the mailbox locked, which is what guarantees
+ * that a callback is not running anymore once sccp_mwi_router_unsubscribe has returned.
+ *
+ * When its last subscription is removed, the mailbox is unlinked and its stasis subscription
+ * is removed without being joined; a message still being delivered finds no subscription.
+ * The mailbox holds a reference on itself for the stasis subscription, which is released
+ * on the final message. The removed stasis subscriptions whose final message has not been
+ * received yet are counted, so that sccp_mwi_router_destroy can wait for them; once it has
+ * returned, on_mwi_event is not called anymore.
+ *
+ * The number of new messages is known once a first MWI event has been received; until then,
+ * the fetcher thread gets it with ast_app_inboxcount, so that the voicemail storage is never
+ * queried from the subscribing thread. An event received while fetching takes precedence
+ * over the fetch result.
+ */
+struct mwi_mailbox {
+	AST_DLLIST_HEAD_NOLOCK(, sccp_mwi_subscription) subs;
+	/* protected by fetch_lock */
+	AST_LIST_ENTRY(mwi_mailbox) fetch_list;
+	/* protected by fetch_lock, non-zero if the mailbox is in the fetch list */
+	int fetch_pending;
+	/* protected by the mailbox lock, -1 if unknown */
+	int new_msgs;
+	/* protected by the mailbox lock, incremented on every MWI event */
+	unsigned int event_count;
+	/* const */
+	struct stasis_subscription *stasis_sub;
+	/* const */
+	char name[AST_MAX_MAILBOX_UNIQUEID];
+};
+
+struct sccp_mwi_subscription {
+	AST_DLLIST_ENTRY(sccp_mwi_subscription) list;
+	struct mwi_mailbox *mailbox;
+	sccp_mwi_cb *callback;
+	void *data;
+};
+
+static struct ao2_container *mailboxes;
+
+static ast_mutex_t fetch_lock;
+static ast_cond_t fetch_cond;
+static AST_LIST_HEAD_NOLOCK(, mwi_mailbox) fetch_queue;
+static pthread_t fetcher_thread;
+static int fetcher_stop;
+
+static ast_mutex_t unsubscribe_lock;
+static ast_cond_t unsubscribe_cond;
+/* protected by unsubscribe_lock */
+static int unsubscribing;
+
+static int mwi_mailbox_hash(const void *obj, int flags)
+{
+	const char *name;
+
+	if (flags & OBJ_SEARCH_KEY) {
+		name = obj;
+	} else {
+		name = ((const struct mwi_mailbox *) obj)->name;
+	}
+
+	return ast_str_hash(name);
+}
+
+static int mwi_mailbox_cmp(void *obj, void *arg, int flags)
+{
+	struct mwi_mailbox *mailbox = obj;
+	const char *name;
+
+	if (flags & OBJ_SEARCH_KEY) {
+		name = arg;
+	} else {
+		name = ((const struct mwi_mailbox *) arg)->name;
+	}
+
+	return strcmp(mailbox->name, name) ? 0 : (CMP_MATCH | CMP_STOP);
+}
+
+static void on_mwi_event(void *data, struct stasis_subscription *stasis_sub, struct stasis_message *msg)
+{
+	struct mwi_mailbox *mailbox = data;
+	struct sccp_mwi_subscription *sub;
+	struct ast_mwi_state *mwi_state;
+
+	if (stasis_subscription_final_message(stasis_sub, msg)) {
+		ao2_ref(mailbox, -1);
+
+		ast_mutex_lock(&unsubscribe_lock);
+		unsubscribing--;
+		ast_cond_signal(&unsubscribe_cond);
+		ast_mutex_unlock(&unsubscribe_lock);
+		return;
+	}
+
+	if (ast_mwi_state_type() != stasis_message_type(msg)) {
+		return;
+	}
+
+	mwi_state = stasis_message_data(msg);
+
+	ao2_lock(mailbox);
+	mailbox->new_msgs = mwi_state->new_msgs;
+	mailbox->event_count++;
+	AST_DLLIST_TRAVERSE(&mailbox->subs, sub, list) {
+		sub->callback(mailbox->new_msgs, sub->data);
+	}
+	ao2_unlock(mailbox);
+}
+
+static void mwi_mailbox_fetch(struct mwi_mailbox *mailbox)
+{
+	struct sccp_mwi_subscription *sub;
+	unsigned int event_count;
+	int new_msgs;
+	int old_msgs;
+	int empty;
+
+	ao2_lock(mailbox);
+	empty = AST_DLLIST_EMPTY(&mailbox->subs);
+	event_count = mailbox->event_count;
+	ao2_unlock(mailbox);
+
+	if (empty) {
+		return;
+	}
+
+	if (ast_app_inboxcount(mailbox->name, &new_msgs, &old_msgs) == -1) {
+		ast_log(LOG_NOTICE, "could not get voicemail count for %s\n", mailbox->name);
+		return;
+	}
+
+	ao2_lock(mailbox);
+	if (mailbox->event_count == event_count) {
+		mailbox->new_msgs = new_msgs;
+		AST_DLLIST_TRAVERSE(&mailbox->subs, sub, list) {
+			sub->callback(mailbox->new_msgs, sub->data);
+		}
+	}
+	ao2_unlock(mailbox);
+}
+
+static void *fetcher_run(void *data)
+{
+	struct mwi_mailbox *mailbox;
+
+	ast_mutex_lock(&fetch_lock);
+	for (;;) {
+		while (AST_LIST_EMPTY(&fetch_queue) && !fetcher_stop) {
+			ast_cond_wait(&fetch_cond, &fetch_lock);
+		}
+
+		if (fetcher_stop) {
+			break;
+		}
+
+		mailbox = AST_LIST_REMOVE_HEAD(&fetch_queue, fetch_list);
+		mailbox->fetch_pending = 0;
+		ast_mutex_unlock(&fetch_lock);
+
+		mwi_mailbox_fetch(mailbox);
+		ao2_ref(mailbox, -1);
+
+		ast_mutex_lock(&fetch_lock);
+	}
+
+	while ((mailbox = AST_LIST_REMOVE_HEAD(&fetch_queue, fetch_list))) {
+		ao2_ref(mailbox, -1);
+	}
+	ast_mutex_unlock(&fetch_lock);
+
+	return NULL;
+}
+
+static void mwi_mailbox_queue_fetch(struct mwi_mailbox *mailbox)
+{
+	ast_mutex_lock(&fetch_lock);
+	if (!mailbox->fetch_pending) {
+		mailbox->fetch_pending = 1;
+		ao2_ref(mailbox, +1);
+		AST_LIST_INSERT_TAIL(&fetch_queue, mailbox, fetch_list);
+		ast_cond_signal(&fetch_cond);
+	}
+	ast_mutex_unlock(&fetch_lock);
+}
+
+static void mwi_mailbox_unsubscribe(struct mwi_mailbox *mailbox)
+{
+	ast_mutex_lock(&unsubscribe_lock);
+	unsubscribing++;
+	ast_mutex_unlock(&unsubscribe_lock);
+
+	stasis_unsubscribe(mailbox->stasis_sub);
+}
+
+/*
+ * Must be called with the mailboxes container locked.
+ */
+static struct mwi_mailbox *mwi_mailbox_create(const char *name)
+{
+	struct mwi_mailbox *mailbox;
+	struct stasis_topic *mwi_topic;
+
+	mwi_topic = ast_mwi_topic(name);
+	if (!mwi_topic) {
+		ast_log(LOG_WARNING, "mwi router subscribe failed: no mwi topic for %s\n", name);
+		return NULL;
+	}
+
+	mailbox = ao2_alloc(sizeof(*mailbox), NULL);
+	if (!mailbox) {
+		return NULL;
+	}
+
+	AST_DLLIST_HEAD_INIT_NOLOCK(&mailbox->subs);
+	mailbox->new_msgs = -1;
+	ast_copy_string(mailbox->name, name, sizeof(mailbox->name));
+
+	/* the reference is released on the final message */
+	ao2_ref(mailbox, +1);
+	mailbox->stasis_sub = stasis_subscribe_pool(mwi_topic, on_mwi_event, mailbox);
+	if (!mailbox->stasis_sub) {
+		ast_log(LOG_WARNING, "mwi router subscribe failed: could not subscribe to %s\n", name);
+		ao2_ref(mailbox, -2);
+		return NULL;
+	}
+
+	if (!ao2_link_flags(mailboxes, mailbox, OBJ_NOLOCK)) {
+		mwi_mailbox_unsubscribe(mailbox);
+		ao2_ref(mailbox, -1);
+		return NULL;
+	}
+
+	return mailbox;
+}
+
+int sccp_mwi_router_init(void)
+{
+	int ret;
+
+	mailboxes = ao2_container_alloc_hash(AO2_ALLOC_OPT_LOCK_MUTEX, 0, SCCP_BUCKETS, mwi_mailbox_hash, NULL, mwi_mailbox_cmp);
+	if (!mailboxes) {
+		return -1;
+	}
+
+	ast_mutex_init(&fetch_lock);
+	ast_cond_init(&fetch_cond, NULL);
+	AST_LIST_HEAD_INIT_NOLOCK(&fetch_queue);
+	fetcher_stop = 0;
+
+	ast_mutex_init(&unsubscribe_lock);
+	ast_cond_init(&unsubscribe_cond, NULL);
+	unsubscribing = 0;
+
+	ret = ast_pthread_create_background(&fetcher_thread, NULL, fetcher_run, NULL);
+	if (ret) {
+		ast_log(LOG_ERROR, "mwi router init failed: pthread create: %s\n", strerror(ret));
+		ast_cond_destroy(&unsubscribe_cond);
+		ast_mutex_destroy(&unsubscribe_lock);
+		ast_cond_destroy(&fetch_cond);
+		ast_mutex_destroy(&fetch_lock);
+		ao2_ref(mailboxes, -1);
+		mailboxes = NULL;
+		return -1;
+	}
+
+	return 0;
+}
+
+void sccp_mwi_router_destroy(void)
+{
+	int ret;
+
+	ast_mutex_lock(&fetch_lock);
+	fetcher_stop = 1;
+	ast_cond_signal(&fetch_cond);
+	ast_mutex_unlock(&fetch_lock);
+
+	ret = pthread_join(fetcher_thread, NULL);
+	if (ret) {
+		ast_log(LOG_ERROR, "mwi router destroy failed: pthread_join: %s\n", strerror(ret));
+	}
+
+	ast_cond_destroy(&fetch_cond);
+	ast_mutex_destroy(&fetch_lock);
+
+	/* wait for the final messages, so that the module can be unloaded */
+	ast_mutex_lock(&unsubscribe_lock);
+	while (unsubscribing) {
+		ast_cond_wait(&unsubscribe_cond, &unsubscribe_lock);
+	}
+	ast_mutex_unlock(&unsubscribe_lock);
+
+	ast_cond_destroy(&unsubscribe_cond);
+	ast_mutex_destroy(&unsubscribe_lock);
+
+	if (ao2_container_count(mailboxes)) {
+		ast_log(LOG_WARNING, "MWI router destroyed with %d mailbox(es) still watched\n", ao2_container_count(mailboxes));
+	}
+
+	ao2_ref(mailboxes, -1);
+	mailboxes = NULL;
+}
+
+struct sccp_mwi_subscription *sccp_mwi_router_subscribe(const char *mailbox_name, sccp_mwi_cb *callback, void *data, int *new_msgs)
+{
+	struct sccp_mwi_subscription *sub;
+	struct mwi_mailbox *mailbox;
+
+	if (ast_strlen_zero(mailbox_name) || !callback || !new_msgs) {
+		ast_log(LOG_ERROR, "mwi router subscribe failed: invalid argument\n");
+		return NULL;
+	}
+
+	sub = ast_calloc(1, sizeof(*sub));
+	if (!sub) {
+		return NULL;
+	}
+
+	ao2_lock(mailboxes);
+
+	mailbox = ao2_find(mailboxes, mailbox_name, OBJ_SEARCH_KEY | OBJ_NOLOCK);
+	if (!mailbox) {
+		mailbox = mwi_mailbox_create(mailbox_name);
+		if (!mailbox) {
+			ao2_unlock(mailboxes);
+			ast_free(sub);
+			return NULL;
+		}
+	}
+
+	/* steal the reference ownership */
+	sub->mailbox = mailbox;
+	sub->callback = callback;
+	sub->data = data;
+
+	ao2_lock(mailbox);
+	AST_DLLIST_INSERT_TAIL(&mailbox->subs, sub, list);
+	*new_msgs = mailbox->new_msgs;
+	ao2_unlock(mailbox);
+
+	ao2_unlock(mailboxes);
+
+	if (*new_msgs == -1) {
+		mwi_mailbox_queue_fetch(mailbox);
+	}
+
+	return sub;
+}
+
+void sccp_mwi_router_unsubscribe(struct sccp_mwi_subscription *sub)
+{
+	struct mwi_mailbox *mailbox = sub->mailbox;
+	int empty;
+
+	ao2_lock(mailboxes);
+
+	ao2_lock(mailbox);
+	AST_DLLIST_REMOVE(&mailbox->subs, sub, list);
+	empty = AST_DLLIST_EMPTY(&mailbox->subs);
+	ao2_unlock(mailbox);
+
+	if (empty) {
+		ao2_unlink_flags(mailboxes, mailbox, OBJ_NOLOCK);
+	}
+
+	ao2_unlock(mailboxes);
+
+	if (empty) {
+		mwi_mailbox_unsubscribe(mailbox);
+	}
+
+	ao2_ref(mailbox, -1);
+	ast_free(sub);
+}
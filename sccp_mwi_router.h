@@ -0,0 +1,63 @@
+#ifndef SCCP_MWI_ROUTER_H_
+#define SCCP_MWI_ROUTER_H_
+
+struct sccp_mwi_subscription;
+
+/*!
+ * \brief Function type for the MWI state change callback.
+ *
+ * \param new_msgs the number of new messages in the mailbox
+ */
+typedef void (sccp_mwi_cb)(int new_msgs, void *data);
+
+/*!
+ * \brief Initialize the MWI router.
+ *
+ * The MWI router holds a single stasis subscription per watched mailbox, and routes
+ * the MWI state changes to its subscribers, so that many devices sharing the same
+ * mailbox don't each add their own subscription.
+ *
+ * \retval 0 on success
+ * \retval non-zero on failure
+ */
+int sccp_mwi_router_init(void);
+
+/*!
+ * \brief Free the resources associated to the MWI router.
+ *
+ * This function waits for the stasis subscriptions that have been removed to receive
+ * their final message.
+ *
+ * \note All the subscriptions must have been removed.
+ */
+void sccp_mwi_router_destroy(void);
+
+/*!
+ * \brief Subscribe to the MWI state changes of a mailbox.
+ *
+ * The callback is called, from a stasis thread or the router thread, every time the
+ * state of the mailbox changes, until the subscription is removed. The callback must
+ * not block.
+ *
+ * If the state of the mailbox is not known yet, it is fetched asynchronously, and the
+ * callback is called once it is available.
+ *
+ * \param[out] new_msgs the last known number of new messages, or -1 if unknown
+ *
+ * \retval non-NULL on success
+ * \retval NULL on failure
+ */
+struct sccp_mwi_subscription *sccp_mwi_router_subscribe(const char *mailbox, sccp_mwi_cb *callback, void *data, int *new_msgs);
+
+/*!
+ * \brief Remove a subscription.
+ *
+ * Once this function returns, the callback of the subscription is not running and
+ * won't be called anymore. This function doesn't wait for the stasis subscription
+ * to be joined.
+ *
+ * \note You must not call this function from the subscription callback.
+ */
+void sccp_mwi_router_unsubscribe(struct sccp_mwi_subscription *sub);
+
+#endif /* SCCP_MWI_ROUTER_H_ */
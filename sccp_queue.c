@@ -1,33 +1,59 @@
 #include <errno.h>
 #include <fcntl.h>
+#include <sched.h>
 #include <string.h>
 #include <unistd.h>
 #include <sys/eventfd.h>
 
 #include <asterisk.h>
+#include <asterisk/dlinkedlists.h>
 #include <asterisk/lock.h>
+#include <asterisk/strings.h>
 #include <asterisk/utils.h>
 
 #include "sccp_queue.h"
 
-static struct queue_item_container *container_alloc(size_t item_size)
+static char *queue_buf(struct sccp_queue *q)
 {
-	return ast_calloc(1, sizeof(struct queue_item_container) + item_size);
+	return q->heap_buf ? q->heap_buf : q->inline_buf.buf;
 }
 
-static void container_destroy(struct queue_item_container *container)
+static void *queue_item(struct sccp_queue *q, char *buf, size_t i)
 {
-	ast_free(container);
+	return buf + ((q->head + i) % q->capacity) * q->item_size;
 }
 
-static void container_write_item(struct queue_item_container *container, size_t item_size, void *item)
+static void queue_reset(struct sccp_queue *q)
 {
-	memcpy(container->item, item, item_size);
+	q->heap_buf = NULL;
+	q->capacity = SCCP_QUEUE_INLINE_SIZE / q->item_size;
+	q->head = 0;
+	q->count = 0;
 }
 
-static void container_read_item(struct queue_item_container *container, size_t item_size, void *item)
+static int queue_grow(struct sccp_queue *q)
 {
-	memcpy(item, container->item, item_size);
+	char *old_buf = queue_buf(q);
+	char *new_buf;
+	size_t new_capacity;
+	size_t i;
+
+	new_capacity = q->capacity ? q->capacity * 2 : 4;
+	new_buf = ast_malloc(new_capacity * q->item_size);
+	if (!new_buf) {
+		return -1;
+	}
+
+	for (i = 0; i < q->count; i++) {
+		memcpy(new_buf + i * q->item_size, queue_item(q, old_buf, i), q->item_size);
+	}
+
+	ast_free(q->heap_buf);
+	q->heap_buf = new_buf;
+	q->capacity = new_capacity;
+	q->head = 0;
+
+	return 0;
 }
 
 int sccp_queue_init(struct sccp_queue *q, size_t item_size)
@@ -36,51 +62,41 @@ int sccp_queue_init(struct sccp_queue *q, size_t item_size)
 		return SCCP_QUEUE_INVAL;
 	}
 
-	AST_LIST_HEAD_INIT_NOLOCK(&q->containers);
 	q->item_size = item_size;
+	queue_reset(q);
 
 	return 0;
 }
 
 void sccp_queue_destroy(struct sccp_queue *q)
 {
-	struct queue_item_container *container;
-
-	AST_LIST_TRAVERSE_SAFE_BEGIN(&q->containers, container, list) {
-		AST_LIST_REMOVE_CURRENT(list);
-		container_destroy(container);
-	}
-	AST_LIST_TRAVERSE_SAFE_END;
+	ast_free(q->heap_buf);
+	queue_reset(q);
 }
 
 int sccp_queue_put(struct sccp_queue *q, void *item)
 {
-	struct queue_item_container *container;
-
-	container = container_alloc(q->item_size);
-	if (!container) {
-		return -1;
+	if (q->count == q->capacity) {
+		if (queue_grow(q)) {
+			return -1;
+		}
 	}
 
-	AST_LIST_INSERT_TAIL(&q->containers, container, list);
-
-	container_write_item(container, q->item_size, item);
+	memcpy(queue_item(q, queue_buf(q), q->count), item, q->item_size);
+	q->count++;
 
 	return 0;
 }
 
 int sccp_queue_get(struct sccp_queue *q, void *item)
 {
-	struct queue_item_container *container;
-
-	container = AST_LIST_FIRST(&q->containers);
-	if (!container) {
-		return -1;
+	if (!q->count) {
+		return SCCP_QUEUE_EMPTY;
 	}
 
-	AST_LIST_REMOVE_HEAD(&q->containers, list);
-	container_read_item(container, q->item_size, item);
-	container_destroy(container);
+	memcpy(item, queue_item(q, queue_buf(q), 0), q->item_size);
+	q->count--;
+	q->head = q->count ? (q->head + 1) % q->capacity : 0;
 
 	return 0;
 }
@@ -91,53 +107,154 @@ int sccp_queue_move(struct sccp_queue *dest, struct sccp_queue *src)
 		return SCCP_QUEUE_INVAL;
 	}
 
-	dest->containers = src->containers;
+	dest->heap_buf = src->heap_buf;
 	dest->item_size = src->item_size;
+	dest->capacity = src->capacity;
+	dest->head = src->head;
+	dest->count = src->count;
+	if (!src->heap_buf && src->count) {
+		memcpy(dest->inline_buf.buf, src->inline_buf.buf, sizeof(src->inline_buf.buf));
+	}
 
-	AST_LIST_HEAD_INIT_NOLOCK(&src->containers);
+	queue_reset(src);
 
 	return 0;
 }
 
 int sccp_queue_empty(const struct sccp_queue *q)
 {
-	return AST_LIST_EMPTY(&q->containers);
+	return !q->count;
 }
 
+/*
+ * The synchronized queue is a lock-free multi-producer single-consumer queue
+ * (Vyukov's intrusive MPSC queue): producers append a node by exchanging the
+ * tail pointer, and the consumer walks the list from a stub node.
+ *
+ * The number of items is counted separately, so that the eventfd is only
+ * written on the empty to non-empty transition. A producer might have exchanged
+ * the tail but not yet linked its node when the consumer drains the queue; in
+ * that case, the count is still non-zero after the drain and the consumer
+ * signals the eventfd itself so that it comes back for the item.
+ */
+struct sync_queue_node {
+	struct sync_queue_node *next;
+	void *item[0];
+};
+
 struct sccp_sync_queue {
-	ast_mutex_t lock;
-	struct sccp_queue q;
+	AST_DLLIST_ENTRY(sccp_sync_queue) list;
+	char name[48];
+	/* only accessed by the consumer; the item of the head node has already been taken */
+	struct sync_queue_node *head;
+	/* exchanged by the producers */
+	struct sync_queue_node *tail;
+	size_t item_size;
+	int count;
+	int capacity;
+	int high_water;
+	int full_count;
+	/* number of producers currently putting an item */
+	int producers;
 	int eventfd;
 	int closed;
 };
 
-struct sccp_sync_queue *sccp_sync_queue_create(size_t item_size)
+/* every synchronized queue, for the stats */
+static AST_DLLIST_HEAD_NOLOCK_STATIC(sync_queues, sccp_sync_queue);
+static size_t sync_queue_count;
+AST_MUTEX_DEFINE_STATIC(sync_queues_lock);
+
+static struct sync_queue_node *sync_queue_node_alloc(size_t item_size)
+{
+	return ast_calloc(1, sizeof(struct sync_queue_node) + item_size);
+}
+
+static void sync_queue_node_destroy(struct sync_queue_node *node)
+{
+	ast_free(node);
+}
+
+struct sccp_sync_queue *sccp_sync_queue_create(const char *name, size_t item_size, int capacity)
 {
 	struct sccp_sync_queue *sync_q;
+	struct sync_queue_node *stub;
+
+	if (!item_size) {
+		return NULL;
+	}
 
 	sync_q = ast_calloc(1, sizeof(*sync_q));
 	if (!sync_q) {
 		return NULL;
 	}
 
+	stub = sync_queue_node_alloc(0);
+	if (!stub) {
+		ast_free(sync_q);
+		return NULL;
+	}
+
 	sync_q->eventfd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
 	if (sync_q->eventfd == -1) {
 		ast_log(LOG_ERROR, "sccp sync queue create failed: eventfd: %s\n", strerror(errno));
+		sync_queue_node_destroy(stub);
 		ast_free(sync_q);
 		return NULL;
 	}
 
-	ast_mutex_init(&sync_q->lock);
-	sccp_queue_init(&sync_q->q, item_size);
+	ast_copy_string(sync_q->name, name, sizeof(sync_q->name));
+	sync_q->head = stub;
+	sync_q->tail = stub;
+	sync_q->item_size = item_size;
+	sync_q->count = 0;
+	sync_q->capacity = capacity;
+	sync_q->high_water = 0;
+	sync_q->full_count = 0;
+	sync_q->producers = 0;
 	sync_q->closed = 0;
 
+	ast_mutex_lock(&sync_queues_lock);
+	AST_DLLIST_INSERT_TAIL(&sync_queues, sync_q, list);
+	sync_queue_count++;
+	ast_mutex_unlock(&sync_queues_lock);
+
 	return sync_q;
 }
 
+/*
+ * Must only be called by the consumer.
+ */
+static struct sync_queue_node *sync_queue_pop(struct sccp_sync_queue *sync_q)
+{
+	struct sync_queue_node *head = sync_q->head;
+	struct sync_queue_node *next;
+
+	next = __atomic_load_n(&head->next, __ATOMIC_ACQUIRE);
+	if (!next) {
+		return NULL;
+	}
+
+	/* the popped node becomes the new stub, and the old stub is returned */
+	sync_q->head = next;
+
+	return head;
+}
+
 void sccp_sync_queue_destroy(struct sccp_sync_queue *sync_q)
 {
-	ast_mutex_destroy(&sync_q->lock);
-	sccp_queue_destroy(&sync_q->q);
+	struct sync_queue_node *node;
+
+	ast_mutex_lock(&sync_queues_lock);
+	AST_DLLIST_REMOVE(&sync_queues, sync_q, list);
+	sync_queue_count--;
+	ast_mutex_unlock(&sync_queues_lock);
+
+	while ((node = sync_queue_pop(sync_q))) {
+		sync_queue_node_destroy(node);
+	}
+
+	sync_queue_node_destroy(sync_q->head);
 	close(sync_q->eventfd);
 	ast_free(sync_q);
 }
@@ -149,9 +266,12 @@ int sccp_sync_queue_fd(struct sccp_sync_queue *sync_q)
 
 void sccp_sync_queue_close(struct sccp_sync_queue *sync_q)
 {
-	ast_mutex_lock(&sync_q->lock);
-	sync_q->closed = 1;
-	ast_mutex_unlock(&sync_q->lock);
+	__atomic_store_n(&sync_q->closed, 1, __ATOMIC_SEQ_CST);
+
+	/* wait for the producers that have not seen the queue closed */
+	while (__atomic_load_n(&sync_q->producers, __ATOMIC_SEQ_CST)) {
+		sched_yield();
+	}
 }
 
 static int sccp_sync_queue_signal_fd(struct sccp_sync_queue *sync_q)
@@ -182,6 +302,10 @@ static int sccp_sync_queue_clear_fd(struct sccp_sync_queue *sync_q)
 
 	switch (n) {
 	case -1:
+		if (errno == EAGAIN) {
+			return 0;
+		}
+
 		ast_log(LOG_ERROR, "sccp sync queue clear fd failed: read: %s\n", strerror(errno));
 		return -1;
 	case 0:
@@ -192,80 +316,145 @@ static int sccp_sync_queue_clear_fd(struct sccp_sync_queue *sync_q)
 	return 0;
 }
 
-static int sccp_sync_queue_put_no_lock(struct sccp_sync_queue *sync_q, void *item)
+int sccp_sync_queue_put(struct sccp_sync_queue *sync_q, void *item)
 {
-	if (sync_q->closed) {
+	struct sync_queue_node *node;
+	struct sync_queue_node *prev;
+	int count;
+	int high_water;
+	int ret = 0;
+
+	node = sync_queue_node_alloc(sync_q->item_size);
+	if (!node) {
+		ast_log(LOG_ERROR, "sccp sync queue put failed: could not queue item\n");
+		return -1;
+	}
+
+	memcpy(node->item, item, sync_q->item_size);
+
+	__atomic_add_fetch(&sync_q->producers, 1, __ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&sync_q->closed, __ATOMIC_SEQ_CST)) {
+		__atomic_sub_fetch(&sync_q->producers, 1, __ATOMIC_SEQ_CST);
+		sync_queue_node_destroy(node);
 		return SCCP_QUEUE_CLOSED;
 	}
 
-	if (sccp_queue_empty(&sync_q->q)) {
-		if (sccp_sync_queue_signal_fd(sync_q)) {
-			ast_log(LOG_ERROR, "sccp sync queue put failed: could not write to pipe\n");
-			return -1;
-		}
+	/* reserve a slot before linking the node, so that the capacity is never exceeded */
+	count = __atomic_fetch_add(&sync_q->count, 1, __ATOMIC_SEQ_CST);
+	if (sync_q->capacity && count >= sync_q->capacity) {
+		__atomic_sub_fetch(&sync_q->count, 1, __ATOMIC_SEQ_CST);
+		__atomic_add_fetch(&sync_q->full_count, 1, __ATOMIC_RELAXED);
+		__atomic_sub_fetch(&sync_q->producers, 1, __ATOMIC_SEQ_CST);
+		sync_queue_node_destroy(node);
+		return SCCP_QUEUE_FULL;
 	}
 
-	if (sccp_queue_put(&sync_q->q, item)) {
-		ast_log(LOG_ERROR, "sccp sync queue put failed: could not queue item\n");
-		return -1;
+	high_water = __atomic_load_n(&sync_q->high_water, __ATOMIC_RELAXED);
+	while (count + 1 > high_water) {
+		if (__atomic_compare_exchange_n(&sync_q->high_water, &high_water, count + 1, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+			break;
+		}
 	}
 
-	return 0;
-}
+	prev = __atomic_exchange_n(&sync_q->tail, node, __ATOMIC_ACQ_REL);
+	__atomic_store_n(&prev->next, node, __ATOMIC_RELEASE);
 
-int sccp_sync_queue_put(struct sccp_sync_queue *sync_q, void *item)
-{
-	int ret;
+	if (!count) {
+		if (sccp_sync_queue_signal_fd(sync_q)) {
+			ast_log(LOG_ERROR, "sccp sync queue put failed: could not write to eventfd\n");
+			ret = -1;
+		}
+	}
 
-	ast_mutex_lock(&sync_q->lock);
-	ret = sccp_sync_queue_put_no_lock(sync_q, item);
-	ast_mutex_unlock(&sync_q->lock);
+	__atomic_sub_fetch(&sync_q->producers, 1, __ATOMIC_SEQ_CST);
 
 	return ret;
 }
 
-static int sccp_sync_queue_get_no_lock(struct sccp_sync_queue *sync_q, void *item)
+/*
+ * Account for the items that have been taken by the consumer, and signal the
+ * eventfd if some items are still pending.
+ */
+static void sccp_sync_queue_on_taken(struct sccp_sync_queue *sync_q, int n)
 {
-	if (sccp_queue_get(&sync_q->q, item)) {
-		return SCCP_QUEUE_EMPTY;
+	if (__atomic_sub_fetch(&sync_q->count, n, __ATOMIC_SEQ_CST)) {
+		sccp_sync_queue_signal_fd(sync_q);
 	}
-
-	if (sccp_queue_empty(&sync_q->q)) {
-		sccp_sync_queue_clear_fd(sync_q);
-	}
-
-	return 0;
 }
 
 int sccp_sync_queue_get(struct sccp_sync_queue *sync_q, void *item)
 {
-	int ret;
-
-	ast_mutex_lock(&sync_q->lock);
-	ret = sccp_sync_queue_get_no_lock(sync_q, item);
-	ast_mutex_unlock(&sync_q->lock);
+	struct sync_queue_node *node;
 
-	return ret;
-}
+	sccp_sync_queue_clear_fd(sync_q);
 
-static void sccp_sync_queue_get_all_no_lock(struct sccp_sync_queue *sync_q, struct sccp_queue *ret)
-{
-	sccp_queue_move(ret, &sync_q->q);
-	if (!sccp_queue_empty(ret)) {
-		sccp_sync_queue_clear_fd(sync_q);
+	node = sync_queue_pop(sync_q);
+	if (!node) {
+		sccp_sync_queue_on_taken(sync_q, 0);
+		return SCCP_QUEUE_EMPTY;
 	}
+
+	memcpy(item, sync_q->head->item, sync_q->item_size);
+	sync_queue_node_destroy(node);
+	sccp_sync_queue_on_taken(sync_q, 1);
+
+	return 0;
 }
 
 int sccp_sync_queue_get_all(struct sccp_sync_queue *sync_q, struct sccp_queue *ret)
 {
+	struct sync_queue_node *node;
+	int n = 0;
+
 	if (!ret) {
 		ast_log(LOG_ERROR, "sccp sync queue get all failed: ret is null\n");
 		return SCCP_QUEUE_INVAL;
 	}
 
-	ast_mutex_lock(&sync_q->lock);
-	sccp_sync_queue_get_all_no_lock(sync_q, ret);
-	ast_mutex_unlock(&sync_q->lock);
+	sccp_queue_init(ret, sync_q->item_size);
+	sccp_sync_queue_clear_fd(sync_q);
+
+	while ((node = sync_queue_pop(sync_q))) {
+		if (sccp_queue_put(ret, sync_q->head->item)) {
+			ast_log(LOG_ERROR, "sccp sync queue get all failed: could not queue item\n");
+		}
+
+		sync_queue_node_destroy(node);
+		n++;
+	}
+
+	sccp_sync_queue_on_taken(sync_q, n);
+
+	return 0;
+}
+
+int sccp_sync_queue_take_snapshots(struct sccp_sync_queue_snapshot **snapshots, size_t *n)
+{
+	struct sccp_sync_queue_snapshot *tmp;
+	struct sccp_sync_queue *sync_q;
+	size_t i = 0;
+
+	ast_mutex_lock(&sync_queues_lock);
+
+	tmp = ast_calloc(sync_queue_count ? sync_queue_count : 1, sizeof(*tmp));
+	if (!tmp) {
+		ast_mutex_unlock(&sync_queues_lock);
+		return -1;
+	}
+
+	AST_DLLIST_TRAVERSE(&sync_queues, sync_q, list) {
+		ast_copy_string(tmp[i].name, sync_q->name, sizeof(tmp[i].name));
+		tmp[i].depth = __atomic_load_n(&sync_q->count, __ATOMIC_RELAXED);
+		tmp[i].high_water = __atomic_load_n(&sync_q->high_water, __ATOMIC_RELAXED);
+		tmp[i].capacity = sync_q->capacity;
+		tmp[i].full_count = __atomic_load_n(&sync_q->full_count, __ATOMIC_RELAXED);
+		i++;
+	}
+
+	ast_mutex_unlock(&sync_queues_lock);
+
+	*snapshots = tmp;
+	*n = i;
 
 	return 0;
 }
@@ -1,24 +1,36 @@
 #ifndef SCCP_QUEUE_H_
 #define SCCP_QUEUE_H_
 
-#include <asterisk/linkedlists.h>
+#include <stdint.h>
+#include <stddef.h>
 
 struct sccp_sync_queue;
 
 #define SCCP_QUEUE_CLOSED 1
 #define SCCP_QUEUE_EMPTY 2
 #define SCCP_QUEUE_INVAL 3
+#define SCCP_QUEUE_FULL 4
 
-/* not to be used directly */
-struct queue_item_container {
-	AST_LIST_ENTRY(queue_item_container) list;
-	void *item[0];
-};
+/* size of the storage embedded in the queue, used before any allocation */
+#define SCCP_QUEUE_INLINE_SIZE 192
 
-/* not to be used directly */
+/*
+ * not to be used directly
+ *
+ * The items are stored in a ring buffer, which is the inline storage as long as
+ * the items fit, else a heap allocated buffer that grows as needed.
+ */
 struct sccp_queue {
-	AST_LIST_HEAD_NOLOCK(, queue_item_container) containers;
+	char *heap_buf;
 	size_t item_size;
+	size_t capacity;
+	size_t head;
+	size_t count;
+	union {
+		char buf[SCCP_QUEUE_INLINE_SIZE];
+		uint64_t align;
+		void *align_ptr;
+	} inline_buf;
 };
 
 /*!
@@ -57,6 +69,8 @@ int sccp_queue_get(struct sccp_queue *q, void *item);
  * \brief Move all items from the source queue to the destination queue.
  *
  * \note The destination queue must not have been initialized.
+ * \note This is a constant time operation; a heap allocated buffer is handed
+ *       over, and the inline storage is copied.
  *
  * \retval 0 on success
  * \retval SCCP_QUEUE_INVAL if dest or src is null
@@ -68,15 +82,27 @@ int sccp_queue_move(struct sccp_queue *dest, struct sccp_queue *src);
  */
 int sccp_queue_empty(const struct sccp_queue *q);
 
+struct sccp_sync_queue_snapshot {
+	char name[48];
+	int depth;
+	int high_water;
+	int capacity;
+	int full_count;
+};
+
 /*!
  * \brief Create a new synchronized (FIFO) queue.
  *
+ * The queue is lock-free, and supports many producers but a single consumer.
+ *
+ * \param name name of the queue, as shown by sccp_sync_queue_take_snapshots
  * \param item_size size of item data
+ * \param capacity maximum number of items in the queue, or 0 for no limit
  *
  * \retval non-NULL on success
  * \retval NULL on failure
  */
-struct sccp_sync_queue *sccp_sync_queue_create(size_t item_size);
+struct sccp_sync_queue *sccp_sync_queue_create(const char *name, size_t item_size, int capacity);
 
 /*!
  * \brief Destroy the queue.
@@ -103,6 +129,7 @@ void sccp_sync_queue_close(struct sccp_sync_queue *sync_q);
  *
  * \retval 0 on success
  * \retval SCCP_QUEUE_CLOSED if the queue is closed
+ * \retval SCCP_QUEUE_FULL if the queue is at capacity
  * \retval -1 on other failure
  */
 int sccp_sync_queue_put(struct sccp_sync_queue *sync_q, void *item);
@@ -126,4 +153,14 @@ int sccp_sync_queue_get(struct sccp_sync_queue *sync_q, void *item);
  */
 int sccp_sync_queue_get_all(struct sccp_sync_queue *sync_q, struct sccp_queue *ret);
 
+/*!
+ * \brief Take a snapshot of every synchronized queue.
+ *
+ * \note On success, snapshots must be freed with ast_free.
+ *
+ * \retval 0 on success
+ * \retval non-zero on failure
+ */
+int sccp_sync_queue_take_snapshots(struct sccp_sync_queue_snapshot **snapshots, size_t *n);
+
 #endif /* SCCP_QUEUE_H_ */
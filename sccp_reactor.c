@@ -0,0 +1,602 @@
+#include <errno.h>
+#include <sys/epoll.h>
+
+#include <asterisk.h>
+#include <asterisk/astobj2.h>
+#include <asterisk/heap.h>
+#include <asterisk/linkedlists.h>
+#include <asterisk/time.h>
+#include <asterisk/utils.h>
+
+#include "sccp_queue.h"
+#include "sccp_reactor.h"
+#include "sccp_session.h"
+
+#define REACTOR_MAX_EVENTS 64
+
+static void *reactor_run(void *data);
+
+enum reactor_state {
+	STATE_CREATED,
+	STATE_STARTED,
+};
+
+enum reactor_fd_type {
+	FD_SOCK,
+	FD_QUEUE,
+};
+
+struct reactor_fd {
+	struct reactor_session *rsession;
+	enum reactor_fd_type type;
+};
+
+struct reactor_session {
+	AST_LIST_ENTRY(reactor_session) list;
+	struct sccp_session *session;
+	sccp_reactor_session_end_cb callback;
+	void *data;
+
+	struct reactor_fd sock_fd;
+	struct reactor_fd queue_fd;
+	/* epoll events currently watched on the session socket */
+	uint32_t sock_events;
+
+	struct timeval when;
+	ssize_t __heap_index;
+	int scheduled;
+	int ended;
+};
+
+struct sccp_reactor {
+	enum reactor_state state;
+	int epfd;
+	int stop;
+	int session_count;
+
+	pthread_t thread;
+
+	struct ast_heap *heap;
+	struct sccp_sync_queue *sync_q;
+	AST_LIST_HEAD_NOLOCK(, reactor_session) rsessions;
+	/* sessions that have been ended but that can't be freed yet, since an
+	 * event referencing them might still be pending in the current epoll batch
+	 */
+	AST_LIST_HEAD_NOLOCK(, reactor_session) ended_rsessions;
+};
+
+enum reactor_msg_id {
+	MSG_ADD_SESSION,
+	MSG_STOP,
+};
+
+struct reactor_msg_add_session {
+	struct sccp_session *session;
+	sccp_reactor_session_end_cb callback;
+	void *data;
+};
+
+union reactor_msg_data {
+	struct reactor_msg_add_session add_session;
+};
+
+struct reactor_msg {
+	union reactor_msg_data data;
+	enum reactor_msg_id id;
+};
+
+static void reactor_msg_init_add_session(struct reactor_msg *msg, struct sccp_session *session, sccp_reactor_session_end_cb callback, void *data)
+{
+	msg->id = MSG_ADD_SESSION;
+	msg->data.add_session.session = session;
+	msg->data.add_session.callback = callback;
+	msg->data.add_session.data = data;
+	ao2_ref(session, +1);
+}
+
+static void reactor_msg_init_stop(struct reactor_msg *msg)
+{
+	msg->id = MSG_STOP;
+}
+
+static void reactor_msg_destroy(struct reactor_msg *msg)
+{
+	switch (msg->id) {
+	case MSG_ADD_SESSION:
+		ao2_ref(msg->data.add_session.session, -1);
+		break;
+	case MSG_STOP:
+		break;
+	}
+}
+
+static int reactor_session_cmp(void *a, void *b)
+{
+	return ast_tvcmp(((struct reactor_session *) b)->when, ((struct reactor_session *) a)->when);
+}
+
+static struct reactor_session *reactor_session_create(struct sccp_session *session, sccp_reactor_session_end_cb callback, void *data)
+{
+	struct reactor_session *rsession;
+
+	rsession = ast_calloc(1, sizeof(*rsession));
+	if (!rsession) {
+		return NULL;
+	}
+
+	rsession->session = session;
+	ao2_ref(session, +1);
+	rsession->callback = callback;
+	rsession->data = data;
+	rsession->sock_fd.rsession = rsession;
+	rsession->sock_fd.type = FD_SOCK;
+	rsession->queue_fd.rsession = rsession;
+	rsession->queue_fd.type = FD_QUEUE;
+
+	return rsession;
+}
+
+static void reactor_session_destroy(struct reactor_session *rsession)
+{
+	ao2_ref(rsession->session, -1);
+	ast_free(rsession);
+}
+
+static int reactor_queue_msg(struct sccp_reactor *reactor, struct reactor_msg *msg)
+{
+	int ret;
+
+	ret = sccp_sync_queue_put(reactor->sync_q, msg);
+	if (ret) {
+		reactor_msg_destroy(msg);
+	}
+
+	return ret;
+}
+
+static int reactor_queue_msg_stop(struct sccp_reactor *reactor)
+{
+	struct reactor_msg msg;
+
+	reactor_msg_init_stop(&msg);
+
+	return reactor_queue_msg(reactor, &msg);
+}
+
+static void reactor_empty_queue(struct sccp_reactor *reactor)
+{
+	struct sccp_queue q;
+	struct reactor_msg msg;
+
+	sccp_sync_queue_get_all(reactor->sync_q, &q);
+	while (!sccp_queue_get(&q, &msg)) {
+		if (msg.id == MSG_ADD_SESSION) {
+			ast_atomic_fetchadd_int(&reactor->session_count, -1);
+			msg.data.add_session.callback(msg.data.add_session.session, msg.data.add_session.data);
+		}
+
+		reactor_msg_destroy(&msg);
+	}
+
+	sccp_queue_destroy(&q);
+}
+
+static int reactor_epoll_ctl(struct sccp_reactor *reactor, int op, int fd, uint32_t events, void *ptr)
+{
+	struct epoll_event event;
+
+	memset(&event, 0, sizeof(event));
+	event.events = events;
+	event.data.ptr = ptr;
+
+	if (epoll_ctl(reactor->epfd, op, fd, &event) == -1) {
+		ast_log(LOG_ERROR, "reactor epoll ctl failed: epoll_ctl: %s\n", strerror(errno));
+		return -1;
+	}
+
+	return 0;
+}
+
+static int reactor_epoll_add(struct sccp_reactor *reactor, int fd, void *ptr)
+{
+	return reactor_epoll_ctl(reactor, EPOLL_CTL_ADD, fd, EPOLLIN, ptr);
+}
+
+static void reactor_epoll_del(struct sccp_reactor *reactor, int fd)
+{
+	/* don't check the result; the fd might never have been added */
+	epoll_ctl(reactor->epfd, EPOLL_CTL_DEL, fd, NULL);
+}
+
+static void reactor_unschedule_session(struct sccp_reactor *reactor, struct reactor_session *rsession)
+{
+	if (rsession->scheduled) {
+		ast_heap_remove(reactor->heap, rsession);
+		rsession->scheduled = 0;
+	}
+}
+
+static void reactor_end_session(struct sccp_reactor *reactor, struct reactor_session *rsession)
+{
+	reactor_epoll_del(reactor, sccp_session_sock_fd(rsession->session));
+	reactor_epoll_del(reactor, sccp_session_queue_fd(rsession->session));
+	reactor_unschedule_session(reactor, rsession);
+
+	sccp_session_end(rsession->session);
+
+	AST_LIST_REMOVE(&reactor->rsessions, rsession, list);
+	AST_LIST_INSERT_TAIL(&reactor->ended_rsessions, rsession, list);
+	rsession->ended = 1;
+
+	ast_atomic_fetchadd_int(&reactor->session_count, -1);
+	rsession->callback(rsession->session, rsession->data);
+}
+
+static void reactor_end_sessions(struct sccp_reactor *reactor)
+{
+	struct reactor_session *rsession;
+
+	while ((rsession = AST_LIST_FIRST(&reactor->rsessions))) {
+		reactor_end_session(reactor, rsession);
+	}
+}
+
+static void reactor_free_ended_sessions(struct sccp_reactor *reactor)
+{
+	struct reactor_session *rsession;
+
+	while ((rsession = AST_LIST_REMOVE_HEAD(&reactor->ended_rsessions, list))) {
+		reactor_session_destroy(rsession);
+	}
+}
+
+static int reactor_schedule_session(struct sccp_reactor *reactor, struct reactor_session *rsession)
+{
+	struct timeval when;
+
+	if (sccp_session_next_task_when(rsession->session, &when)) {
+		reactor_unschedule_session(reactor, rsession);
+		return 0;
+	}
+
+	if (rsession->scheduled) {
+		if (!ast_tvcmp(when, rsession->when)) {
+			return 0;
+		}
+
+		reactor_unschedule_session(reactor, rsession);
+	}
+
+	rsession->when = when;
+	if (ast_heap_push(reactor->heap, rsession)) {
+		ast_log(LOG_ERROR, "reactor schedule session failed: heap push failed\n");
+		return -1;
+	}
+
+	rsession->scheduled = 1;
+
+	return 0;
+}
+
+/*
+ * Watch the session socket for writability only while the session has pending output.
+ */
+static int reactor_update_sock_events(struct sccp_reactor *reactor, struct reactor_session *rsession)
+{
+	uint32_t events = EPOLLIN;
+
+	if (sccp_session_want_write(rsession->session)) {
+		events |= EPOLLOUT;
+	}
+
+	if (events == rsession->sock_events) {
+		return 0;
+	}
+
+	if (reactor_epoll_ctl(reactor, EPOLL_CTL_MOD, sccp_session_sock_fd(rsession->session), events, &rsession->sock_fd)) {
+		return -1;
+	}
+
+	rsession->sock_events = events;
+
+	return 0;
+}
+
+/*
+ * Must be called every time the session might have changed state, i.e. after
+ * each call to one of the sccp_session_on_* function.
+ */
+static void reactor_update_session(struct sccp_reactor *reactor, struct reactor_session *rsession)
+{
+	if (sccp_session_stopped(rsession->session) ||
+			reactor_update_sock_events(reactor, rsession) ||
+			reactor_schedule_session(reactor, rsession)) {
+		reactor_end_session(reactor, rsession);
+	}
+}
+
+static void reactor_add_session(struct sccp_reactor *reactor, struct reactor_msg_add_session *msg)
+{
+	struct reactor_session *rsession;
+
+	rsession = reactor_session_create(msg->session, msg->callback, msg->data);
+	if (!rsession) {
+		ast_atomic_fetchadd_int(&reactor->session_count, -1);
+		msg->callback(msg->session, msg->data);
+		return;
+	}
+
+	AST_LIST_INSERT_TAIL(&reactor->rsessions, rsession, list);
+
+	if (reactor_epoll_add(reactor, sccp_session_sock_fd(rsession->session), &rsession->sock_fd) ||
+			reactor_epoll_add(reactor, sccp_session_queue_fd(rsession->session), &rsession->queue_fd)) {
+		reactor_end_session(reactor, rsession);
+		return;
+	}
+
+	rsession->sock_events = EPOLLIN;
+	sccp_session_start(rsession->session);
+	reactor_update_session(reactor, rsession);
+}
+
+static void reactor_process_msg(struct sccp_reactor *reactor, struct reactor_msg *msg)
+{
+	switch (msg->id) {
+	case MSG_ADD_SESSION:
+		reactor_add_session(reactor, &msg->data.add_session);
+		break;
+	case MSG_STOP:
+		reactor->stop = 1;
+		break;
+	}
+
+	reactor_msg_destroy(msg);
+}
+
+static void reactor_on_queue_events(struct sccp_reactor *reactor, int events)
+{
+	struct sccp_queue q;
+	struct reactor_msg msg;
+
+	if (events & EPOLLIN) {
+		sccp_sync_queue_get_all(reactor->sync_q, &q);
+		while (!sccp_queue_get(&q, &msg)) {
+			reactor_process_msg(reactor, &msg);
+		}
+
+		sccp_queue_destroy(&q);
+	}
+
+	if (events & ~EPOLLIN) {
+		ast_log(LOG_WARNING, "reactor on queue events failed: unexpected event 0x%X\n", events);
+		reactor->stop = 1;
+	}
+}
+
+static void reactor_on_session_events(struct sccp_reactor *reactor, struct reactor_fd *rfd, int events)
+{
+	struct reactor_session *rsession = rfd->rsession;
+
+	if (rsession->ended) {
+		return;
+	}
+
+	if (!sccp_session_stopped(rsession->session)) {
+		switch (rfd->type) {
+		case FD_SOCK:
+			sccp_session_on_sock_events(rsession->session, events);
+			break;
+		case FD_QUEUE:
+			sccp_session_on_queue_events(rsession->session, events);
+			break;
+		}
+	}
+
+	reactor_update_session(reactor, rsession);
+}
+
+static void reactor_run_tasks(struct sccp_reactor *reactor)
+{
+	struct reactor_session *rsession;
+	struct timeval when;
+
+	when = ast_tvadd(ast_tvnow(), ast_tv(0, 1000));
+	while ((rsession = ast_heap_peek(reactor->heap, 1))) {
+		if (ast_tvcmp(rsession->when, when) != -1) {
+			break;
+		}
+
+		ast_heap_pop(reactor->heap);
+		rsession->scheduled = 0;
+
+		sccp_session_run_tasks(rsession->session);
+		reactor_update_session(reactor, rsession);
+	}
+}
+
+static int reactor_next_ms(struct sccp_reactor *reactor)
+{
+	struct reactor_session *rsession;
+	int ms;
+
+	rsession = ast_heap_peek(reactor->heap, 1);
+	if (!rsession) {
+		return -1;
+	}
+
+	ms = ast_tvdiff_ms(rsession->when, ast_tvnow());
+	if (ms < 0) {
+		ms = 0;
+	}
+
+	return ms;
+}
+
+static void *reactor_run(void *data)
+{
+	struct sccp_reactor *reactor = data;
+	struct epoll_event events[REACTOR_MAX_EVENTS];
+	struct reactor_fd *rfd;
+	int nfds;
+	int i;
+
+	for (;;) {
+		nfds = epoll_wait(reactor->epfd, events, ARRAY_LEN(events), reactor_next_ms(reactor));
+		if (nfds == -1) {
+			if (errno == EINTR) {
+				continue;
+			}
+
+			ast_log(LOG_ERROR, "reactor run failed: epoll_wait: %s\n", strerror(errno));
+			goto end;
+		}
+
+		for (i = 0; i < nfds; i++) {
+			rfd = events[i].data.ptr;
+			if (rfd) {
+				reactor_on_session_events(reactor, rfd, events[i].events);
+			} else {
+				reactor_on_queue_events(reactor, events[i].events);
+			}
+		}
+
+		if (reactor->stop) {
+			goto end;
+		}
+
+		reactor_run_tasks(reactor);
+		reactor_free_ended_sessions(reactor);
+	}
+
+end:
+	reactor_end_sessions(reactor);
+	reactor_free_ended_sessions(reactor);
+	sccp_sync_queue_close(reactor->sync_q);
+	reactor_empty_queue(reactor);
+
+	return NULL;
+}
+
+struct sccp_reactor *sccp_reactor_create(int index)
+{
+	struct sccp_reactor *reactor;
+	char name[32];
+
+	reactor = ast_calloc(1, sizeof(*reactor));
+	if (!reactor) {
+		return NULL;
+	}
+
+	reactor->epfd = epoll_create1(EPOLL_CLOEXEC);
+	if (reactor->epfd == -1) {
+		ast_log(LOG_ERROR, "sccp reactor create failed: epoll_create1: %s\n", strerror(errno));
+		goto error;
+	}
+
+	reactor->heap = ast_heap_create(8, reactor_session_cmp, offsetof(struct reactor_session, __heap_index));
+	if (!reactor->heap) {
+		goto error;
+	}
+
+	snprintf(name, sizeof(name), "reactor %d", index);
+	reactor->sync_q = sccp_sync_queue_create(name, sizeof(struct reactor_msg), 0);
+	if (!reactor->sync_q) {
+		goto error;
+	}
+
+	if (reactor_epoll_add(reactor, sccp_sync_queue_fd(reactor->sync_q), NULL)) {
+		goto error;
+	}
+
+	reactor->state = STATE_CREATED;
+	AST_LIST_HEAD_INIT_NOLOCK(&reactor->rsessions);
+	AST_LIST_HEAD_INIT_NOLOCK(&reactor->ended_rsessions);
+
+	return reactor;
+
+error:
+	if (reactor->sync_q) {
+		sccp_sync_queue_destroy(reactor->sync_q);
+	}
+
+	if (reactor->heap) {
+		ast_heap_destroy(reactor->heap);
+	}
+
+	if (reactor->epfd != -1) {
+		close(reactor->epfd);
+	}
+
+	ast_free(reactor);
+
+	return NULL;
+}
+
+void sccp_reactor_destroy(struct sccp_reactor *reactor)
+{
+	int ret;
+
+	if (reactor->state == STATE_STARTED) {
+		if (reactor_queue_msg_stop(reactor)) {
+			ast_log(LOG_WARNING, "sccp reactor destroy error: could not ask reactor to stop\n");
+		}
+
+		ret = pthread_join(reactor->thread, NULL);
+		if (ret) {
+			ast_log(LOG_ERROR, "sccp reactor destroy error: pthread_join: %s\n", strerror(ret));
+		}
+	} else {
+		sccp_sync_queue_close(reactor->sync_q);
+		reactor_empty_queue(reactor);
+	}
+
+	sccp_sync_queue_destroy(reactor->sync_q);
+	ast_heap_destroy(reactor->heap);
+	close(reactor->epfd);
+	ast_free(reactor);
+}
+
+int sccp_reactor_start(struct sccp_reactor *reactor)
+{
+	int ret;
+
+	if (reactor->state != STATE_CREATED) {
+		ast_log(LOG_ERROR, "sccp reactor start failed: reactor not in initialized state\n");
+		return -1;
+	}
+
+	ret = ast_pthread_create_background(&reactor->thread, NULL, reactor_run, reactor);
+	if (ret) {
+		ast_log(LOG_ERROR, "sccp reactor start failed: pthread create: %s\n", strerror(ret));
+		return -1;
+	}
+
+	reactor->state = STATE_STARTED;
+
+	return 0;
+}
+
+int sccp_reactor_add_session(struct sccp_reactor *reactor, struct sccp_session *session, sccp_reactor_session_end_cb callback, void *data)
+{
+	struct reactor_msg msg;
+
+	if (!session) {
+		ast_log(LOG_ERROR, "sccp reactor add session failed: session is null\n");
+		return -1;
+	}
+
+	reactor_msg_init_add_session(&msg, session, callback, data);
+
+	ast_atomic_fetchadd_int(&reactor->session_count, +1);
+	if (reactor_queue_msg(reactor, &msg)) {
+		ast_atomic_fetchadd_int(&reactor->session_count, -1);
+		return -1;
+	}
+
+	return 0;
+}
+
+int sccp_reactor_session_count(struct sccp_reactor *reactor)
+{
+	return reactor->session_count;
+}
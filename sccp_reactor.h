@@ -0,0 +1,63 @@
+#ifndef SCCP_REACTOR_H_
+#define SCCP_REACTOR_H_
+
+struct sccp_reactor;
+struct sccp_session;
+
+/*!
+ * \brief Function type for the session end callback.
+ *
+ * \note Called from the reactor thread, after the session has been ended.
+ */
+typedef void (*sccp_reactor_session_end_cb)(struct sccp_session *session, void *data);
+
+/*!
+ * \brief Create a new reactor.
+ *
+ * A reactor is a thread multiplexing many sessions over a single epoll instance.
+ *
+ * \param index index of the reactor, used to identify it in the stats
+ *
+ * \retval non-NULL on success
+ * \retval NULL on failure
+ */
+struct sccp_reactor *sccp_reactor_create(int index);
+
+/*!
+ * \brief Destroy the reactor.
+ *
+ * \note If the reactor is running, it will be stopped and all the sessions it
+ *       is running will be ended.
+ */
+void sccp_reactor_destroy(struct sccp_reactor *reactor);
+
+/*!
+ * \brief Start the reactor thread.
+ *
+ * \retval 0 on success
+ * \retval non-zero on failure
+ */
+int sccp_reactor_start(struct sccp_reactor *reactor);
+
+/*!
+ * \brief Ask the reactor to run the session.
+ *
+ * The reactor takes a new reference to the session. Once the session has stopped,
+ * the callback is called from the reactor thread.
+ *
+ * \note The callback is also called if the reactor stops before the session
+ *       has been started.
+ *
+ * \retval 0 on success
+ * \retval non-zero on failure
+ */
+int sccp_reactor_add_session(struct sccp_reactor *reactor, struct sccp_session *session, sccp_reactor_session_end_cb callback, void *data);
+
+/*!
+ * \brief Return the number of sessions owned by the reactor.
+ *
+ * \note The value is only indicative, since it might change at any time.
+ */
+int sccp_reactor_session_count(struct sccp_reactor *reactor);
+
+#endif /* SCCP_REACTOR_H_ */
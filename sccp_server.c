@@ -1,4 +1,5 @@
 #include <errno.h>
+#include <sys/eventfd.h>
 
 #include <asterisk.h>
 #include <asterisk/astobj2.h>
@@ -6,15 +7,18 @@
 #include <asterisk/network.h>
 
 #include "sccp_config.h"
+#include "sccp_device.h"
+#include "sccp_device_registry.h"
 #include "sccp_queue.h"
+#include "sccp_reactor.h"
 #include "sccp_server.h"
 #include "sccp_session.h"
 #include "sccp_utils.h"
 
 #define SERVER_PORT 2000
-#define SERVER_BACKLOG 50
 
 static void *server_run(void *data);
+static void *listener_run(void *data);
 
 enum server_state {
 	STATE_CREATED,
@@ -23,31 +27,50 @@ enum server_state {
 
 struct sccp_server {
 	enum server_state state;
-	int sockfd;
 	int stop;
+	/* eventfd signaled to stop the listener threads */
+	int stop_fd;
 
 	pthread_t thread;
 
 	struct sccp_cfg *cfg;
 	struct sccp_device_registry *registry;
+	struct sccp_admission *admission;
 	struct sccp_sync_queue *sync_q;
+	struct sccp_reactor **reactors;
+	size_t reactor_count;
+	struct server_listener *listeners;
+	size_t listener_count;
 	AST_LIST_HEAD_NOLOCK(, server_session) srv_sessions;
 };
 
+struct server_listener {
+	struct sccp_server *server;
+	int sockfd;
+	pthread_t thread;
+	/* non-zero while accept is failing for lack of resources */
+	int accept_failing;
+};
+
 struct server_session {
 	AST_LIST_ENTRY(server_session) list;
 	struct sccp_server *server;
 	struct sccp_session *session;
-	pthread_t thread;
 };
 
 enum server_msg_id {
+	MSG_NEW_CONNECTION,
 	MSG_RELOAD_CONFIG,
 	MSG_RELOAD_DEBUG,
 	MSG_SESSION_END,
 	MSG_STOP,
 };
 
+struct server_msg_new_connection {
+	struct sockaddr_in addr;
+	int sockfd;
+};
+
 struct server_msg_reload_config {
 	struct sccp_cfg *cfg;
 };
@@ -57,6 +80,7 @@ struct server_msg_session_end {
 };
 
 union server_msg_data {
+	struct server_msg_new_connection new_connection;
 	struct server_msg_reload_config reload_config;
 	struct server_msg_session_end session_end;
 };
@@ -90,6 +114,13 @@ static void server_session_destroy(struct server_session *srv_session)
 	ast_free(srv_session);
 }
 
+static void server_msg_init_new_connection(struct server_msg *msg, int sockfd, struct sockaddr_in *addr)
+{
+	msg->id = MSG_NEW_CONNECTION;
+	msg->data.new_connection.sockfd = sockfd;
+	msg->data.new_connection.addr = *addr;
+}
+
 static void server_msg_init_reload_config(struct server_msg *msg, struct sccp_cfg *cfg)
 {
 	msg->id = MSG_RELOAD_CONFIG;
@@ -116,6 +147,11 @@ static void server_msg_init_stop(struct server_msg *msg)
 static void server_msg_destroy(struct server_msg *msg)
 {
 	switch (msg->id) {
+	case MSG_NEW_CONNECTION:
+		if (msg->data.new_connection.sockfd != -1) {
+			close(msg->data.new_connection.sockfd);
+		}
+		break;
 	case MSG_RELOAD_CONFIG:
 		ao2_ref(msg->data.reload_config.cfg, -1);
 		break;
@@ -156,6 +192,15 @@ static int server_queue_msg(struct sccp_server *server, struct server_msg *msg)
 	return ret;
 }
 
+static int server_queue_msg_new_connection(struct sccp_server *server, int sockfd, struct sockaddr_in *addr)
+{
+	struct server_msg msg;
+
+	server_msg_init_new_connection(&msg, sockfd, addr);
+
+	return server_queue_msg(server, &msg);
+}
+
 static int server_queue_msg_reload_config(struct sccp_server *server, struct sccp_cfg *cfg)
 {
 	struct server_msg msg;
@@ -205,32 +250,78 @@ static int server_join(struct sccp_server *server)
 	return 0;
 }
 
-static void server_stop_sessions(struct sccp_server *server)
+struct reload_device_data {
+	struct sccp_server *server;
+	struct sccp_cfg *cfg;
+	int count;
+};
+
+static void reload_device_by_name(const char *name, void *data)
 {
-	struct server_session *srv_session;
+	struct reload_device_data *reload_data = data;
+	struct sccp_device *device;
 
-	AST_LIST_TRAVERSE(&server->srv_sessions, srv_session, list) {
-		/* if sccp_session_stop returns a failure, then right now, we'll
-		 * have some kind of partial deadlock since there is no hard guarantee that
-		 * the session will eventually stop
-		 */
-		sccp_session_stop(srv_session->session);
+	device = sccp_device_registry_find(reload_data->server->registry, name);
+	if (!device) {
+		return;
 	}
+
+	sccp_session_reload_config(sccp_device_session(device), reload_data->cfg);
+	reload_data->count++;
+	ao2_ref(device, -1);
 }
 
+/*
+ * Only the sessions that are affected by the new config are reloaded, i.e. all of
+ * them if the general config changed, else the sessions without a device and the
+ * sessions of the devices whose config changed.
+ *
+ * The sessions without a device are reloaded before looking up the changed devices
+ * in the registry, so that a device registering concurrently is reloaded either way.
+ */
 static void server_reload_config(struct sccp_server *server, struct sccp_cfg *cfg)
 {
+	struct reload_device_data reload_data = {
+		.server = server,
+		.cfg = cfg,
+		.count = 0,
+	};
 	struct server_session *srv_session;
+	struct sccp_cfg *old_cfg = server->cfg;
+	struct timeval start = ast_tvnow();
+	int reload_all;
+	int ms;
+	size_t i;
 
-	sccp_socket_set_tos(server->sockfd, cfg, server->cfg);
+	for (i = 0; i < server->listener_count; i++) {
+		sccp_socket_set_tos(server->listeners[i].sockfd, cfg, old_cfg);
+	}
 
-	ao2_ref(server->cfg, -1);
 	server->cfg = cfg;
 	ao2_ref(cfg, +1);
 
+	reload_all = sccp_cfg_general_changed(old_cfg, cfg);
+
 	AST_LIST_TRAVERSE(&server->srv_sessions, srv_session, list) {
-		sccp_session_reload_config(srv_session->session, cfg);
+		if (reload_all) {
+			sccp_session_reload_config(srv_session->session, cfg);
+			if (sccp_session_has_device(srv_session->session)) {
+				reload_data.count++;
+			}
+		} else if (!sccp_session_has_device(srv_session->session)) {
+			sccp_session_reload_config(srv_session->session, cfg);
+		}
+	}
+
+	if (!reload_all) {
+		sccp_cfg_diff_devices(old_cfg, cfg, reload_device_by_name, &reload_data);
 	}
+
+	ao2_ref(old_cfg, -1);
+
+	ms = ast_tvdiff_ms(ast_tvnow(), start);
+	sccp_stat_on_reload(reload_data.count, ms);
+	ast_verb(2, "SCCP config reloaded: %d device(s) affected in %d ms\n", reload_data.count, ms);
 }
 
 static void server_reload_debug(struct sccp_server *server)
@@ -252,49 +343,102 @@ static void server_remove_srv_session(struct sccp_server *server, struct server_
 	AST_LIST_REMOVE(&server->srv_sessions, srv_session, list);
 }
 
-static void *session_run(void *data)
+static void on_session_end(struct sccp_session *session, void *data)
 {
 	struct server_session *srv_session = data;
 
-	sccp_session_run(srv_session->session);
-
 	/* don't check the result; not being able to queue the message is normal,
 	 * and it will happen on server destroy
 	 */
 	server_queue_msg_session_end(srv_session->server, srv_session);
+}
 
-	return NULL;
+static struct sccp_reactor *server_select_reactor(struct sccp_server *server)
+{
+	struct sccp_reactor *reactor = server->reactors[0];
+	size_t i;
+
+	for (i = 1; i < server->reactor_count; i++) {
+		if (sccp_reactor_session_count(server->reactors[i]) < sccp_reactor_session_count(reactor)) {
+			reactor = server->reactors[i];
+		}
+	}
+
+	return reactor;
 }
 
 static int start_session(struct server_session *srv_session)
 {
-	int ret;
+	struct sccp_server *server = srv_session->server;
 
-	ret = ast_pthread_create(&srv_session->thread, NULL, session_run, srv_session);
-	if (ret) {
-		ast_log(LOG_ERROR, "server start session failed: pthread create: %s\n", strerror(ret));
-		return -1;
+	return sccp_reactor_add_session(server_select_reactor(server), srv_session->session, on_session_end, srv_session);
+}
+
+static void server_destroy_sessions(struct sccp_server *server)
+{
+	struct server_session *srv_session;
+
+	while ((srv_session = AST_LIST_REMOVE_HEAD(&server->srv_sessions, list))) {
+		server_session_destroy(srv_session);
 	}
+}
 
-	return 0;
+static size_t server_reactor_count(struct sccp_cfg *cfg)
+{
+	long count = cfg->general_cfg->reactor_threads;
+
+	if (!count) {
+		count = sysconf(_SC_NPROCESSORS_ONLN);
+		if (count < 1) {
+			count = 1;
+		}
+	}
+
+	return count;
 }
 
-static void server_join_sessions(struct sccp_server *server)
+static void server_destroy_reactors(struct sccp_server *server)
 {
-	struct server_session *srv_session;
-	int ret;
+	size_t i;
 
-	AST_LIST_TRAVERSE_SAFE_BEGIN(&server->srv_sessions, srv_session, list) {
-		ast_debug(1, "joining session %p thread\n", srv_session->session);
-		ret = pthread_join(srv_session->thread, NULL);
-		if (ret) {
-			ast_log(LOG_ERROR, "server join sessions failed: pthread_join: %s\n", strerror(ret));
+	for (i = 0; i < server->reactor_count; i++) {
+		sccp_reactor_destroy(server->reactors[i]);
+	}
+
+	ast_free(server->reactors);
+	server->reactors = NULL;
+	server->reactor_count = 0;
+}
+
+static int server_create_reactors(struct sccp_server *server)
+{
+	size_t count = server_reactor_count(server->cfg);
+
+	server->reactors = ast_calloc(count, sizeof(*server->reactors));
+	if (!server->reactors) {
+		return -1;
+	}
+
+	for (server->reactor_count = 0; server->reactor_count < count; server->reactor_count++) {
+		server->reactors[server->reactor_count] = sccp_reactor_create(server->reactor_count);
+		if (!server->reactors[server->reactor_count]) {
+			goto error;
 		}
 
-		AST_LIST_REMOVE_CURRENT(list);
-		server_session_destroy(srv_session);
+		if (sccp_reactor_start(server->reactors[server->reactor_count])) {
+			sccp_reactor_destroy(server->reactors[server->reactor_count]);
+			goto error;
+		}
 	}
-	AST_LIST_TRAVERSE_SAFE_END;
+
+	ast_verb(4, "SCCP server started %zu reactor threads\n", server->reactor_count);
+
+	return 0;
+
+error:
+	server_destroy_reactors(server);
+
+	return -1;
 }
 
 static int new_server_socket(struct sccp_cfg *cfg)
@@ -303,7 +447,7 @@ static int new_server_socket(struct sccp_cfg *cfg)
 	int sockfd;
 	int flag_reuse = 1;
 
-	sockfd = socket(AF_INET, SOCK_STREAM, 0);
+	sockfd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
 	if (sockfd == -1) {
 		ast_log(LOG_ERROR, "server new socket failed: socket: %s\n", strerror(errno));
 		return -1;
@@ -313,6 +457,17 @@ static int new_server_socket(struct sccp_cfg *cfg)
 		ast_log(LOG_ERROR, "server new socket error: setsockopt REUSEADDR: %s\n", strerror(errno));
 	}
 
+	/* each listener has its own socket bound to the same port, and the kernel
+	 * distributes the incoming connections between them
+	 */
+	if (cfg->general_cfg->listeners > 1) {
+		if (setsockopt(sockfd, SOL_SOCKET, SO_REUSEPORT, &flag_reuse, sizeof(flag_reuse)) == -1) {
+			ast_log(LOG_ERROR, "server new socket failed: setsockopt REUSEPORT: %s\n", strerror(errno));
+			close(sockfd);
+			return -1;
+		}
+	}
+
 	sccp_socket_set_tos(sockfd, cfg, NULL);
 
 	memset(&addr, 0, sizeof(addr));
@@ -325,40 +480,176 @@ static int new_server_socket(struct sccp_cfg *cfg)
 		return -1;
 	}
 
+	if (listen(sockfd, cfg->general_cfg->listen_backlog) == -1) {
+		ast_log(LOG_ERROR, "server new socket failed: listen: %s\n", strerror(errno));
+		close(sockfd);
+		return -1;
+	}
+
 	return sockfd;
 }
 
+static void server_join_listeners(struct sccp_server *server, size_t count)
+{
+	size_t i;
+	int ret;
+
+	for (i = 0; i < count; i++) {
+		ret = pthread_join(server->listeners[i].thread, NULL);
+		if (ret) {
+			ast_log(LOG_ERROR, "server join listeners failed: pthread_join: %s\n", strerror(ret));
+		}
+	}
+}
+
+static void server_signal_listeners(struct sccp_server *server)
+{
+	uint64_t val = 1;
+
+	/* the eventfd is never read, so it wakes up every listener thread */
+	if (write(server->stop_fd, &val, sizeof(val)) == -1) {
+		ast_log(LOG_ERROR, "server signal listeners failed: write: %s\n", strerror(errno));
+	}
+}
+
+static void server_stop_listeners(struct sccp_server *server)
+{
+	server_signal_listeners(server);
+	server_join_listeners(server, server->listener_count);
+}
+
+static void server_destroy_listeners(struct sccp_server *server)
+{
+	size_t i;
+
+	for (i = 0; i < server->listener_count; i++) {
+		close(server->listeners[i].sockfd);
+	}
+
+	ast_free(server->listeners);
+	server->listeners = NULL;
+	server->listener_count = 0;
+}
+
+static int server_create_listeners(struct sccp_server *server)
+{
+	struct server_listener *listener;
+	size_t count = server->cfg->general_cfg->listeners;
+
+	server->listeners = ast_calloc(count, sizeof(*server->listeners));
+	if (!server->listeners) {
+		return -1;
+	}
+
+	for (server->listener_count = 0; server->listener_count < count; server->listener_count++) {
+		listener = &server->listeners[server->listener_count];
+		listener->server = server;
+		listener->sockfd = new_server_socket(server->cfg);
+		if (listener->sockfd == -1) {
+			server_destroy_listeners(server);
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+static int server_start_listeners(struct sccp_server *server)
+{
+	size_t i;
+	int ret;
+
+	for (i = 0; i < server->listener_count; i++) {
+		ret = ast_pthread_create_background(&server->listeners[i].thread, NULL, listener_run, &server->listeners[i]);
+		if (ret) {
+			ast_log(LOG_ERROR, "server start listeners failed: pthread create: %s\n", strerror(ret));
+			goto error;
+		}
+	}
+
+	return 0;
+
+error:
+	server_signal_listeners(server);
+	server_join_listeners(server, i);
+
+	return -1;
+}
+
 static int server_start(struct sccp_server *server)
 {
 	int ret;
 
-	server->sockfd = new_server_socket(server->cfg);
-	if (server->sockfd == -1) {
+	server->stop_fd = eventfd(0, EFD_CLOEXEC);
+	if (server->stop_fd == -1) {
+		ast_log(LOG_ERROR, "server start failed: eventfd: %s\n", strerror(errno));
 		return -1;
 	}
 
+	if (server_create_listeners(server)) {
+		goto error_listeners;
+	}
+
+	if (server_create_reactors(server)) {
+		goto error_reactors;
+	}
+
 	ret = ast_pthread_create_background(&server->thread, NULL, server_run, server);
 	if (ret) {
 		ast_log(LOG_ERROR, "server start failed: pthread create: %s\n", strerror(ret));
-		close(server->sockfd);
-		return -1;
+		goto error_thread;
+	}
+
+	if (server_start_listeners(server)) {
+		server_queue_msg_stop(server);
+		server_join(server);
+		goto error_thread;
 	}
 
 	server->state = STATE_STARTED;
 
 	return 0;
+
+error_thread:
+	server_destroy_reactors(server);
+error_reactors:
+	server_destroy_listeners(server);
+error_listeners:
+	close(server->stop_fd);
+
+	return -1;
 }
 
-static void server_on_session_end(struct sccp_server *server, struct server_session *srv_session)
+static void server_on_new_connection(struct sccp_server *server, struct server_msg_new_connection *msg)
 {
-	int ret;
+	struct sccp_session *session;
+	struct server_session *srv_session;
 
-	ast_debug(1, "joining session %p thread\n", srv_session->session);
-	ret = pthread_join(srv_session->thread, NULL);
-	if (ret) {
-		ast_log(LOG_ERROR, "server on session end failed: pthread_join: %s\n", strerror(ret));
+	session = sccp_session_create(server->cfg, server->registry, server->admission, &msg->addr, msg->sockfd);
+	if (!session) {
+		return;
+	}
+
+	/* the session now owns the socket */
+	msg->sockfd = -1;
+
+	/* on success, the srv_session will own the session reference */
+	srv_session = server_session_create(session, server);
+	if (!srv_session) {
+		ao2_ref(session, -1);
+		return;
 	}
 
+	server_add_srv_session(server, srv_session);
+	if (start_session(srv_session)) {
+		server_remove_srv_session(server, srv_session);
+		server_session_destroy(srv_session);
+		return;
+	}
+}
+
+static void server_on_session_end(struct sccp_server *server, struct server_session *srv_session)
+{
 	server_remove_srv_session(server, srv_session);
 	server_session_destroy(srv_session);
 }
@@ -366,6 +657,9 @@ static void server_on_session_end(struct sccp_server *server, struct server_sess
 static void server_process_msg(struct sccp_server *server, struct server_msg *msg)
 {
 	switch (msg->id) {
+	case MSG_NEW_CONNECTION:
+		server_on_new_connection(server, &msg->data.new_connection);
+		break;
 	case MSG_RELOAD_CONFIG:
 		server_reload_config(server, msg->data.reload_config.cfg);
 		break;
@@ -403,67 +697,125 @@ static void server_on_queue_events(struct sccp_server *server, int events)
 	}
 }
 
-static void server_on_sock_events(struct sccp_server *server, int events)
+/*
+ * On a listening socket, tcpi_unacked is the current length of the accept queue
+ * and tcpi_sacked is its maximum length (i.e. the backlog).
+ */
+static void listener_check_queue_full(struct server_listener *listener)
+{
+	struct tcp_info info;
+	socklen_t len = sizeof(info);
+
+	if (getsockopt(listener->sockfd, IPPROTO_TCP, TCP_INFO, &info, &len) == -1) {
+		return;
+	}
+
+	if (info.tcpi_unacked >= info.tcpi_sacked) {
+		sccp_stat_on_accept_queue_full();
+	}
+}
+
+/*
+ * Accept all the pending connections, until the accept queue is empty.
+ */
+static int listener_drain(struct server_listener *listener)
 {
 	struct sockaddr_in addr;
-	struct sccp_session *session;
-	struct server_session *srv_session;
 	socklen_t addrlen;
 	int sockfd;
 
-	if (events & POLLIN) {
+	listener_check_queue_full(listener);
+
+	for (;;) {
 		addrlen = sizeof(addr);
-		sockfd = accept(server->sockfd, (struct sockaddr *) &addr, &addrlen);
+		sockfd = accept4(listener->sockfd, (struct sockaddr *) &addr, &addrlen, SOCK_CLOEXEC);
 		if (sockfd == -1) {
-			ast_log(LOG_ERROR, "server on sock events failed: accept: %s\n", strerror(errno));
-			server->stop = 1;
-			return;
+			switch (errno) {
+			case EAGAIN:
+				return 0;
+			case EINTR:
+			case ECONNABORTED:
+				continue;
+			case EMFILE:
+			case ENFILE:
+			case ENOBUFS:
+			case ENOMEM:
+				/* back off a little; the connection stays in the accept queue */
+				if (!listener->accept_failing) {
+					ast_log(LOG_WARNING, "listener drain error: accept: %s\n", strerror(errno));
+					listener->accept_failing = 1;
+				}
+
+				usleep(100000);
+				return 0;
+			default:
+				ast_log(LOG_ERROR, "listener drain failed: accept: %s\n", strerror(errno));
+				return -1;
+			}
+		}
+
+		if (listener->accept_failing) {
+			ast_log(LOG_NOTICE, "listener accepting connections again\n");
+			listener->accept_failing = 0;
 		}
 
 		ast_verb(4, "New SCCP connection from %s:%d accepted\n", ast_inet_ntoa(addr.sin_addr), ntohs(addr.sin_port));
 
-		session = sccp_session_create(server->cfg, server->registry, &addr, sockfd);
-		if (!session) {
-			close(sockfd);
-			return;
+		if (server_queue_msg_new_connection(listener->server, sockfd, &addr)) {
+			return -1;
 		}
+	}
+}
+
+static void *listener_run(void *data)
+{
+	struct server_listener *listener = data;
+	struct pollfd fds[2];
+	int nfds;
+
+	fds[0].fd = listener->sockfd;
+	fds[0].events = POLLIN;
+	fds[1].fd = listener->server->stop_fd;
+	fds[1].events = POLLIN;
 
-		/* on success, the srv_session will own the session reference */
-		srv_session = server_session_create(session, server);
-		if (!srv_session) {
-			ao2_ref(session, -1);
-			return;
+	for (;;) {
+		nfds = poll(fds, ARRAY_LEN(fds), -1);
+		if (nfds == -1) {
+			if (errno == EINTR) {
+				continue;
+			}
+
+			ast_log(LOG_ERROR, "listener run failed: poll: %s\n", strerror(errno));
+			break;
 		}
 
-		server_add_srv_session(server, srv_session);
-		if (start_session(srv_session)) {
-			server_remove_srv_session(server, srv_session);
-			server_session_destroy(srv_session);
-			return;
+		if (fds[1].revents) {
+			break;
 		}
-	}
 
-	if (events & ~POLLIN) {
-		ast_log(LOG_WARNING, "server on sock events failed: unexpected event 0x%X\n", events);
-		server->stop = 1;
+		if (fds[0].revents & POLLIN) {
+			if (listener_drain(listener)) {
+				break;
+			}
+		}
+
+		if (fds[0].revents & ~POLLIN) {
+			ast_log(LOG_WARNING, "listener run failed: unexpected event 0x%X\n", fds[0].revents);
+			break;
+		}
 	}
+
+	return NULL;
 }
 
 static void *server_run(void *data)
 {
 	struct sccp_server *server = data;
-	struct pollfd fds[2];
+	struct pollfd fds[1];
 	int nfds;
 
-	if (listen(server->sockfd, SERVER_BACKLOG) == -1) {
-		ast_log(LOG_ERROR, "server run failed: listen: %s\n", strerror(errno));
-		goto end;
-	}
-
-	fds[0].fd = server->sockfd;
+	fds[0].fd = sccp_sync_queue_fd(server->sync_q);
 	fds[0].events = POLLIN;
-	fds[1].fd = sccp_sync_queue_fd(server->sync_q);
-	fds[1].events = POLLIN;
 
 	server->stop = 0;
 	for (;;) {
@@ -473,15 +825,8 @@ static void *server_run(void *data)
 			goto end;
 		}
 
-		if (fds[1].revents) {
-			server_on_queue_events(server, fds[1].revents);
-			if (server->stop) {
-				goto end;
-			}
-		}
-
 		if (fds[0].revents) {
-			server_on_sock_events(server, fds[0].revents);
+			server_on_queue_events(server, fds[0].revents);
 			if (server->stop) {
 				goto end;
 			}
@@ -489,14 +834,13 @@ static void *server_run(void *data)
 	}
 
 end:
-	close(server->sockfd);
 	server_close_queue(server);
 	server_empty_queue(server);
 
 	return NULL;
 }
 
-struct sccp_server *sccp_server_create(struct sccp_cfg *cfg, struct sccp_device_registry *registry)
+struct sccp_server *sccp_server_create(struct sccp_cfg *cfg, struct sccp_device_registry *registry, struct sccp_admission *admission)
 {
 	struct sccp_server *server;
 
@@ -510,12 +854,17 @@ struct sccp_server *sccp_server_create(struct sccp_cfg *cfg, struct sccp_device_
 		return NULL;
 	}
 
+	if (!admission) {
+		ast_log(LOG_ERROR, "sccp server create failed: admission is null\n");
+		return NULL;
+	}
+
 	server = ast_calloc(1, sizeof(*server));
 	if (!server) {
 		return NULL;
 	}
 
-	server->sync_q = sccp_sync_queue_create(sizeof(struct server_msg));
+	server->sync_q = sccp_sync_queue_create("server", sizeof(struct server_msg), 0);
 	if (!server->sync_q) {
 		ast_free(server);
 		return NULL;
@@ -525,6 +874,7 @@ struct sccp_server *sccp_server_create(struct sccp_cfg *cfg, struct sccp_device_
 	server->cfg = cfg;
 	ao2_ref(cfg, +1);
 	server->registry = registry;
+	server->admission = admission;
 	AST_LIST_HEAD_INIT_NOLOCK(&server->srv_sessions);
 
 	return server;
@@ -533,13 +883,20 @@ struct sccp_server *sccp_server_create(struct sccp_cfg *cfg, struct sccp_device_
 void sccp_server_destroy(struct sccp_server *server)
 {
 	if (server->state == STATE_STARTED) {
+		/* stop accepting new connections first */
+		server_stop_listeners(server);
+
 		if (server_queue_msg_stop(server)) {
 			ast_log(LOG_WARNING, "sccp server destroy error: could not ask server to stop\n");
 		}
 
 		server_join(server);
-		server_stop_sessions(server);
-		server_join_sessions(server);
+
+		/* destroying the reactors ends all the sessions they are running */
+		server_destroy_reactors(server);
+		server_destroy_sessions(server);
+		server_destroy_listeners(server);
+		close(server->stop_fd);
 	}
 
 	sccp_sync_queue_destroy(server->sync_q);
@@ -1,6 +1,7 @@
 #ifndef SCCP_SERVER_H_
 #define SCCP_SERVER_H_
 
+struct sccp_admission;
 struct sccp_cfg;
 struct sccp_device;
 struct sccp_device_registry;
@@ -12,7 +13,7 @@ struct sccp_server;
  * \retval non-NULL on success
  * \retval NULL on failure
  */
-struct sccp_server *sccp_server_create(struct sccp_cfg *cfg, struct sccp_device_registry *registry);
+struct sccp_server *sccp_server_create(struct sccp_cfg *cfg, struct sccp_device_registry *registry, struct sccp_admission *admission);
 
 /*!
  * \brief Destroy the server.
@@ -1,10 +1,14 @@
 #include <errno.h>
+#include <fcntl.h>
+#include <sys/param.h>
+#include <sys/uio.h>
 
 #include <asterisk.h>
 #include <asterisk/astobj2.h>
 #include <asterisk/network.h>
 #include <asterisk/utils.h>
 
+#include "sccp_admission.h"
 #include "sccp_debug.h"
 #include "sccp_config.h"
 #include "sccp_device.h"
@@ -15,7 +19,33 @@
 #include "sccp_task.h"
 #include "sccp_utils.h"
 
+#define OUTBUF_MIN_SIZE 4096
+
 static void sccp_session_empty_queue(struct sccp_session *session);
+static int sccp_session_transmit(struct sccp_session *session, const char *data, size_t count);
+
+/*
+ * Ring buffer of the bytes that have not been written to the socket yet.
+ *
+ * While the outbuf is corked, the messages are accumulated and are written all at
+ * once when it is uncorked. When the socket can't accept all the bytes, the outbuf
+ * becomes congested and the remaining bytes are written when the socket becomes
+ * writable.
+ *
+ * The buffer is allocated only when needed, and a grown buffer is freed once it
+ * has been flushed.
+ */
+struct session_outbuf {
+	ast_mutex_t lock;
+	char *buf;
+	size_t size;
+	size_t start;
+	size_t len;
+	/* maximum number of pending bytes before the peer is disconnected */
+	size_t max;
+	int corked;
+	int congested;
+};
 
 struct sccp_session {
 	struct sccp_deserializer deserializer;
@@ -24,32 +54,57 @@ struct sccp_session {
 	int stop;
 	int remote_port;
 	int debug;
-
+	int register_deferred;
+	/* monotonic time of the last read on the socket */
+	time_t last_activity;
+	/* bitmask of the IDs of the messages in the queue */
+	int pending_msgs;
+	/* newest config to reload, while a MSG_RELOAD_CONFIG is pending */
+	struct sccp_cfg *pending_cfg;
+	/* non-zero while session->device is set, accessed atomically from other threads */
+	int has_device;
+
+	/* only used until a device is registered, then released (NULL), so that a session
+	 * whose device is not affected by a reload doesn't keep the old config alive
+	 */
 	struct sccp_cfg *cfg;
 	struct sccp_device_registry *registry;
+	struct sccp_admission *admission;
 	struct sccp_sync_queue *sync_q;
 	struct sccp_task_runner *task_runner;
 	struct sccp_device *device;
 
+	struct session_outbuf outbuf;
+
+	/* copy of the register message, while the registration is deferred */
+	struct register_message deferred_reg;
+
 	char remote_addr_ch[INET_ADDRSTRLEN];
 };
 
+/* serialized KEEP_ALIVE_ACK_MESSAGE */
+static const char keep_alive_ack[SCCP_MSG_MIN_TOTAL_LEN] = {
+	0x04, 0x00, 0x00, 0x00,
+	0x00, 0x00, 0x00, 0x00,
+	0x00, 0x01, 0x00, 0x00,
+};
+
+/*
+ * The session messages are coalesced: a message is not queued if a message with
+ * the same ID is already pending, so the queue never holds more than one message
+ * of each ID.
+ */
 enum session_msg_id {
 	MSG_NOOP,
 	MSG_RELOAD_CONFIG,
 	MSG_RELOAD_DEBUG,
+	MSG_BLF_UPDATE,
+	MSG_MWI_UPDATE,
 };
 
-struct session_msg_reload {
-	struct sccp_cfg *cfg;
-};
-
-union session_msg_data {
-	struct session_msg_reload reload;
-};
+#define SESSION_QUEUE_CAPACITY 8
 
 struct session_msg {
-	union session_msg_data data;
 	enum session_msg_id id;
 };
 
@@ -67,11 +122,9 @@ static void session_msg_init_noop(struct session_msg *msg)
 	msg->id = MSG_NOOP;
 }
 
-static void session_msg_init_reload_config(struct session_msg *msg, struct sccp_cfg *cfg)
+static void session_msg_init_reload_config(struct session_msg *msg)
 {
 	msg->id = MSG_RELOAD_CONFIG;
-	msg->data.reload.cfg = cfg;
-	ao2_ref(cfg, +1);
 }
 
 static void session_msg_init_reload_debug(struct session_msg *msg)
@@ -79,18 +132,176 @@ static void session_msg_init_reload_debug(struct session_msg *msg)
 	msg->id = MSG_RELOAD_DEBUG;
 }
 
+static void session_msg_init_blf_update(struct session_msg *msg)
+{
+	msg->id = MSG_BLF_UPDATE;
+}
+
+static void session_msg_init_mwi_update(struct session_msg *msg)
+{
+	msg->id = MSG_MWI_UPDATE;
+}
+
 static void session_msg_destroy(struct session_msg *msg)
 {
 	switch (msg->id) {
 	case MSG_RELOAD_CONFIG:
-		ao2_ref(msg->data.reload.cfg, -1);
-		break;
 	case MSG_RELOAD_DEBUG:
+	case MSG_BLF_UPDATE:
+	case MSG_MWI_UPDATE:
 	case MSG_NOOP:
 		break;
 	}
 }
 
+static void outbuf_init(struct session_outbuf *outbuf, size_t max)
+{
+	ast_mutex_init(&outbuf->lock);
+	outbuf->buf = NULL;
+	outbuf->size = 0;
+	outbuf->start = 0;
+	outbuf->len = 0;
+	outbuf->max = max;
+	outbuf->corked = 0;
+	outbuf->congested = 0;
+}
+
+static void outbuf_destroy(struct session_outbuf *outbuf)
+{
+	ast_free(outbuf->buf);
+	ast_mutex_destroy(&outbuf->lock);
+}
+
+static void outbuf_clear(struct session_outbuf *outbuf)
+{
+	/* keep the initial buffer around, since it will most likely be reused soon */
+	if (outbuf->size > OUTBUF_MIN_SIZE) {
+		ast_free(outbuf->buf);
+		outbuf->buf = NULL;
+		outbuf->size = 0;
+	}
+
+	outbuf->start = 0;
+	outbuf->len = 0;
+	outbuf->congested = 0;
+}
+
+static int outbuf_grow(struct session_outbuf *outbuf, size_t needed)
+{
+	size_t new_size;
+	size_t first;
+	char *buf;
+
+	new_size = outbuf->size ? outbuf->size * 2 : OUTBUF_MIN_SIZE;
+	while (new_size < needed) {
+		new_size *= 2;
+	}
+
+	if (new_size > outbuf->max) {
+		new_size = outbuf->max;
+	}
+
+	buf = ast_malloc(new_size);
+	if (!buf) {
+		return -1;
+	}
+
+	/* linearize the pending bytes at the start of the new buffer */
+	if (outbuf->len) {
+		first = MIN(outbuf->len, outbuf->size - outbuf->start);
+		memcpy(buf, outbuf->buf + outbuf->start, first);
+		memcpy(buf + first, outbuf->buf, outbuf->len - first);
+	}
+
+	ast_free(outbuf->buf);
+	outbuf->buf = buf;
+	outbuf->size = new_size;
+	outbuf->start = 0;
+
+	return 0;
+}
+
+static int outbuf_append(struct session_outbuf *outbuf, const char *data, size_t count)
+{
+	size_t needed = outbuf->len + count;
+	size_t end;
+	size_t first;
+
+	if (needed > outbuf->max) {
+		return -1;
+	}
+
+	if (needed > outbuf->size && outbuf_grow(outbuf, needed)) {
+		return -1;
+	}
+
+	end = (outbuf->start + outbuf->len) % outbuf->size;
+	first = MIN(count, outbuf->size - end);
+	memcpy(outbuf->buf + end, data, first);
+	memcpy(outbuf->buf, data + first, count - first);
+	outbuf->len += count;
+
+	return 0;
+}
+
+/*
+ * Write as many pending bytes as possible to the socket.
+ */
+static int outbuf_flush(struct session_outbuf *outbuf, int sockfd)
+{
+	struct iovec iov[2];
+	size_t first;
+	ssize_t n;
+
+	while (outbuf->len) {
+		first = MIN(outbuf->len, outbuf->size - outbuf->start);
+		iov[0].iov_base = outbuf->buf + outbuf->start;
+		iov[0].iov_len = first;
+		iov[1].iov_base = outbuf->buf;
+		iov[1].iov_len = outbuf->len - first;
+
+		n = writev(sockfd, iov, iov[1].iov_len ? 2 : 1);
+		if (n == -1) {
+			if (errno == EAGAIN) {
+				return 0;
+			} else if (errno == EINTR) {
+				continue;
+			}
+
+			ast_log(LOG_WARNING, "session outbuf flush failed: writev: %s\n", strerror(errno));
+			return -1;
+		}
+
+		outbuf->start = (outbuf->start + n) % outbuf->size;
+		outbuf->len -= n;
+	}
+
+	outbuf_clear(outbuf);
+
+	return 0;
+}
+
+/*
+ * Write as many pending bytes as possible to the socket, and mark the outbuf as
+ * congested if some bytes are still pending.
+ *
+ * Return 1 if the outbuf has just become congested, 0 if not, and -1 on failure.
+ */
+static int outbuf_try_flush(struct session_outbuf *outbuf, int sockfd)
+{
+	if (outbuf_flush(outbuf, sockfd)) {
+		return -1;
+	}
+
+	if (!outbuf->len || outbuf->congested) {
+		return 0;
+	}
+
+	outbuf->congested = 1;
+
+	return 1;
+}
+
 /* important to zero out the data memory since sccp_task does a byte level
  * compare to see if two task are equal
  */
@@ -107,7 +318,7 @@ static void sccp_session_destructor(void *data)
 		/*
 		 * This is theoretically impossible, because that would mean:
 		 *
-		 * - if session->device, then the session is running its session thread
+		 * - if session->device, then the session has not been ended by its reactor
 		 * - which would imply that there's still a reference to the session
 		 * - which would imply that this function is never called
 		 */
@@ -121,7 +332,13 @@ static void sccp_session_destructor(void *data)
 	sccp_session_empty_queue(session);
 	sccp_sync_queue_destroy(session->sync_q);
 	sccp_task_runner_destroy(session->task_runner);
-	ao2_ref(session->cfg, -1);
+	if (session->pending_cfg) {
+		ao2_ref(session->pending_cfg, -1);
+	}
+
+	outbuf_destroy(&session->outbuf);
+	sccp_deserializer_destroy(&session->deserializer);
+	ao2_cleanup(session->cfg);
 }
 
 static int get_sock_local_addr(int sockfd, struct sockaddr_in *addr)
@@ -139,7 +356,7 @@ static int get_sock_local_addr(int sockfd, struct sockaddr_in *addr)
 static int set_sock_options(int sockfd)
 {
 	int flag_nodelay = 1;
-	struct timeval flag_timeout = { .tv_sec = 10, .tv_usec = 0 };
+	int flags;
 
 	if (setsockopt(sockfd, IPPROTO_TCP, TCP_NODELAY, &flag_nodelay, sizeof(flag_nodelay)) == -1) {
 		ast_log(LOG_ERROR, "set session sock option failed: setsockopt: %s\n", strerror(errno));
@@ -147,15 +364,13 @@ static int set_sock_options(int sockfd)
 	}
 
 	/*
-	 * Setting a send timeout is a must in our case because currently we are doing blocking send.
-	 *
-	 * This means that, without a timeout, it could stay in send for a long time, which means the
-	 * thread session wouldn't read it's alert pipe, and it could take a lot of time before asking
-	 * a session to stop and the session thread exiting, which would then create some partial deadlock
-	 * condition when closing all sessions, etc.
+	 * The socket is non-blocking, so that a peer with a stalled TCP window can't block the
+	 * reactor thread or a thread holding the device lock. The bytes that can't be written right
+	 * away are kept in the session outbuf and flushed when the socket becomes writable.
 	 */
-	if (setsockopt(sockfd, SOL_SOCKET, SO_SNDTIMEO, &flag_timeout, sizeof(flag_timeout)) == -1) {
-		ast_log(LOG_ERROR, "set session sock option failed: setsockopt: %s\n", strerror(errno));
+	flags = fcntl(sockfd, F_GETFL);
+	if (flags == -1 || fcntl(sockfd, F_SETFL, flags | O_NONBLOCK) == -1) {
+		ast_log(LOG_ERROR, "set session sock option failed: fcntl: %s\n", strerror(errno));
 		return -1;
 	}
 
@@ -173,12 +388,13 @@ static void sccp_session_update_debug(struct sccp_session *session)
 	session->debug = sccp_debug_enabled(device_name, session->remote_addr_ch);
 }
 
-struct sccp_session *sccp_session_create(struct sccp_cfg *cfg, struct sccp_device_registry *registry, struct sockaddr_in *addr, int sockfd)
+struct sccp_session *sccp_session_create(struct sccp_cfg *cfg, struct sccp_device_registry *registry, struct sccp_admission *admission, struct sockaddr_in *addr, int sockfd)
 {
 	struct sockaddr_in local_addr;
 	struct sccp_sync_queue *sync_q;
 	struct sccp_task_runner *task_runner;
 	struct sccp_session *session;
+	char name[48];
 
 	if (!cfg) {
 		ast_log(LOG_ERROR, "sccp session create failed: cfg is null\n");
@@ -190,6 +406,11 @@ struct sccp_session *sccp_session_create(struct sccp_cfg *cfg, struct sccp_devic
 		return NULL;
 	}
 
+	if (!admission) {
+		ast_log(LOG_ERROR, "sccp session create failed: admission is null\n");
+		return NULL;
+	}
+
 	if (!addr) {
 		ast_log(LOG_ERROR, "sccp session create failed: addr is null\n");
 		return NULL;
@@ -203,7 +424,8 @@ struct sccp_session *sccp_session_create(struct sccp_cfg *cfg, struct sccp_devic
 		return NULL;
 	}
 
-	sync_q = sccp_sync_queue_create(sizeof(struct session_msg));
+	snprintf(name, sizeof(name), "session %s:%d", ast_inet_ntoa(addr->sin_addr), ntohs(addr->sin_port));
+	sync_q = sccp_sync_queue_create(name, sizeof(struct session_msg), SESSION_QUEUE_CAPACITY);
 	if (!sync_q) {
 		return NULL;
 	}
@@ -228,10 +450,17 @@ struct sccp_session *sccp_session_create(struct sccp_cfg *cfg, struct sccp_devic
 	session->task_runner = task_runner;
 	session->stop = 0;
 	session->debug = 0;
+	session->register_deferred = 0;
+	session->last_activity = sccp_monotonic_coarse();
+	session->pending_msgs = 0;
+	session->pending_cfg = NULL;
+	session->has_device = 0;
 	session->device = NULL;
+	outbuf_init(&session->outbuf, cfg->general_cfg->send_buffer_max);
 	session->cfg = cfg;
 	ao2_ref(cfg, +1);
 	session->registry = registry;
+	session->admission = admission;
 	session->remote_port = ntohs(addr->sin_port);
 	ast_copy_string(session->remote_addr_ch, ast_inet_ntoa(addr->sin_addr), sizeof(session->remote_addr_ch));
 
@@ -260,16 +489,33 @@ static void sccp_session_empty_queue(struct sccp_session *session)
 
 static int sccp_session_queue_msg(struct sccp_session *session, struct session_msg *msg)
 {
+	int bit = 1 << msg->id;
 	int ret;
 
+	if (__atomic_fetch_or(&session->pending_msgs, bit, __ATOMIC_SEQ_CST) & bit) {
+		/* coalesced with the pending message */
+		session_msg_destroy(msg);
+		return 0;
+	}
+
 	ret = sccp_sync_queue_put(session->sync_q, msg);
 	if (ret) {
+		__atomic_and_fetch(&session->pending_msgs, ~bit, __ATOMIC_SEQ_CST);
 		session_msg_destroy(msg);
 	}
 
 	return ret;
 }
 
+/*
+ * Clear the pending flag of the message, so that a new message with the same ID
+ * can be queued while this one is being processed.
+ */
+static void sccp_session_unpend_msg(struct sccp_session *session, struct session_msg *msg)
+{
+	__atomic_and_fetch(&session->pending_msgs, ~(1 << msg->id), __ATOMIC_SEQ_CST);
+}
+
 static int sccp_session_queue_msg_noop(struct sccp_session *session)
 {
 	struct session_msg msg;
@@ -282,8 +528,16 @@ static int sccp_session_queue_msg_noop(struct sccp_session *session)
 static int sccp_session_queue_msg_reload_config(struct sccp_session *session, struct sccp_cfg *cfg)
 {
 	struct session_msg msg;
+	struct sccp_cfg *old_cfg;
 
-	session_msg_init_reload_config(&msg, cfg);
+	/* only the newest config is kept */
+	ao2_ref(cfg, +1);
+	old_cfg = __atomic_exchange_n(&session->pending_cfg, cfg, __ATOMIC_SEQ_CST);
+	if (old_cfg) {
+		ao2_ref(old_cfg, -1);
+	}
+
+	session_msg_init_reload_config(&msg);
 
 	return sccp_session_queue_msg(session, &msg);
 }
@@ -304,13 +558,13 @@ static void on_auth_timeout(struct sccp_session *session, void __attribute__((un
 	session->stop = 1;
 }
 
-static int add_auth_timeout_task(struct sccp_session *session)
+static int add_auth_timeout_task(struct sccp_session *session, int extra_ms)
 {
 	union session_task_data task_data;
 
 	session_task_zero(&task_data);
 
-	return sccp_task_runner_add(session->task_runner, on_auth_timeout, &task_data, session->cfg->general_cfg->authtimeout);
+	return sccp_task_runner_add_ms(session->task_runner, on_auth_timeout, &task_data, session->cfg->general_cfg->authtimeout * 1000 + extra_ms);
 }
 
 static void remove_auth_timeout_task(struct sccp_session *session)
@@ -328,11 +582,14 @@ static void process_reload_config(struct sccp_session *session, struct sccp_cfg
 
 	sccp_socket_set_tos(session->sockfd, cfg, session->cfg);
 
-	ao2_ref(session->cfg, -1);
-	session->cfg = cfg;
-	ao2_ref(cfg, +1);
+	ast_mutex_lock(&session->outbuf.lock);
+	session->outbuf.max = cfg->general_cfg->send_buffer_max;
+	ast_mutex_unlock(&session->outbuf.lock);
 
 	if (!session->device) {
+		ao2_ref(session->cfg, -1);
+		session->cfg = cfg;
+		ao2_ref(cfg, +1);
 		return;
 	}
 
@@ -350,30 +607,50 @@ static void process_reload_config(struct sccp_session *session, struct sccp_cfg
 
 static void sccp_session_process_msg(struct sccp_session *session, struct session_msg *msg)
 {
+	struct sccp_cfg *cfg;
+
+	sccp_session_unpend_msg(session, msg);
+
 	switch (msg->id) {
 	case MSG_NOOP:
 		break;
 	case MSG_RELOAD_CONFIG:
-		process_reload_config(session, msg->data.reload.cfg);
+		cfg = __atomic_exchange_n(&session->pending_cfg, NULL, __ATOMIC_SEQ_CST);
+		if (cfg) {
+			process_reload_config(session, cfg);
+			ao2_ref(cfg, -1);
+		}
 		break;
 	case MSG_RELOAD_DEBUG:
 		sccp_session_update_debug(session);
 		break;
+	case MSG_BLF_UPDATE:
+		if (session->device) {
+			sccp_device_on_blf_update(session->device);
+		}
+		break;
+	case MSG_MWI_UPDATE:
+		if (session->device) {
+			sccp_device_on_mwi_update(session->device);
+		}
+		break;
 	}
 
 	session_msg_destroy(msg);
 }
 
-static void sccp_session_on_queue_events(struct sccp_session *session, int events)
+void sccp_session_on_queue_events(struct sccp_session *session, int events)
 {
 	struct sccp_queue q;
 	struct session_msg msg;
 
 	if (events & POLLIN) {
 		sccp_sync_queue_get_all(session->sync_q, &q);
+		sccp_session_cork(session);
 		while (!sccp_queue_get(&q, &msg)) {
 			sccp_session_process_msg(session, &msg);
 		}
+		sccp_session_uncork(session);
 
 		sccp_queue_destroy(&q);
 	}
@@ -388,10 +665,9 @@ static int sccp_session_read_sock(struct sccp_session *session)
 {
 	switch (sccp_deserializer_read(&session->deserializer)) {
 	case 0:
-		if (session->device) {
-			sccp_device_on_data_read(session->device);
-		}
-
+		session->last_activity = sccp_monotonic_coarse();
+		return 0;
+	case SCCP_DESERIALIZER_NOMSG:
 		return 0;
 	case SCCP_DESERIALIZER_EOF:
 		ast_log(LOG_NOTICE, "Device has closed the connection\n");
@@ -417,7 +693,7 @@ static int sccp_session_transmit_register_rej(struct sccp_session *session)
 	return sccp_session_transmit_msg(session, &msg);
 }
 
-static void sccp_session_handle_msg_register(struct sccp_session *session, struct sccp_msg *msg)
+static void sccp_session_register(struct sccp_session *session, struct register_message *reg)
 {
 	struct sccp_device_info device_info;
 	struct sccp_device *device;
@@ -427,8 +703,8 @@ static void sccp_session_handle_msg_register(struct sccp_session *session, struc
 
 	/* A: session->device is null */
 
-	name = msg->data.reg.name;
-	name[sizeof(msg->data.reg.name)] = '\0';
+	name = reg->name;
+	name[sizeof(reg->name)] = '\0';
 
 	device_cfg = sccp_cfg_find_device_or_guest(session->cfg, name);
 	if (!device_cfg) {
@@ -438,8 +714,8 @@ static void sccp_session_handle_msg_register(struct sccp_session *session, struc
 	}
 
 	device_info.name = name;
-	device_info.type = letohl(msg->data.reg.type);
-	device_info.proto_version = letohl(msg->data.reg.protoVersion);
+	device_info.type = letohl(reg->type);
+	device_info.proto_version = letohl(reg->protoVersion);
 	device = sccp_device_create(device_cfg, session, &device_info);
 	ao2_ref(device_cfg, -1);
 	if (!device) {
@@ -465,16 +741,97 @@ static void sccp_session_handle_msg_register(struct sccp_session *session, struc
 
 	/* steal the reference ownership */
 	session->device = device;
+	__atomic_store_n(&session->has_device, 1, __ATOMIC_RELEASE);
+	ao2_ref(session->cfg, -1);
+	session->cfg = NULL;
 
 	remove_auth_timeout_task(session);
 	sccp_session_update_debug(session);
 	sccp_device_on_registration_success(device);
 }
 
+static void on_register_admitted(struct sccp_session *session, void __attribute__((unused)) *data)
+{
+	session->register_deferred = 0;
+	sccp_admission_release(session->admission);
+
+	sccp_session_register(session, &session->deferred_reg);
+}
+
+static int add_register_admitted_task(struct sccp_session *session, int ms)
+{
+	union session_task_data task_data;
+
+	session_task_zero(&task_data);
+
+	return sccp_task_runner_add_ms(session->task_runner, on_register_admitted, &task_data, ms);
+}
+
+static void sccp_session_handle_msg_register(struct sccp_session *session, struct sccp_msg *msg)
+{
+	int delay;
+
+	/* A: session->device is null */
+
+	if (session->register_deferred) {
+		/* the device is retransmitting its register message, ignore it */
+		return;
+	}
+
+	/*
+	 * A device is not kept waiting in the admission queue for longer than authtimeout; the
+	 * auth timeout is then extended by the delay, so that a deferred device doesn't time out.
+	 */
+	delay = sccp_admission_request(session->admission, session->cfg->general_cfg->authtimeout * 1000);
+	if (delay == SCCP_ADMISSION_REJECTED) {
+		/* the episode is logged by the admission controller */
+		ast_debug(1, "Rejecting registration from %s:%d: admission queue is full\n", session->remote_addr_ch, session->remote_port);
+		sccp_session_transmit_register_rej(session);
+		return;
+	}
+
+	if (!delay) {
+		sccp_session_register(session, &msg->data.reg);
+		return;
+	}
+
+	ast_debug(1, "Deferring registration from %s:%d for %d ms\n", session->remote_addr_ch, session->remote_port, delay);
+
+	session->deferred_reg = msg->data.reg;
+	session->register_deferred = 1;
+	if (add_register_admitted_task(session, delay)) {
+		session->stop = 1;
+		return;
+	}
+
+	/* the device must not time out while it is waiting in the admission queue */
+	add_auth_timeout_task(session, delay);
+}
+
+/*
+ * Keepalives make up most of the inbound traffic, so once the device is registered
+ * they are answered directly by the session, without locking the device.
+ */
+static int sccp_session_handle_msg_keep_alive(struct sccp_session *session)
+{
+	if (!session->device || session->debug) {
+		return -1;
+	}
+
+	sccp_session_transmit(session, keep_alive_ack, sizeof(keep_alive_ack));
+	sccp_stat_on_keepalive_fastpath();
+
+	return 0;
+}
+
 static void sccp_session_handle_msg(struct sccp_session *session, struct sccp_msg *msg)
 {
 	uint32_t msg_id = letohl(msg->id);
 
+	if (msg_id == KEEP_ALIVE_MESSAGE && !sccp_session_handle_msg_keep_alive(session)) {
+		return;
+	}
+
 	if (session->debug) {
 		sccp_dump_message_received(msg, session->remote_addr_ch, session->remote_port);
 	}
@@ -494,20 +851,32 @@ static void sccp_session_handle_msg(struct sccp_session *session, struct sccp_ms
 	}
 }
 
-static void sccp_session_on_sock_events(struct sccp_session *session, int events)
+void sccp_session_on_sock_events(struct sccp_session *session, int events)
 {
 	struct sccp_msg *msg;
 	int ret;
 
+	if (events & POLLOUT) {
+		ast_mutex_lock(&session->outbuf.lock);
+		ret = outbuf_flush(&session->outbuf, session->sockfd);
+		ast_mutex_unlock(&session->outbuf.lock);
+		if (ret) {
+			session->stop = 1;
+			return;
+		}
+	}
+
 	if (events & POLLIN) {
 		if (sccp_session_read_sock(session)) {
 			session->stop = 1;
 			return;
 		}
 
+		sccp_session_cork(session);
 		while (!(ret = sccp_deserializer_pop(&session->deserializer, &msg))) {
 			sccp_session_handle_msg(session, msg);
 		}
+		sccp_session_uncork(session);
 
 		switch (ret) {
 		case SCCP_DESERIALIZER_NOMSG:
@@ -519,70 +888,75 @@ static void sccp_session_on_sock_events(struct sccp_session *session, int events
 		}
 	}
 
-	if (events & ~POLLIN) {
+	if (events & ~(POLLIN | POLLOUT)) {
 		ast_log(LOG_WARNING, "sccp session on sock events failed: unexpected event 0x%X\n", events);
 		session->stop = 1;
 	}
 }
 
-void sccp_session_run(struct sccp_session *session)
+void sccp_session_start(struct sccp_session *session)
 {
-	struct pollfd fds[2];
-	int nfds;
-	int timeout;
+	if (add_auth_timeout_task(session, 0)) {
+		ast_log(LOG_ERROR, "sccp session start failed: could not add auth timeout task\n");
+		session->stop = 1;
+	}
+}
 
-	fds[0].fd = session->sockfd;
-	fds[0].events = POLLIN;
-	fds[1].fd = sccp_sync_queue_fd(session->sync_q);
-	fds[1].events = POLLIN;
+int sccp_session_sock_fd(const struct sccp_session *session)
+{
+	return session->sockfd;
+}
 
-	add_auth_timeout_task(session);
+int sccp_session_queue_fd(const struct sccp_session *session)
+{
+	return sccp_sync_queue_fd(session->sync_q);
+}
 
-	for (;;) {
-		timeout = sccp_task_runner_next_ms(session->task_runner);
+void sccp_session_run_tasks(struct sccp_session *session)
+{
+	sccp_session_cork(session);
+	sccp_task_runner_run(session->task_runner, session);
+	sccp_session_uncork(session);
+}
 
-		nfds = poll(fds, ARRAY_LEN(fds), timeout);
-		if (nfds == -1) {
-			ast_log(LOG_ERROR, "sccp session run failed: poll: %s\n", strerror(errno));
-			goto end;
-		}
+int sccp_session_next_task_when(struct sccp_session *session, struct timeval *when)
+{
+	return sccp_task_runner_next_when(session->task_runner, when);
+}
 
-		if (session->stop) {
-			goto end;
-		}
+int sccp_session_want_write(struct sccp_session *session)
+{
+	int ret;
 
-		if (!nfds) {
-			sccp_task_runner_run(session->task_runner, session);
-			if (session->stop) {
-				goto end;
-			}
-		} else {
-			if (fds[1].revents) {
-				sccp_session_on_queue_events(session, fds[1].revents);
-				if (session->stop) {
-					goto end;
-				}
-			}
+	ast_mutex_lock(&session->outbuf.lock);
+	ret = session->outbuf.congested;
+	ast_mutex_unlock(&session->outbuf.lock);
 
-			if (fds[0].revents) {
-				sccp_session_on_sock_events(session, fds[0].revents);
-				if (session->stop) {
-					goto end;
-				}
-			}
-		}
-	}
+	return ret;
+}
+
+int sccp_session_stopped(const struct sccp_session *session)
+{
+	return session->stop;
+}
 
-end:
+void sccp_session_end(struct sccp_session *session)
+{
 	sccp_session_close_queue(session);
 	sccp_session_empty_queue(session);
 
+	if (session->register_deferred) {
+		session->register_deferred = 0;
+		sccp_admission_cancel(session->admission);
+	}
+
 	if (session->device) {
 		/* sccp_device_registry_remove must really be called before
 		 * sccp_device_destroy, else undefined behaviour happens, because
 		 * registry_remove use some functions that are invalid on destroyed
 		 * device
 		 */
+		__atomic_store_n(&session->has_device, 0, __ATOMIC_RELEASE);
 		sccp_device_registry_remove(session->registry, session->device);
 		sccp_device_destroy(session->device);
 
@@ -595,8 +969,8 @@ int sccp_session_stop(struct sccp_session *session)
 {
 	int ret;
 
-	/* set session->stop to 1 here so that if called from the session thread,
-	 * the flag will be set when going back in the session_run
+	/* set session->stop to 1 here so that if called from the reactor thread,
+	 * the flag will be set when going back in the reactor
 	 */
 	session->stop = 1;
 
@@ -618,6 +992,11 @@ int sccp_session_reload_config(struct sccp_session *session, struct sccp_cfg *cf
 	return sccp_session_queue_msg_reload_config(session, cfg);
 }
 
+int sccp_session_has_device(struct sccp_session *session)
+{
+	return __atomic_load_n(&session->has_device, __ATOMIC_ACQUIRE);
+}
+
 int sccp_session_reload_debug(struct sccp_session *session)
 {
 	return sccp_session_queue_msg_reload_debug(session);
@@ -646,6 +1025,40 @@ int sccp_session_add_device_task(struct sccp_session *session, sccp_device_task_
 	return sccp_task_runner_add(session->task_runner, on_device_task_timeout, &task_data, sec);
 }
 
+int sccp_session_add_device_task_ms(struct sccp_session *session, sccp_device_task_cb callback, void *data, int ms)
+{
+	union session_task_data task_data;
+
+	session_task_zero(&task_data);
+	task_data.device.callback = callback;
+	task_data.device.data = data;
+
+	return sccp_task_runner_add_ms(session->task_runner, on_device_task_timeout, &task_data, ms);
+}
+
+int sccp_session_queue_blf_update(struct sccp_session *session)
+{
+	struct session_msg msg;
+
+	session_msg_init_blf_update(&msg);
+
+	return sccp_session_queue_msg(session, &msg);
+}
+
+int sccp_session_queue_mwi_update(struct sccp_session *session)
+{
+	struct session_msg msg;
+
+	session_msg_init_mwi_update(&msg);
+
+	return sccp_session_queue_msg(session, &msg);
+}
+
+int sccp_session_idle_time(const struct sccp_session *session)
+{
+	return sccp_monotonic_coarse() - session->last_activity;
+}
+
 void sccp_session_remove_device_task(struct sccp_session *session, sccp_device_task_cb callback, void *data)
 {
 	union session_task_data task_data;
@@ -657,28 +1070,81 @@ void sccp_session_remove_device_task(struct sccp_session *session, sccp_device_t
 	sccp_task_runner_remove(session->task_runner, on_device_task_timeout, &task_data);
 }
 
-int sccp_session_transmit_msg(struct sccp_session *session, struct sccp_msg *msg)
+/*
+ * Handle the result of outbuf_try_flush. Must be called without the outbuf lock held.
+ */
+static int sccp_session_on_try_flush(struct sccp_session *session, int ret)
 {
-	size_t count = SCCP_MSG_TOTAL_LEN_FROM_LEN(letohl(msg->length));
-	ssize_t n;
+	switch (ret) {
+	case -1:
+		sccp_session_stop(session);
+		return -1;
+	case 1:
+		/* wake up the reactor so that it starts polling for the socket to be writable */
+		sccp_session_queue_msg_noop(session);
+		break;
+	}
 
-	if (session->debug) {
-		sccp_dump_message_transmitting(msg, session->remote_addr_ch, session->remote_port);
+	return 0;
+}
+
+static int sccp_session_transmit(struct sccp_session *session, const char *data, size_t count)
+{
+	struct session_outbuf *outbuf = &session->outbuf;
+	int ret;
+
+	ast_mutex_lock(&outbuf->lock);
+	if (outbuf_append(outbuf, data, count)) {
+		ast_log(LOG_WARNING, "sccp session transmit msg failed: %zu bytes pending, disconnecting %s:%d\n",
+				outbuf->len + count, session->remote_addr_ch, session->remote_port);
+		ast_mutex_unlock(&outbuf->lock);
+		sccp_session_stop(session);
+		return -1;
 	}
 
-	n = write(session->sockfd, msg, count);
-	if (n == (ssize_t) count) {
+	if (outbuf->corked || outbuf->congested) {
+		ast_mutex_unlock(&outbuf->lock);
 		return 0;
 	}
 
-	session->stop = 1;
-	if (n == -1) {
-		ast_log(LOG_WARNING, "sccp session transmit msg failed: write: %s\n", strerror(errno));
-	} else {
-		ast_log(LOG_WARNING, "sccp session transmit msg failed: write wrote less bytes than expected\n");
+	ret = outbuf_try_flush(outbuf, session->sockfd);
+	ast_mutex_unlock(&outbuf->lock);
+
+	return sccp_session_on_try_flush(session, ret);
+}
+
+int sccp_session_transmit_msg(struct sccp_session *session, struct sccp_msg *msg)
+{
+	if (session->debug) {
+		sccp_dump_message_transmitting(msg, session->remote_addr_ch, session->remote_port);
 	}
 
-	return -1;
+	return sccp_session_transmit(session, (char *) msg, SCCP_MSG_TOTAL_LEN_FROM_LEN(letohl(msg->length)));
+}
+
+void sccp_session_cork(struct sccp_session *session)
+{
+	ast_mutex_lock(&session->outbuf.lock);
+	session->outbuf.corked++;
+	ast_mutex_unlock(&session->outbuf.lock);
+}
+
+void sccp_session_uncork(struct sccp_session *session)
+{
+	struct session_outbuf *outbuf = &session->outbuf;
+	int ret;
+
+	ast_mutex_lock(&outbuf->lock);
+	outbuf->corked--;
+	if (outbuf->corked || outbuf->congested || !outbuf->len) {
+		ast_mutex_unlock(&outbuf->lock);
+		return;
+	}
+
+	ret = outbuf_try_flush(outbuf, session->sockfd);
+	ast_mutex_unlock(&outbuf->lock);
+
+	sccp_session_on_try_flush(session, ret);
 }
 
 const char *sccp_session_remote_addr_ch(const struct sccp_session *session)
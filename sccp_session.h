@@ -1,12 +1,14 @@
 #ifndef SCCP_SESSION_H_
 #define SCCP_SESSION_H_
 
+struct sccp_admission;
 struct sccp_cfg;
 struct sccp_device;
 struct sccp_device_registry;
 struct sccp_msg;
 struct sccp_session;
 struct sockaddr_in;
+struct timeval;
 
 /*!
  * \brief Create a new session (astobj2 object).
@@ -14,15 +16,74 @@ struct sockaddr_in;
  * \retval non-NULL on success
  * \retval NULL on failure
  */
-struct sccp_session *sccp_session_create(struct sccp_cfg *cfg, struct sccp_device_registry *registry, struct sockaddr_in *addr, int sockfd);
+struct sccp_session *sccp_session_create(struct sccp_cfg *cfg, struct sccp_device_registry *registry, struct sccp_admission *admission, struct sockaddr_in *addr, int sockfd);
 
 /*!
- * \brief Run the session.
+ * \brief Start the session.
  *
- * \note This function returns only when the session stops, either "naturally"
- *       or after a call to sccp_session_stop.
+ * \note Must be called from the reactor thread, before any other event function.
  */
-void sccp_session_run(struct sccp_session *session);
+void sccp_session_start(struct sccp_session *session);
+
+/*!
+ * \brief Return the socket file descriptor of the session.
+ */
+int sccp_session_sock_fd(const struct sccp_session *session);
+
+/*!
+ * \brief Return the file descriptor of the session queue.
+ */
+int sccp_session_queue_fd(const struct sccp_session *session);
+
+/*!
+ * \brief Handle the poll events of the session socket.
+ *
+ * \note Must be called only from the reactor thread.
+ */
+void sccp_session_on_sock_events(struct sccp_session *session, int events);
+
+/*!
+ * \brief Handle the poll events of the session queue.
+ *
+ * \note Must be called only from the reactor thread.
+ */
+void sccp_session_on_queue_events(struct sccp_session *session, int events);
+
+/*!
+ * \brief Run the due tasks of the session.
+ *
+ * \note Must be called only from the reactor thread.
+ */
+void sccp_session_run_tasks(struct sccp_session *session);
+
+/*!
+ * \brief Get the time of the next task of the session.
+ *
+ * \retval 0 on success
+ * \retval non-zero if the session has no task
+ */
+int sccp_session_next_task_when(struct sccp_session *session, struct timeval *when);
+
+/*!
+ * \brief Return non-zero if the session has pending output, i.e. if the
+ *        reactor must poll for the socket to be writable.
+ */
+int sccp_session_want_write(struct sccp_session *session);
+
+/*!
+ * \brief Return non-zero if the session has stopped, i.e. if it must be ended.
+ */
+int sccp_session_stopped(const struct sccp_session *session);
+
+/*!
+ * \brief End the session.
+ *
+ * The session queue is closed and the device associated to the session, if any,
+ * is unregistered and destroyed.
+ *
+ * \note Must be called only from the reactor thread.
+ */
+void sccp_session_end(struct sccp_session *session);
 
 /*!
  * \brief Stop the session.
@@ -44,6 +105,13 @@ int sccp_session_stop(struct sccp_session *session);
  */
 int sccp_session_reload_config(struct sccp_session *session, struct sccp_cfg *cfg);
 
+/*!
+ * \brief Return non-zero if a device is registered on the session.
+ *
+ * This function is thread safe. Once it returns non-zero, the device is in the registry.
+ */
+int sccp_session_has_device(struct sccp_session *session);
+
 /*!
  * \brief Reload the debug status.
  *
@@ -62,7 +130,7 @@ typedef void (*sccp_device_task_cb)(struct sccp_device *device, void *data);
 /*!
  * \brief Add a device task.
  *
- * \note Must be called only from the session thread.
+ * \note Must be called only from the reactor thread.
  * \note Part of the device API.
  *
  * \retval 0 on success
@@ -70,10 +138,55 @@ typedef void (*sccp_device_task_cb)(struct sccp_device *device, void *data);
  */
 int sccp_session_add_device_task(struct sccp_session *session, sccp_device_task_cb callback, void *data, int sec);
 
+/*!
+ * \brief Add a device task, with a delay in milliseconds.
+ *
+ * \note Must be called only from the reactor thread.
+ * \note Part of the device API.
+ *
+ * \retval 0 on success
+ * \retval non-zero on failure
+ */
+int sccp_session_add_device_task_ms(struct sccp_session *session, sccp_device_task_cb callback, void *data, int ms);
+
+/*!
+ * \brief Ask the session to call sccp_device_on_blf_update from its thread.
+ *
+ * Many requests made before the session handles the first one are coalesced.
+ *
+ * \note This function is thread safe.
+ * \note Part of the device API.
+ *
+ * \retval 0 on success
+ * \retval non-zero on failure
+ */
+int sccp_session_queue_blf_update(struct sccp_session *session);
+
+/*!
+ * \brief Ask the session to call sccp_device_on_mwi_update from its thread.
+ *
+ * Many requests made before the session handles the first one are coalesced.
+ *
+ * \note This function is thread safe.
+ * \note Part of the device API.
+ *
+ * \retval 0 on success
+ * \retval non-zero on failure
+ */
+int sccp_session_queue_mwi_update(struct sccp_session *session);
+
+/*!
+ * \brief Return the number of seconds since data was last read from the session socket.
+ *
+ * \note Must be called only from the reactor thread.
+ * \note Part of the device API.
+ */
+int sccp_session_idle_time(const struct sccp_session *session);
+
 /*!
  * \brief Remove a device task.
  *
- * \note Must be called only from the session thread.
+ * \note Must be called only from the reactor thread.
  * \note Part of the device API.
  */
 void sccp_session_remove_device_task(struct sccp_session *session, sccp_device_task_cb callback, void *data);
@@ -81,6 +194,10 @@ void sccp_session_remove_device_task(struct sccp_session *session, sccp_device_t
 /*!
  * \brief Transmit a message on the session socket.
  *
+ * The socket is non-blocking; what can't be written right away is buffered
+ * and written once the socket becomes writable. If the peer has too many
+ * pending bytes, the session is stopped.
+ *
  * \note Part of the device API.
  *
  * \retval 0 on success
@@ -88,6 +205,24 @@ void sccp_session_remove_device_task(struct sccp_session *session, sccp_device_t
  */
 int sccp_session_transmit_msg(struct sccp_session *session, struct sccp_msg *msg);
 
+/*!
+ * \brief Cork the session output.
+ *
+ * While the session is corked, the transmitted messages are accumulated and are
+ * written with a single system call once the session is uncorked. Cork and uncork
+ * calls can be nested.
+ *
+ * \note Part of the device API.
+ */
+void sccp_session_cork(struct sccp_session *session);
+
+/*!
+ * \brief Uncork the session output.
+ *
+ * \note Part of the device API.
+ */
+void sccp_session_uncork(struct sccp_session *session);
+
 /*!
  * \brief Return the remote (i.e. peer) IPv4 address of the session, as a char*.
  *
@@ -1,29 +1,87 @@
+#include <stdint.h>
 #include <string.h>
+#include <sys/param.h>
 
 #include <asterisk.h>
-#include <asterisk/heap.h>
+#include <asterisk/dlinkedlists.h>
 #include <asterisk/linkedlists.h>
 #include <asterisk/time.h>
 #include <asterisk/utils.h>
 
 #include "sccp_task.h"
 
+/*
+ * The tasks are stored in a hashed timing wheel: a task is put in the slot of
+ * its tick modulo the number of slots, and a task that is due in more than one
+ * rotation simply stays in its slot for more than one rotation. The tasks are
+ * also indexed by a hash of their callback and data, so that adding,
+ * rescheduling and removing a task are constant time operations.
+ *
+ * The tick only selects the slot; the tasks are run at their exact time.
+ */
+#define WHEEL_TICK_MS 1000
+#define WHEEL_SLOTS 64
+#define HASH_BUCKETS 8
+
 struct task {
-	AST_LIST_ENTRY(task) list;
+	AST_DLLIST_ENTRY(task) slot_list;
+	AST_LIST_ENTRY(task) bucket_list;
 	struct timeval when;
-	ssize_t __heap_index;
+	uint64_t tick;
+	unsigned int hash;
 
 	sccp_task_cb callback;
 	void *data[0];
 };
 
+AST_DLLIST_HEAD_NOLOCK(task_slot, task);
+AST_LIST_HEAD_NOLOCK(task_bucket, task);
+
 struct sccp_task_runner {
-	AST_LIST_HEAD_NOLOCK(, task) tasks;
-	struct ast_heap *heap;
+	struct task_slot slots[WHEEL_SLOTS];
+	struct task_bucket buckets[HASH_BUCKETS];
+	/* cached next task, valid only if next_valid is true */
+	struct task *next;
+	int next_valid;
+	/* no task has a tick lower than the current tick */
+	uint64_t cur_tick;
+	size_t count;
 	size_t data_size;
 };
 
-static struct task *task_create(size_t data_size, sccp_task_cb callback, void *data)
+static uint64_t tv_to_tick(struct timeval tv)
+{
+	return ((uint64_t) tv.tv_sec * 1000 + tv.tv_usec / 1000) / WHEEL_TICK_MS;
+}
+
+static uint64_t fnv1a(uint64_t hash, const void *buf, size_t len)
+{
+	const unsigned char *p = buf;
+	uint64_t word;
+
+	for (; len >= sizeof(word); len -= sizeof(word), p += sizeof(word)) {
+		memcpy(&word, p, sizeof(word));
+		hash = (hash ^ word) * 1099511628211u;
+	}
+
+	for (; len; len--, p++) {
+		hash = (hash ^ *p) * 1099511628211u;
+	}
+
+	return hash;
+}
+
+static unsigned int task_hash(sccp_task_cb callback, void *data, size_t data_size)
+{
+	uint64_t hash = 14695981039346656037u;
+
+	hash = fnv1a(hash, &callback, sizeof(callback));
+	hash = fnv1a(hash, data, data_size);
+
+	return (unsigned int) (hash ^ (hash >> 32));
+}
+
+static struct task *task_create(size_t data_size, sccp_task_cb callback, void *data, unsigned int hash)
 {
 	struct task *task;
 
@@ -33,6 +91,7 @@ static struct task *task_create(size_t data_size, sccp_task_cb callback, void *d
 	}
 
 	task->callback = callback;
+	task->hash = hash;
 	memcpy(task->data, data, data_size);
 
 	return task;
@@ -48,27 +107,76 @@ static int task_is_equal(struct task *task, sccp_task_cb callback, void *data, s
 	return task->callback == callback && !memcmp(task->data, data, data_size);
 }
 
-static int task_cmp(void *a, void *b)
+static struct task *runner_find(struct sccp_task_runner *runner, sccp_task_cb callback, void *data, unsigned int hash)
+{
+	struct task *task;
+
+	AST_LIST_TRAVERSE(&runner->buckets[hash % HASH_BUCKETS], task, bucket_list) {
+		if (task->hash == hash && task_is_equal(task, callback, data, runner->data_size)) {
+			return task;
+		}
+	}
+
+	return NULL;
+}
+
+static void runner_link(struct sccp_task_runner *runner, struct task *task)
 {
-	return ast_tvcmp(((struct task *) b)->when, ((struct task *) a)->when);
+	AST_DLLIST_INSERT_TAIL(&runner->slots[task->tick % WHEEL_SLOTS], task, slot_list);
+}
+
+static void runner_unlink(struct sccp_task_runner *runner, struct task *task)
+{
+	AST_DLLIST_REMOVE(&runner->slots[task->tick % WHEEL_SLOTS], task, slot_list);
+}
+
+static void runner_remove(struct sccp_task_runner *runner, struct task *task)
+{
+	runner_unlink(runner, task);
+	AST_LIST_REMOVE(&runner->buckets[task->hash % HASH_BUCKETS], task, bucket_list);
+	runner->count--;
+
+	if (runner->next == task) {
+		runner->next_valid = 0;
+	}
+}
+
+static void runner_update_next(struct sccp_task_runner *runner, struct task *task)
+{
+	if (!runner->next_valid) {
+		return;
+	}
+
+	if (runner->next == task) {
+		/* the next task might have been rescheduled later */
+		runner->next_valid = 0;
+	} else if (!runner->next || ast_tvcmp(task->when, runner->next->when) < 0) {
+		runner->next = task;
+	}
 }
 
 struct sccp_task_runner *sccp_task_runner_create(size_t data_size)
 {
 	struct sccp_task_runner *runner;
+	int i;
 
 	runner = ast_calloc(1, sizeof(*runner));
 	if (!runner) {
 		return NULL;
 	}
 
-	runner->heap = ast_heap_create(3, task_cmp, offsetof(struct task, __heap_index));
-	if (!runner->heap) {
-		ast_free(runner);
-		return NULL;
+	for (i = 0; i < WHEEL_SLOTS; i++) {
+		AST_DLLIST_HEAD_INIT_NOLOCK(&runner->slots[i]);
+	}
+
+	for (i = 0; i < HASH_BUCKETS; i++) {
+		AST_LIST_HEAD_INIT_NOLOCK(&runner->buckets[i]);
 	}
 
-	AST_LIST_HEAD_INIT_NOLOCK(&runner->tasks);
+	runner->next = NULL;
+	runner->next_valid = 1;
+	runner->cur_tick = tv_to_tick(ast_tvnow());
+	runner->count = 0;
 	runner->data_size = data_size;
 
 	return runner;
@@ -77,104 +185,186 @@ struct sccp_task_runner *sccp_task_runner_create(size_t data_size)
 void sccp_task_runner_destroy(struct sccp_task_runner *runner)
 {
 	struct task *task;
+	int i;
 
-	ast_heap_destroy(runner->heap);
-	AST_LIST_TRAVERSE_SAFE_BEGIN(&runner->tasks, task, list) {
-		AST_LIST_REMOVE_CURRENT(list);
-		task_destroy(task);
+	for (i = 0; i < WHEEL_SLOTS; i++) {
+		while ((task = AST_DLLIST_FIRST(&runner->slots[i]))) {
+			AST_DLLIST_REMOVE(&runner->slots[i], task, slot_list);
+			task_destroy(task);
+		}
 	}
-	AST_LIST_TRAVERSE_SAFE_END;
 
 	ast_free(runner);
 }
 
 int sccp_task_runner_add(struct sccp_task_runner *runner, sccp_task_cb callback, void *data, int sec)
+{
+	return sccp_task_runner_add_ms(runner, callback, data, sec < 0 ? -1 : sec * 1000);
+}
+
+int sccp_task_runner_add_ms(struct sccp_task_runner *runner, sccp_task_cb callback, void *data, int ms)
 {
 	struct task *task;
-	size_t data_size = runner->data_size;
+	struct timeval when;
+	uint64_t tick;
+	unsigned int hash;
 
-	/* check if the task is already known */
-	AST_LIST_TRAVERSE(&runner->tasks, task, list) {
-		if (task_is_equal(task, callback, data, data_size)) {
-			break;
-		}
+	if (ms < 0) {
+		when = ast_tvnow();
+	} else {
+		when = ast_tvadd(ast_tvnow(), ast_tv(ms / 1000, (ms % 1000) * 1000));
 	}
 
+	tick = MAX(tv_to_tick(when), runner->cur_tick);
+
+	hash = task_hash(callback, data, runner->data_size);
+	task = runner_find(runner, callback, data, hash);
 	if (task) {
-		ast_heap_remove(runner->heap, task);
+		/* rescheduling in the same tick, which is the common case, doesn't move the task */
+		if (task->tick != tick) {
+			runner_unlink(runner, task);
+			task->tick = tick;
+			runner_link(runner, task);
+		}
 	} else {
-		task = task_create(data_size, callback, data);
+		task = task_create(runner->data_size, callback, data, hash);
 		if (!task) {
 			return -1;
 		}
 
-		AST_LIST_INSERT_TAIL(&runner->tasks, task, list);
+		task->tick = tick;
+		runner_link(runner, task);
+		AST_LIST_INSERT_HEAD(&runner->buckets[hash % HASH_BUCKETS], task, bucket_list);
+		runner->count++;
 	}
 
-	if (sec < 0) {
-		task->when = ast_tvnow();
-	} else {
-		task->when = ast_tvadd(ast_tvnow(), ast_tv(sec, 0));
-	}
+	task->when = when;
+	runner_update_next(runner, task);
 
-	return ast_heap_push(runner->heap, task);
+	return 0;
 }
 
 void sccp_task_runner_remove(struct sccp_task_runner *runner, sccp_task_cb callback, void *data)
 {
 	struct task *task;
-	size_t data_size = runner->data_size;
 
-	AST_LIST_TRAVERSE_SAFE_BEGIN(&runner->tasks, task, list) {
-		if (task_is_equal(task, callback, data, data_size)) {
-			ast_heap_remove(runner->heap, task);
-			AST_LIST_REMOVE_CURRENT(list);
-			task_destroy(task);
-			break;
-		}
+	task = runner_find(runner, callback, data, task_hash(callback, data, runner->data_size));
+	if (task) {
+		runner_remove(runner, task);
+		task_destroy(task);
 	}
-	AST_LIST_TRAVERSE_SAFE_END;
 }
 
-void sccp_task_runner_run(struct sccp_task_runner *runner, struct sccp_session *session)
+static struct task *slot_find_due(struct task_slot *slot, struct timeval limit)
 {
 	struct task *task;
-	struct timeval when;
 
-	when = ast_tvadd(ast_tvnow(), ast_tv(0, 1000));
-	while (1) {
-		task = ast_heap_peek(runner->heap, 1);
-		if (!task) {
-			break;
+	AST_DLLIST_TRAVERSE(slot, task, slot_list) {
+		if (ast_tvcmp(task->when, limit) < 0) {
+			return task;
 		}
+	}
 
-		if (ast_tvcmp(task->when, when) != -1) {
-			break;
-		}
+	return NULL;
+}
 
-		ast_heap_pop(runner->heap);
-		AST_LIST_REMOVE(&runner->tasks, task, list);
+void sccp_task_runner_run(struct sccp_task_runner *runner, struct sccp_session *session)
+{
+	struct task *task;
+	struct timeval now;
+	struct timeval limit;
+	uint64_t last_tick;
+	uint64_t tick;
 
-		task->callback(session, task->data);
+	now = ast_tvnow();
+	limit = ast_tvadd(now, ast_tv(0, 1000));
 
-		task_destroy(task);
+	/*
+	 * The tasks added by the callbacks are always in the last tick or later, so they
+	 * can't end up in a slot that has already been visited.
+	 */
+	last_tick = MAX(tv_to_tick(now), runner->cur_tick);
+	for (tick = runner->cur_tick; tick <= last_tick && tick < runner->cur_tick + WHEEL_SLOTS; tick++) {
+		while ((task = slot_find_due(&runner->slots[tick % WHEEL_SLOTS], limit))) {
+			runner_remove(runner, task);
+
+			task->callback(session, task->data);
+
+			task_destroy(task);
+		}
 	}
+
+	runner->cur_tick = last_tick;
 }
 
 int sccp_task_runner_next_ms(struct sccp_task_runner *runner)
 {
-	struct task *task;
+	struct timeval when;
 	int ms;
 
-	task = ast_heap_peek(runner->heap, 1);
-	if (!task) {
+	if (sccp_task_runner_next_when(runner, &when)) {
 		return -1;
 	}
 
-	ms = ast_tvdiff_ms(task->when, ast_tvnow());
+	ms = ast_tvdiff_ms(when, ast_tvnow());
 	if (ms < 0) {
 		ms = 0;
 	}
 
 	return ms;
 }
+
+/*
+ * Find the next task by walking the wheel from the current tick; the first slot
+ * that has a task due in this rotation has the next task.
+ */
+static struct task *runner_find_next(struct sccp_task_runner *runner)
+{
+	struct task *task;
+	struct task *next = NULL;
+	uint64_t tick;
+	int i;
+
+	if (!runner->count) {
+		return NULL;
+	}
+
+	for (tick = runner->cur_tick; tick < runner->cur_tick + WHEEL_SLOTS; tick++) {
+		AST_DLLIST_TRAVERSE(&runner->slots[tick % WHEEL_SLOTS], task, slot_list) {
+			if (task->tick == tick && (!next || ast_tvcmp(task->when, next->when) < 0)) {
+				next = task;
+			}
+		}
+
+		if (next) {
+			return next;
+		}
+	}
+
+	/* all the tasks are due in more than one rotation */
+	for (i = 0; i < WHEEL_SLOTS; i++) {
+		AST_DLLIST_TRAVERSE(&runner->slots[i], task, slot_list) {
+			if (!next || ast_tvcmp(task->when, next->when) < 0) {
+				next = task;
+			}
+		}
+	}
+
+	return next;
+}
+
+int sccp_task_runner_next_when(struct sccp_task_runner *runner, struct timeval *when)
+{
+	if (!runner->next_valid) {
+		runner->next = runner_find_next(runner);
+		runner->next_valid = 1;
+	}
+
+	if (!runner->next) {
+		return -1;
+	}
+
+	*when = runner->next->when;
+
+	return 0;
+}
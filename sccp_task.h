@@ -1,9 +1,9 @@
 #ifndef SCCP_TASK_H_
 #define SCCP_TASK_H_
 
-struct ast_heap;
 struct sccp_session;
 struct sccp_task_runner;
+struct timeval;
 
 /*!
  * \brief Function type for session task callback
@@ -35,6 +35,13 @@ void sccp_task_runner_destroy(struct sccp_task_runner *runner);
  */
 int sccp_task_runner_add(struct sccp_task_runner *runner, sccp_task_cb callback, void *data, int sec);
 
+/*!
+ * \brief Add/schedule a task, with a millisecond precision.
+ *
+ * \see sccp_task_runner_add
+ */
+int sccp_task_runner_add_ms(struct sccp_task_runner *runner, sccp_task_cb callback, void *data, int ms);
+
 /*!
  * \brief Remove/unschedule a task
  *
@@ -58,4 +65,12 @@ void sccp_task_runner_run(struct sccp_task_runner *runner, struct sccp_session *
  */
 int sccp_task_runner_next_ms(struct sccp_task_runner *runner);
 
+/*!
+ * \brief Get the time of the next task.
+ *
+ * \retval 0 on success
+ * \retval non-zero if there is no task
+ */
+int sccp_task_runner_next_when(struct sccp_task_runner *runner, struct timeval *when);
+
 #endif /* SCCP_TASK_H_ */
@@ -2,6 +2,7 @@
 #include <asterisk/lock.h>
 #include <asterisk/logger.h>
 
+#include "sccp.h"
 #include "sccp_config.h"
 #include "sccp_utils.h"
 
@@ -23,11 +24,69 @@ void sccp_stat_on_device_panic(void)
 	ast_atomic_fetchadd_int(&stat.device_panic_count, 1);
 }
 
+void sccp_stat_on_accept_queue_full(void)
+{
+	time_t now = time(NULL);
+
+	stat.accept_queue_full_last = now;
+	ast_atomic_fetchadd_int(&stat.accept_queue_full_count, 1);
+}
+
+void sccp_stat_on_keepalive_fastpath(void)
+{
+	ast_atomic_fetchadd_int(&stat.keepalive_fastpath_count, 1);
+}
+
+void sccp_stat_on_reload(int devices, int ms)
+{
+	time_t now = time(NULL);
+
+	stat.reload_last = now;
+	stat.reload_last_devices = devices;
+	stat.reload_last_ms = ms;
+	ast_atomic_fetchadd_int(&stat.reload_count, 1);
+}
+
+void sccp_stat_on_blf_received(void)
+{
+	ast_atomic_fetchadd_int(&stat.blf_received_count, 1);
+}
+
+void sccp_stat_on_blf_transmitted(void)
+{
+	ast_atomic_fetchadd_int(&stat.blf_transmitted_count, 1);
+}
+
 void sccp_stat_take_snapshot(struct sccp_stat *dst)
 {
 	memcpy(dst, &stat, sizeof(*dst));
 }
 
+time_t sccp_monotonic_coarse(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+
+	return ts.tv_sec;
+}
+
+unsigned int sccp_buckets(size_t count)
+{
+	static const unsigned int primes[] = {
+		SCCP_BUCKETS, 1153, 2311, 4621, 9241, 18481, 36947, 73897, 147793, 295663,
+	};
+	size_t i;
+
+	for (i = 0; i < ARRAY_LEN(primes) - 1; i++) {
+		if (count <= primes[i]) {
+			break;
+		}
+	}
+
+	return primes[i];
+}
+
 int sccp_socket_set_tos(int sockfd, struct sccp_cfg *new_cfg, struct sccp_cfg *old_cfg)
 {
 	unsigned int tos = new_cfg->general_cfg->tos;
@@ -1,6 +1,7 @@
 #ifndef SCCP_UTILS_H_
 #define SCCP_UTILS_H_
 
+#include <stddef.h>
 #include <time.h>
 
 struct sccp_cfg;
@@ -23,6 +24,15 @@ struct sccp_stat {
 	time_t device_fault_last;
 	int device_panic_count;
 	time_t device_panic_last;
+	int accept_queue_full_count;
+	time_t accept_queue_full_last;
+	int keepalive_fastpath_count;
+	int reload_count;
+	time_t reload_last;
+	int reload_last_devices;
+	int reload_last_ms;
+	int blf_received_count;
+	int blf_transmitted_count;
 };
 
 /*!
@@ -39,12 +49,68 @@ void sccp_stat_on_device_fault(void);
  */
 void sccp_stat_on_device_panic(void);
 
+/*!
+ * \brief Update the global count of accept queue samples found full, and the time of the last one.
+ *
+ * This counts the times the accept queue was found full when sampled, not the connections
+ * dropped by the kernel.
+ *
+ * This function is thread safe.
+ */
+void sccp_stat_on_accept_queue_full(void);
+
+/*!
+ * \brief Update the global count of keepalives answered by the session fast path.
+ *
+ * This function is thread safe.
+ */
+void sccp_stat_on_keepalive_fastpath(void);
+
+/*!
+ * \brief Update the global reload count, and the stat of the last reload.
+ *
+ * \param devices number of devices affected by the reload
+ * \param ms time taken by the reload, in milliseconds
+ *
+ * This function is thread safe.
+ */
+void sccp_stat_on_reload(int devices, int ms);
+
+/*!
+ * \brief Update the global count of BLF state changes received from Asterisk.
+ *
+ * This function is thread safe.
+ */
+void sccp_stat_on_blf_received(void);
+
+/*!
+ * \brief Update the global count of BLF state changes transmitted to the devices.
+ *
+ * This function is thread safe.
+ */
+void sccp_stat_on_blf_transmitted(void);
+
 /*!
  * \brief Take a snapshot of the global stat and copy it into dst.
  *
  */
 void sccp_stat_take_snapshot(struct sccp_stat *dst);
 
+/*!
+ * \brief Return the current time in seconds, from a coarse monotonic clock.
+ *
+ * This is much cheaper than ast_tvnow, and is not affected by system time changes.
+ */
+time_t sccp_monotonic_coarse(void);
+
+/*!
+ * \brief Return the number of buckets to use for a hash container holding count objects.
+ *
+ * The returned value is a prime, not less than SCCP_BUCKETS, chosen so that the chains
+ * stay short (about one object per bucket).
+ */
+unsigned int sccp_buckets(size_t count);
+
 /*!
  * \brief Set the TOS / DSCP value on the given socket from the config.
  *
@@ -0,0 +1,268 @@
+/*
+ * Microbenchmark of the sizing of the hash containers and of the cached name hashes.
+ *
+ * The lookups are done on a model of the ao2 hash container (an array of buckets of
+ * linked nodes pointing to the objects, the bucket being the hash modulo the number of
+ * buckets), filled with the device and line names generated by utils/sccp-confgen:
+ *
+ * - key lookup: search by name, like ao2_find with OBJ_SEARCH_KEY; the name is hashed
+ *   then compared with strcmp to the objects of its bucket
+ * - object lookup: search by object, like ao2_unlink or ao2_container_dup; uncached, the
+ *   name of the object is hashed and compared with strcmp, as before the hashes were
+ *   cached; cached, the hash of the object is used and compared before strcmp
+ *
+ * Each lookup is measured with the fixed SCCP_BUCKETS buckets and with the number of
+ * buckets returned by sccp_buckets for the number of objects.
+ */
+#include <time.h>
+
+#include <asterisk.h>
+
+#include "sccp.h"
+
+#define LOOKUPS 2000000
+/* every measure is the best of a few runs, to filter out the noise */
+#define RUNS 3
+
+struct obj {
+	int hash;
+	char name[SCCP_LINE_NAME_MAX];
+};
+
+struct bucket_node {
+	struct bucket_node *next;
+	struct obj *obj;
+};
+
+struct table {
+	unsigned int n_buckets;
+	struct bucket_node **buckets;
+	struct bucket_node *nodes;
+};
+
+/* number of nodes walked by the lookups */
+static unsigned long nodes_walked;
+
+/* same as sccp_buckets in sccp_utils.c */
+static unsigned int sccp_buckets(size_t count)
+{
+	static const unsigned int primes[] = {
+		SCCP_BUCKETS, 1153, 2311, 4621, 9241, 18481, 36947, 73897, 147793, 295663,
+	};
+	size_t i;
+
+	for (i = 0; i < ARRAY_LEN(primes) - 1; i++) {
+		if (count <= primes[i]) {
+			break;
+		}
+	}
+
+	return primes[i];
+}
+
+static double now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static unsigned int bucket_of(const struct table *table, int hash)
+{
+	return abs(hash % (int) table->n_buckets);
+}
+
+static void table_init(struct table *table, unsigned int n_buckets, struct obj *objs, size_t n)
+{
+	struct bucket_node **tail;
+	struct bucket_node *node;
+	size_t i;
+
+	table->n_buckets = n_buckets;
+	table->buckets = calloc(n_buckets, sizeof(*table->buckets));
+	table->nodes = calloc(n, sizeof(*table->nodes));
+	if (!table->buckets || !table->nodes) {
+		fprintf(stderr, "out of memory\n");
+		exit(1);
+	}
+
+	/* the objects are linked at the end of their bucket, like ao2_link */
+	for (i = 0; i < n; i++) {
+		node = &table->nodes[i];
+		node->obj = &objs[i];
+		for (tail = &table->buckets[bucket_of(table, objs[i].hash)]; *tail; tail = &(*tail)->next) {
+		}
+		*tail = node;
+	}
+}
+
+static void table_destroy(struct table *table)
+{
+	free(table->buckets);
+	free(table->nodes);
+}
+
+static struct obj *table_find_key(const struct table *table, const char *name)
+{
+	struct bucket_node *node;
+
+	for (node = table->buckets[bucket_of(table, ast_str_hash(name))]; node; node = node->next) {
+		nodes_walked++;
+		if (!strcmp(node->obj->name, name)) {
+			return node->obj;
+		}
+	}
+
+	return NULL;
+}
+
+static struct obj *table_find_obj_uncached(const struct table *table, const struct obj *obj)
+{
+	struct bucket_node *node;
+
+	for (node = table->buckets[bucket_of(table, ast_str_hash(obj->name))]; node; node = node->next) {
+		nodes_walked++;
+		if (!strcmp(node->obj->name, obj->name)) {
+			return node->obj;
+		}
+	}
+
+	return NULL;
+}
+
+static struct obj *table_find_obj_cached(const struct table *table, const struct obj *obj)
+{
+	struct bucket_node *node;
+
+	for (node = table->buckets[bucket_of(table, obj->hash)]; node; node = node->next) {
+		nodes_walked++;
+		if (node->obj->hash == obj->hash && !strcmp(node->obj->name, obj->name)) {
+			return node->obj;
+		}
+	}
+
+	return NULL;
+}
+
+enum lookup {
+	LOOKUP_KEY,
+	LOOKUP_OBJ_UNCACHED,
+	LOOKUP_OBJ_CACHED,
+};
+
+/*
+ * The objects are looked up in a shuffled order (order), so that the walks are not
+ * trivially predicted.
+ */
+static double bench_lookup(const struct table *table, struct obj *objs, const size_t *order, size_t n, enum lookup lookup, double *avg_nodes_walked)
+{
+	struct obj *obj;
+	struct obj *found = NULL;
+	double best = 0;
+	double start;
+	double t;
+	int run;
+	int i;
+
+	for (run = 0; run < RUNS; run++) {
+		nodes_walked = 0;
+		start = now_ns();
+		for (i = 0; i < LOOKUPS; i++) {
+			obj = &objs[order[i % n]];
+			switch (lookup) {
+			case LOOKUP_KEY:
+				found = table_find_key(table, obj->name);
+				break;
+			case LOOKUP_OBJ_UNCACHED:
+				found = table_find_obj_uncached(table, obj);
+				break;
+			case LOOKUP_OBJ_CACHED:
+				found = table_find_obj_cached(table, obj);
+				break;
+			}
+
+			if (found != obj) {
+				fprintf(stderr, "FAIL: %s not found\n", obj->name);
+				exit(1);
+			}
+		}
+		t = (now_ns() - start) / LOOKUPS;
+
+		if (!run || t < best) {
+			best = t;
+		}
+	}
+
+	*avg_nodes_walked = (double) nodes_walked / LOOKUPS;
+
+	return best;
+}
+
+static void bench(const char *kind, const char *fmt, size_t n)
+{
+	struct obj *objs;
+	size_t *order;
+	unsigned int rand_state = 2463534242u;
+	unsigned int n_buckets[2] = { SCCP_BUCKETS, sccp_buckets(n) };
+	struct table table;
+	double key_ns;
+	double uncached_ns;
+	double cached_ns;
+	double key_nodes_walked;
+	double obj_nodes_walked;
+	size_t i;
+	size_t j;
+	size_t tmp;
+	int k;
+
+	objs = calloc(n, sizeof(*objs));
+	order = calloc(n, sizeof(*order));
+	if (!objs || !order) {
+		fprintf(stderr, "out of memory\n");
+		exit(1);
+	}
+
+	for (i = 0; i < n; i++) {
+		snprintf(objs[i].name, sizeof(objs[i].name), fmt, (int) i);
+		objs[i].hash = ast_str_hash(objs[i].name);
+		order[i] = i;
+	}
+
+	for (i = n - 1; i > 0; i--) {
+		rand_state ^= rand_state << 13;
+		rand_state ^= rand_state >> 17;
+		rand_state ^= rand_state << 5;
+		j = rand_state % (i + 1);
+		tmp = order[i];
+		order[i] = order[j];
+		order[j] = tmp;
+	}
+
+	for (k = 0; k < 2; k++) {
+		table_init(&table, n_buckets[k], objs, n);
+		key_ns = bench_lookup(&table, objs, order, n, LOOKUP_KEY, &key_nodes_walked);
+		uncached_ns = bench_lookup(&table, objs, order, n, LOOKUP_OBJ_UNCACHED, &obj_nodes_walked);
+		cached_ns = bench_lookup(&table, objs, order, n, LOOKUP_OBJ_CACHED, &obj_nodes_walked);
+		printf("%-7s %6zu objects, %6u buckets: %5.1f nodes walked, key %6.1f ns, object uncached %6.1f ns, cached %6.1f ns\n",
+			kind, n, n_buckets[k], key_nodes_walked, key_ns, uncached_ns, cached_ns);
+		table_destroy(&table);
+	}
+
+	free(objs);
+	free(order);
+}
+
+int main(void)
+{
+	static const size_t counts[] = { 500, 5000, 25000 };
+	size_t i;
+
+	for (i = 0; i < ARRAY_LEN(counts); i++) {
+		bench("devices", "SEP%012d", counts[i]);
+		bench("lines", "%d", counts[i]);
+	}
+
+	return 0;
+}
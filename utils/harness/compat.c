@@ -0,0 +1,208 @@
+/*
+ * Implementation of the non-inline parts of the Asterisk stand-ins.
+ */
+#include <stdarg.h>
+
+#include <asterisk.h>
+
+static const char *const level_names[] = {
+	[__LOG_NOTICE] = "NOTICE",
+	[__LOG_WARNING] = "WARNING",
+	[__LOG_ERROR] = "ERROR",
+};
+
+void ast_log(int level, const char *file, int line, const char *function, const char *fmt, ...)
+{
+	va_list ap;
+
+	fprintf(stderr, "[%s] %s:%d %s: ", level_names[level], file, line, function);
+	va_start(ap, fmt);
+	vfprintf(stderr, fmt, ap);
+	va_end(ap);
+}
+
+struct timeval ast_tvadd(struct timeval a, struct timeval b)
+{
+	a.tv_sec += b.tv_sec;
+	a.tv_usec += b.tv_usec;
+	if (a.tv_usec >= 1000000) {
+		a.tv_sec++;
+		a.tv_usec -= 1000000;
+	}
+
+	return a;
+}
+
+/*
+ * Binary heap with the semantics of the Asterisk one: the element for which the
+ * comparison function returns a positive value compared to the others is on top, and
+ * the 1-based position of each element is stored at index_offset in the element.
+ */
+struct ast_heap {
+	ast_heap_cmp_fn cmp_fn;
+	ssize_t index_offset;
+	size_t cur_len;
+	size_t avail_len;
+	void **heap;
+};
+
+static ssize_t *heap_index(struct ast_heap *h, void *elm)
+{
+	return (ssize_t *) ((char *) elm + h->index_offset);
+}
+
+static void heap_set(struct ast_heap *h, size_t i, void *elm)
+{
+	h->heap[i - 1] = elm;
+	*heap_index(h, elm) = i;
+}
+
+static void *heap_get(struct ast_heap *h, size_t i)
+{
+	return h->heap[i - 1];
+}
+
+static void heap_swap(struct ast_heap *h, size_t i, size_t j)
+{
+	void *tmp = heap_get(h, i);
+
+	heap_set(h, i, heap_get(h, j));
+	heap_set(h, j, tmp);
+}
+
+static void heap_sift_down(struct ast_heap *h, size_t i)
+{
+	size_t l;
+	size_t r;
+	size_t max;
+
+	for (;;) {
+		l = 2 * i;
+		r = 2 * i + 1;
+		max = i;
+
+		if (l <= h->cur_len && h->cmp_fn(heap_get(h, l), heap_get(h, max)) > 0) {
+			max = l;
+		}
+
+		if (r <= h->cur_len && h->cmp_fn(heap_get(h, r), heap_get(h, max)) > 0) {
+			max = r;
+		}
+
+		if (max == i) {
+			break;
+		}
+
+		heap_swap(h, i, max);
+		i = max;
+	}
+}
+
+static size_t heap_bubble_up(struct ast_heap *h, size_t i)
+{
+	while (i > 1 && h->cmp_fn(heap_get(h, i), heap_get(h, i / 2)) > 0) {
+		heap_swap(h, i, i / 2);
+		i /= 2;
+	}
+
+	return i;
+}
+
+struct ast_heap *ast_heap_create(unsigned int init_height, ast_heap_cmp_fn cmp_fn, ssize_t index_offset)
+{
+	struct ast_heap *h;
+
+	h = calloc(1, sizeof(*h));
+	if (!h) {
+		return NULL;
+	}
+
+	h->cmp_fn = cmp_fn;
+	h->index_offset = index_offset;
+	h->avail_len = (1 << init_height) - 1;
+	h->heap = calloc(h->avail_len, sizeof(void *));
+	if (!h->heap) {
+		free(h);
+		return NULL;
+	}
+
+	return h;
+}
+
+struct ast_heap *ast_heap_destroy(struct ast_heap *h)
+{
+	free(h->heap);
+	free(h);
+
+	return NULL;
+}
+
+int ast_heap_push(struct ast_heap *h, void *elm)
+{
+	void **tmp;
+
+	if (h->cur_len == h->avail_len) {
+		tmp = realloc(h->heap, (h->avail_len * 2 + 1) * sizeof(void *));
+		if (!tmp) {
+			return -1;
+		}
+
+		h->heap = tmp;
+		h->avail_len = h->avail_len * 2 + 1;
+	}
+
+	h->cur_len++;
+	heap_set(h, h->cur_len, elm);
+	heap_bubble_up(h, h->cur_len);
+
+	return 0;
+}
+
+static void *heap_remove(struct ast_heap *h, size_t i)
+{
+	void *ret;
+
+	if (!i || i > h->cur_len) {
+		return NULL;
+	}
+
+	ret = heap_get(h, i);
+	*heap_index(h, ret) = 0;
+
+	if (i != h->cur_len) {
+		heap_set(h, i, heap_get(h, h->cur_len));
+	}
+	h->cur_len--;
+
+	if (i <= h->cur_len) {
+		i = heap_bubble_up(h, i);
+		heap_sift_down(h, i);
+	}
+
+	return ret;
+}
+
+void *ast_heap_pop(struct ast_heap *h)
+{
+	return heap_remove(h, 1);
+}
+
+void *ast_heap_remove(struct ast_heap *h, void *elm)
+{
+	ssize_t i = *heap_index(h, elm);
+
+	if (i <= 0) {
+		return NULL;
+	}
+
+	return heap_remove(h, i);
+}
+
+void *ast_heap_peek(struct ast_heap *h, unsigned int index)
+{
+	if (!index || index > h->cur_len) {
+		return NULL;
+	}
+
+	return heap_get(h, index);
+}
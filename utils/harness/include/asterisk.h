@@ -0,0 +1,291 @@
+/*
+ * Minimal stand-ins for the parts of the Asterisk API used by the sources built into
+ * the harness programs, so that they can be built and run without Asterisk.
+ *
+ * Only what sccp_queue.c and sccp_task.c use is provided, with the same semantics as
+ * the Asterisk implementation.
+ */
+#ifndef HARNESS_ASTERISK_H_
+#define HARNESS_ASTERISK_H_
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <sys/types.h>
+
+/* logger */
+#define __LOG_ERROR 4
+#define __LOG_WARNING 3
+#define __LOG_NOTICE 2
+#define LOG_ERROR __LOG_ERROR, __FILE__, __LINE__, __func__
+#define LOG_WARNING __LOG_WARNING, __FILE__, __LINE__, __func__
+#define LOG_NOTICE __LOG_NOTICE, __FILE__, __LINE__, __func__
+
+void ast_log(int level, const char *file, int line, const char *function, const char *fmt, ...)
+	__attribute__((format(printf, 5, 6)));
+
+/* memory */
+#define ast_malloc(size) malloc(size)
+#define ast_calloc(nmemb, size) calloc(nmemb, size)
+#define ast_realloc(ptr, size) realloc(ptr, size)
+#define ast_free(ptr) free(ptr)
+
+/* utils */
+#define ARRAY_LEN(a) (sizeof(a) / sizeof(0[a]))
+
+static inline void ast_copy_string(char *dst, const char *src, size_t size)
+{
+	if (!size) {
+		return;
+	}
+
+	while (*src && size > 1) {
+		*dst++ = *src++;
+		size--;
+	}
+
+	*dst = '\0';
+}
+
+static inline int ast_str_hash(const char *str)
+{
+	unsigned int hash = 5381;
+
+	while (*str) {
+		hash = hash * 33 ^ (unsigned char) *str++;
+	}
+
+	return abs((int) hash);
+}
+
+/* lock */
+typedef pthread_mutex_t ast_mutex_t;
+#define AST_MUTEX_DEFINE_STATIC(mutex) static ast_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER
+#define ast_mutex_init(mutex) pthread_mutex_init(mutex, NULL)
+#define ast_mutex_destroy(mutex) pthread_mutex_destroy(mutex)
+#define ast_mutex_lock(mutex) pthread_mutex_lock(mutex)
+#define ast_mutex_unlock(mutex) pthread_mutex_unlock(mutex)
+
+/* time */
+static inline struct timeval ast_tv(time_t sec, suseconds_t usec)
+{
+	struct timeval tv = {
+		.tv_sec = sec,
+		.tv_usec = usec,
+	};
+
+	return tv;
+}
+
+static inline struct timeval ast_tvnow(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+
+	return tv;
+}
+
+static inline int ast_tvcmp(struct timeval a, struct timeval b)
+{
+	if (a.tv_sec < b.tv_sec) {
+		return -1;
+	}
+
+	if (a.tv_sec > b.tv_sec) {
+		return 1;
+	}
+
+	if (a.tv_usec < b.tv_usec) {
+		return -1;
+	}
+
+	if (a.tv_usec > b.tv_usec) {
+		return 1;
+	}
+
+	return 0;
+}
+
+static inline int64_t ast_tvdiff_ms(struct timeval end, struct timeval start)
+{
+	return ((int64_t) end.tv_sec - start.tv_sec) * 1000 + (((int64_t) 1000000 + end.tv_usec - start.tv_usec) / 1000 - 1000);
+}
+
+struct timeval ast_tvadd(struct timeval a, struct timeval b);
+
+/* heap, only used by the previous task runner */
+struct ast_heap;
+typedef int (*ast_heap_cmp_fn)(void *elm1, void *elm2);
+struct ast_heap *ast_heap_create(unsigned int init_height, ast_heap_cmp_fn cmp_fn, ssize_t index_offset);
+struct ast_heap *ast_heap_destroy(struct ast_heap *h);
+int ast_heap_push(struct ast_heap *h, void *elm);
+void *ast_heap_pop(struct ast_heap *h);
+void *ast_heap_remove(struct ast_heap *h, void *elm);
+void *ast_heap_peek(struct ast_heap *h, unsigned int index);
+
+/* singly linked lists */
+#define AST_LIST_HEAD_NOLOCK(name, type) \
+struct name { \
+	struct type *first; \
+	struct type *last; \
+}
+
+#define AST_LIST_ENTRY(type) \
+struct { \
+	struct type *next; \
+}
+
+#define AST_LIST_FIRST(head) ((head)->first)
+#define AST_LIST_NEXT(elm, field) ((elm)->field.next)
+#define AST_LIST_EMPTY(head) (AST_LIST_FIRST(head) == NULL)
+
+#define AST_LIST_HEAD_INIT_NOLOCK(head) do { \
+	(head)->first = NULL; \
+	(head)->last = NULL; \
+} while (0)
+
+#define AST_LIST_TRAVERSE(head, var, field) \
+	for ((var) = (head)->first; (var); (var) = (var)->field.next)
+
+#define AST_LIST_TRAVERSE_SAFE_BEGIN(head, var, field) { \
+	typeof((head)) __list_head = head; \
+	typeof(__list_head->first) __list_next; \
+	typeof(__list_head->first) __list_prev = NULL; \
+	typeof(__list_head->first) __list_current; \
+	for ((var) = __list_head->first, \
+		__list_current = (var), \
+		__list_next = (var) ? (var)->field.next : NULL; \
+		(var); \
+		__list_prev = __list_current, \
+		(var) = __list_next, \
+		__list_current = (var), \
+		__list_next = (var) ? (var)->field.next : NULL \
+	)
+
+#define AST_LIST_REMOVE_CURRENT(field) do { \
+	__list_current->field.next = NULL; \
+	__list_current = __list_prev; \
+	if (__list_prev) { \
+		__list_prev->field.next = __list_next; \
+	} else { \
+		__list_head->first = __list_next; \
+	} \
+	if (!__list_next) { \
+		__list_head->last = __list_prev; \
+	} \
+} while (0)
+
+#define AST_LIST_TRAVERSE_SAFE_END }
+
+#define AST_LIST_INSERT_HEAD(head, elm, field) do { \
+	(elm)->field.next = (head)->first; \
+	(head)->first = (elm); \
+	if (!(head)->last) { \
+		(head)->last = (elm); \
+	} \
+} while (0)
+
+#define AST_LIST_INSERT_TAIL(head, elm, field) do { \
+	if (!(head)->first) { \
+		(head)->first = (elm); \
+		(head)->last = (elm); \
+	} else { \
+		(head)->last->field.next = (elm); \
+		(head)->last = (elm); \
+	} \
+} while (0)
+
+#define AST_LIST_REMOVE(head, elm, field) \
+({ \
+	typeof(elm) __elm = (elm); \
+	if (__elm) { \
+		if ((head)->first == __elm) { \
+			(head)->first = __elm->field.next; \
+			__elm->field.next = NULL; \
+			if ((head)->last == __elm) { \
+				(head)->last = NULL; \
+			} \
+		} else { \
+			typeof(elm) __prev = (head)->first; \
+			while (__prev && __prev->field.next != __elm) { \
+				__prev = __prev->field.next; \
+			} \
+			if (__prev) { \
+				__prev->field.next = __elm->field.next; \
+				__elm->field.next = NULL; \
+				if ((head)->last == __elm) { \
+					(head)->last = __prev; \
+				} \
+			} else { \
+				__elm = NULL; \
+			} \
+		} \
+	} \
+	__elm; \
+})
+
+/* doubly linked lists */
+#define AST_DLLIST_HEAD_NOLOCK(name, type) \
+struct name { \
+	struct type *first; \
+	struct type *last; \
+}
+
+#define AST_DLLIST_HEAD_NOLOCK_STATIC(name, type) \
+struct name { \
+	struct type *first; \
+	struct type *last; \
+} name = { NULL, NULL }
+
+#define AST_DLLIST_ENTRY(type) \
+struct { \
+	struct type *prev; \
+	struct type *next; \
+}
+
+#define AST_DLLIST_FIRST(head) ((head)->first)
+#define AST_DLLIST_EMPTY(head) (AST_DLLIST_FIRST(head) == NULL)
+
+#define AST_DLLIST_HEAD_INIT_NOLOCK(head) do { \
+	(head)->first = NULL; \
+	(head)->last = NULL; \
+} while (0)
+
+#define AST_DLLIST_TRAVERSE(head, var, field) \
+	for ((var) = (head)->first; (var); (var) = (var)->field.next)
+
+#define AST_DLLIST_INSERT_TAIL(head, elm, field) do { \
+	(elm)->field.next = NULL; \
+	(elm)->field.prev = (head)->last; \
+	if ((head)->last) { \
+		(head)->last->field.next = (elm); \
+	} else { \
+		(head)->first = (elm); \
+	} \
+	(head)->last = (elm); \
+} while (0)
+
+#define AST_DLLIST_REMOVE(head, elm, field) \
+({ \
+	typeof(elm) __elm = (elm); \
+	if (__elm->field.prev) { \
+		__elm->field.prev->field.next = __elm->field.next; \
+	} else { \
+		(head)->first = __elm->field.next; \
+	} \
+	if (__elm->field.next) { \
+		__elm->field.next->field.prev = __elm->field.prev; \
+	} else { \
+		(head)->last = __elm->field.prev; \
+	} \
+	__elm->field.next = NULL; \
+	__elm->field.prev = NULL; \
+	__elm; \
+})
+
+#endif /* HARNESS_ASTERISK_H_ */
@@ -0,0 +1,354 @@
+/*
+ * Stress test of the synchronized queue (sccp_sync_queue_*).
+ *
+ * Many producer threads put items into a queue that is consumed by the main thread,
+ * which only takes items once the file descriptor of the queue has been polled ready.
+ * The test checks that:
+ *
+ * - every item is received exactly once, and in the order it was put by its producer
+ * - no wakeup is lost, i.e. the file descriptor is always ready when items are pending
+ * - closing the queue while the producers are putting items waits for the producers
+ *   that had not seen it closed, so that every item successfully put is received and
+ *   no item can be put once sccp_sync_queue_close has returned
+ * - a queue with a capacity never holds more items than its capacity
+ *
+ * The program exits with a non-zero status on the first failed check.
+ */
+#include <errno.h>
+#include <poll.h>
+#include <sched.h>
+#include <stdarg.h>
+
+#include <asterisk.h>
+
+#include "sccp_queue.h"
+
+#define PRODUCERS 8
+#define ITEMS_PER_PRODUCER 200000
+#define ROUNDS 3
+#define CAPACITY 64
+/* time after which a pending item that did not make the fd ready is a lost wakeup */
+#define WAKEUP_TIMEOUT_MS 2000
+
+struct item {
+	int producer;
+	int seq;
+};
+
+struct producer {
+	pthread_t thread;
+	struct sccp_sync_queue *sync_q;
+	int id;
+	/* number of items to put, or 0 to put until the queue is closed */
+	int n;
+	/* number of items successfully put */
+	int put_count;
+	/* number of SCCP_QUEUE_FULL results */
+	int full_count;
+	/* number of items successfully put after the queue close had returned */
+	int put_after_close;
+	unsigned int rand_state;
+};
+
+struct consumer {
+	struct sccp_sync_queue *sync_q;
+	int next_seq[PRODUCERS];
+	long received;
+	long wakeups;
+	int max_batch;
+};
+
+static int start;
+static int close_returned;
+static int producers_done;
+
+static void fail(const char *fmt, ...) __attribute__((format(printf, 1, 2), noreturn));
+
+static void fail(const char *fmt, ...)
+{
+	va_list ap;
+
+	fprintf(stderr, "FAIL: ");
+	va_start(ap, fmt);
+	vfprintf(stderr, fmt, ap);
+	va_end(ap);
+	exit(1);
+}
+
+static unsigned int producer_rand(struct producer *producer)
+{
+	unsigned int x = producer->rand_state;
+
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	producer->rand_state = x;
+
+	return x;
+}
+
+static void *producer_run(void *data)
+{
+	struct producer *producer = data;
+	struct item item;
+	int closed_before;
+	int ret;
+
+	while (!__atomic_load_n(&start, __ATOMIC_ACQUIRE)) {
+		sched_yield();
+	}
+
+	item.producer = producer->id;
+	item.seq = 0;
+	while (!producer->n || item.seq < producer->n) {
+		closed_before = __atomic_load_n(&close_returned, __ATOMIC_SEQ_CST);
+		ret = sccp_sync_queue_put(producer->sync_q, &item);
+		switch (ret) {
+		case 0:
+			if (closed_before) {
+				producer->put_after_close++;
+			}
+
+			producer->put_count++;
+			item.seq++;
+			break;
+		case SCCP_QUEUE_FULL:
+			producer->full_count++;
+			sched_yield();
+			continue;
+		case SCCP_QUEUE_CLOSED:
+			goto end;
+		default:
+			fail("producer %d: put returned %d\n", producer->id, ret);
+		}
+
+		/* vary the interleaving of the producers */
+		if (!(producer_rand(producer) % 64)) {
+			sched_yield();
+		}
+	}
+
+end:
+	__atomic_add_fetch(&producers_done, 1, __ATOMIC_SEQ_CST);
+
+	return NULL;
+}
+
+static void consumer_check_item(struct consumer *consumer, const struct item *item)
+{
+	if (item->producer < 0 || item->producer >= PRODUCERS) {
+		fail("received item from unknown producer %d\n", item->producer);
+	}
+
+	if (item->seq != consumer->next_seq[item->producer]) {
+		fail("producer %d: received seq %d, expected %d\n", item->producer, item->seq, consumer->next_seq[item->producer]);
+	}
+
+	consumer->next_seq[item->producer]++;
+	consumer->received++;
+}
+
+/*
+ * Take the items once the fd is ready, alternating between sccp_sync_queue_get_all and
+ * sccp_sync_queue_get, the latter leaving items in the queue that must make the fd ready
+ * again.
+ */
+static int consumer_take(struct consumer *consumer, int timeout_ms)
+{
+	struct pollfd pfd = {
+		.fd = sccp_sync_queue_fd(consumer->sync_q),
+		.events = POLLIN,
+	};
+	struct sccp_queue q;
+	struct item item;
+	int batch = 0;
+	int ret;
+
+	ret = poll(&pfd, 1, timeout_ms);
+	if (ret == -1) {
+		fail("poll: %s\n", strerror(errno));
+	}
+
+	if (!ret) {
+		return 0;
+	}
+
+	consumer->wakeups++;
+	if (consumer->wakeups % 2) {
+		sccp_sync_queue_get_all(consumer->sync_q, &q);
+		while (!sccp_queue_get(&q, &item)) {
+			consumer_check_item(consumer, &item);
+			batch++;
+		}
+		sccp_queue_destroy(&q);
+	} else if (!sccp_sync_queue_get(consumer->sync_q, &item)) {
+		consumer_check_item(consumer, &item);
+		batch++;
+	}
+
+	if (batch > consumer->max_batch) {
+		consumer->max_batch = batch;
+	}
+
+	return 1;
+}
+
+static void consumer_drain(struct consumer *consumer)
+{
+	struct item item;
+
+	while (!sccp_sync_queue_get(consumer->sync_q, &item)) {
+		consumer_check_item(consumer, &item);
+	}
+}
+
+static void producers_start(struct producer *producers, struct sccp_sync_queue *sync_q, int n, int round)
+{
+	int i;
+	int ret;
+
+	__atomic_store_n(&start, 0, __ATOMIC_SEQ_CST);
+	__atomic_store_n(&close_returned, 0, __ATOMIC_SEQ_CST);
+	__atomic_store_n(&producers_done, 0, __ATOMIC_SEQ_CST);
+
+	for (i = 0; i < PRODUCERS; i++) {
+		memset(&producers[i], 0, sizeof(producers[i]));
+		producers[i].sync_q = sync_q;
+		producers[i].id = i;
+		producers[i].n = n;
+		producers[i].rand_state = 2463534242u + i * 7919 + round;
+
+		ret = pthread_create(&producers[i].thread, NULL, producer_run, &producers[i]);
+		if (ret) {
+			fail("pthread_create: %s\n", strerror(ret));
+		}
+	}
+
+	__atomic_store_n(&start, 1, __ATOMIC_RELEASE);
+}
+
+static void producers_join(struct producer *producers)
+{
+	int i;
+
+	for (i = 0; i < PRODUCERS; i++) {
+		pthread_join(producers[i].thread, NULL);
+	}
+}
+
+static void consumer_check_complete(struct consumer *consumer, struct producer *producers)
+{
+	int i;
+
+	for (i = 0; i < PRODUCERS; i++) {
+		if (consumer->next_seq[i] != producers[i].put_count) {
+			fail("producer %d: received %d items, %d were put\n", i, consumer->next_seq[i], producers[i].put_count);
+		}
+	}
+}
+
+/*
+ * All the items are put then taken, checking that the fd becomes ready as long as some
+ * items are pending.
+ */
+static void test_delivery(int round, int capacity)
+{
+	struct producer producers[PRODUCERS];
+	struct consumer consumer;
+	long expected = (long) PRODUCERS * ITEMS_PER_PRODUCER;
+	long full_count = 0;
+	int i;
+
+	memset(&consumer, 0, sizeof(consumer));
+	consumer.sync_q = sccp_sync_queue_create("stress", sizeof(struct item), capacity);
+	if (!consumer.sync_q) {
+		fail("could not create queue\n");
+	}
+
+	producers_start(producers, consumer.sync_q, ITEMS_PER_PRODUCER, round);
+
+	while (consumer.received < expected) {
+		if (!consumer_take(&consumer, WAKEUP_TIMEOUT_MS) && __atomic_load_n(&producers_done, __ATOMIC_SEQ_CST) == PRODUCERS) {
+			fail("lost wakeup: %ld items pending but the fd is not ready\n", expected - consumer.received);
+		}
+	}
+
+	producers_join(producers);
+	consumer_check_complete(&consumer, producers);
+
+	/* nothing must be left */
+	consumer_drain(&consumer);
+	if (consumer.received != expected) {
+		fail("received %ld items, expected %ld\n", consumer.received, expected);
+	}
+
+	if (capacity && consumer.max_batch > capacity) {
+		fail("took %d items at once from a queue of capacity %d\n", consumer.max_batch, capacity);
+	}
+
+	for (i = 0; i < PRODUCERS; i++) {
+		full_count += producers[i].full_count;
+	}
+
+	printf("delivery round %d, capacity %d: %ld items, %ld wakeups, max batch %d, %ld full\n",
+		round, capacity, consumer.received, consumer.wakeups, consumer.max_batch, full_count);
+
+	sccp_sync_queue_destroy(consumer.sync_q);
+}
+
+/*
+ * The queue is closed while the producers are putting items as fast as they can.
+ */
+static void test_close(int round)
+{
+	struct producer producers[PRODUCERS];
+	struct consumer consumer;
+	long put_count = 0;
+	int i;
+
+	memset(&consumer, 0, sizeof(consumer));
+	consumer.sync_q = sccp_sync_queue_create("stress", sizeof(struct item), 0);
+	if (!consumer.sync_q) {
+		fail("could not create queue\n");
+	}
+
+	producers_start(producers, consumer.sync_q, 0, round);
+
+	while (consumer.received < 100000 * (round + 1)) {
+		consumer_take(&consumer, WAKEUP_TIMEOUT_MS);
+	}
+
+	sccp_sync_queue_close(consumer.sync_q);
+	__atomic_store_n(&close_returned, 1, __ATOMIC_SEQ_CST);
+
+	producers_join(producers);
+	consumer_drain(&consumer);
+	consumer_check_complete(&consumer, producers);
+
+	for (i = 0; i < PRODUCERS; i++) {
+		if (producers[i].put_after_close) {
+			fail("producer %d: %d items put after the queue was closed\n", i, producers[i].put_after_close);
+		}
+
+		put_count += producers[i].put_count;
+	}
+
+	printf("close round %d: %ld items put before close, all received\n", round, put_count);
+
+	sccp_sync_queue_destroy(consumer.sync_q);
+}
+
+int main(void)
+{
+	int round;
+
+	for (round = 0; round < ROUNDS; round++) {
+		test_delivery(round, 0);
+		test_delivery(round, CAPACITY);
+		test_close(round);
+	}
+
+	printf("OK\n");
+
+	return 0;
+}
@@ -0,0 +1,189 @@
+/*
+ * Microbenchmark of the task runner (sccp_task_runner_*).
+ *
+ * The program is linked once with the timing wheel of sccp_task.c (task_bench) and once
+ * with the previous list and heap runner of sccp_task_list.c (task_bench_list), so that
+ * both can be compared on the operations done by a session:
+ *
+ * - reschedule: an existing task is pushed back, then the next deadline is asked for,
+ *   like the keepalive on every message received followed by the reactor computing
+ *   its timeout
+ * - add/remove: a task is added then removed before it is due, like a dial timeout
+ * - add/run: tasks due now are added then run
+ *
+ * Each operation is measured with a runner holding 4 and 32 other tasks, the former
+ * being the usual case for a session.
+ */
+#include <time.h>
+
+#include <asterisk.h>
+
+#include "sccp_task.h"
+
+#define ITERATIONS 1000000
+#define RUN_BATCH 8
+/* every measure is the best of a few runs, to filter out the noise */
+#define RUNS 5
+
+/* same layout as the session task data */
+struct task_data {
+	void *callback;
+	void *data;
+};
+
+static unsigned long run_count;
+
+static void on_task(struct sccp_session *session, void *data)
+{
+	run_count++;
+}
+
+static void on_other_task(struct sccp_session *session, void *data)
+{
+}
+
+static double now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static struct task_data task_data_at(int i)
+{
+	struct task_data data = {
+		.callback = on_other_task,
+		.data = (void *) (intptr_t) (i + 1),
+	};
+
+	return data;
+}
+
+static struct sccp_task_runner *runner_create(int n_tasks)
+{
+	struct sccp_task_runner *runner;
+	struct task_data data;
+	int i;
+
+	runner = sccp_task_runner_create(sizeof(struct task_data));
+	if (!runner) {
+		fprintf(stderr, "could not create runner\n");
+		exit(1);
+	}
+
+	/* other tasks, spread over a few minutes */
+	for (i = 0; i < n_tasks; i++) {
+		data = task_data_at(i);
+		sccp_task_runner_add(runner, on_other_task, &data, 10 + (i * 37) % 300);
+	}
+
+	return runner;
+}
+
+static double bench_reschedule(int n_tasks)
+{
+	struct sccp_task_runner *runner = runner_create(n_tasks);
+	struct task_data data = task_data_at(-2);
+	struct timeval when;
+	double start;
+	double end;
+	int i;
+
+	sccp_task_runner_add(runner, on_task, &data, 30);
+
+	start = now_ns();
+	for (i = 0; i < ITERATIONS; i++) {
+		sccp_task_runner_add(runner, on_task, &data, 30);
+		sccp_task_runner_next_when(runner, &when);
+	}
+	end = now_ns();
+
+	sccp_task_runner_destroy(runner);
+
+	return (end - start) / ITERATIONS;
+}
+
+static double bench_add_remove(int n_tasks)
+{
+	struct sccp_task_runner *runner = runner_create(n_tasks);
+	struct task_data data = task_data_at(-2);
+	double start;
+	double end;
+	int i;
+
+	start = now_ns();
+	for (i = 0; i < ITERATIONS; i++) {
+		sccp_task_runner_add(runner, on_task, &data, 5);
+		sccp_task_runner_remove(runner, on_task, &data);
+	}
+	end = now_ns();
+
+	sccp_task_runner_destroy(runner);
+
+	return (end - start) / ITERATIONS;
+}
+
+static double bench_add_run(int n_tasks)
+{
+	struct sccp_task_runner *runner = runner_create(n_tasks);
+	struct task_data data;
+	double start;
+	double end;
+	int i;
+	int j;
+
+	run_count = 0;
+
+	start = now_ns();
+	for (i = 0; i < ITERATIONS / RUN_BATCH; i++) {
+		for (j = 0; j < RUN_BATCH; j++) {
+			data = task_data_at(-2 - j);
+			sccp_task_runner_add_ms(runner, on_task, &data, -1);
+		}
+
+		sccp_task_runner_run(runner, NULL);
+	}
+	end = now_ns();
+
+	sccp_task_runner_destroy(runner);
+
+	if (run_count != (unsigned long) (ITERATIONS / RUN_BATCH) * RUN_BATCH) {
+		fprintf(stderr, "FAIL: %lu tasks run, expected %d\n", run_count, ITERATIONS / RUN_BATCH * RUN_BATCH);
+		exit(1);
+	}
+
+	return (end - start) / ((ITERATIONS / RUN_BATCH) * RUN_BATCH);
+}
+
+static double best_of(double (*bench)(int n_tasks), int n_tasks)
+{
+	double best = 0;
+	double t;
+	int i;
+
+	for (i = 0; i < RUNS; i++) {
+		t = bench(n_tasks);
+		if (!i || t < best) {
+			best = t;
+		}
+	}
+
+	return best;
+}
+
+int main(int argc, char *argv[])
+{
+	static const int n_tasks[] = { 4, 32 };
+	size_t i;
+
+	printf("%s\n", argv[0]);
+	for (i = 0; i < ARRAY_LEN(n_tasks); i++) {
+		printf("  %2d tasks: reschedule %6.1f ns, add/remove %6.1f ns, add/run %6.1f ns per task\n",
+			n_tasks[i], best_of(bench_reschedule, n_tasks[i]), best_of(bench_add_remove, n_tasks[i]),
+			best_of(bench_add_run, n_tasks[i]));
+	}
+
+	return 0;
+}